@@ -0,0 +1,348 @@
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "autotune.h"
+#include "output.h"
+
+
+// Arrangements are drawn once, up to this many elements in all, and every
+// evaluator is timed on the same ones.
+#define POOL_ARRANGEMENTS 64
+#define POOL_ELEMENTS (1 << 22)
+
+// Each timed batch runs for at least this long, and every evaluator gets this
+// many of them, taken in turn so that any drift in the machine hits them all.
+#define BATCH_SECONDS 5e-3
+#define REPETITIONS 7
+
+#define LINE_LENGTH 512
+
+const char *const evaluator_names[EVALUATOR_COUNT] = {
+    "optimized",
+    "longest-loop",
+    "bitset",
+};
+
+struct pool {
+    prisoner_ctx *ctx;
+    unsigned int *boxes;
+    unsigned int *arrangements;
+    unsigned int len;
+    unsigned int next;
+};
+
+
+bool _evaluator_applies(const prisoner_config *config) {
+    return (config->box_count == 0 || config->box_count == config->count)
+        && config->mapping == PRISONER_MAPPING_PERMUTATION
+        && config->budgets == NULL;
+}
+
+
+const char *_tuning_cache_default(void) {
+    static char path[LINE_LENGTH];
+    const char *cache = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+
+    if (cache != NULL && cache[0] != '\0') {
+        mkdir(cache, 0755);
+        snprintf(path, sizeof(path), "%s/prisoner-autotune.tsv", cache);
+    } else if (home != NULL && home[0] != '\0') {
+        snprintf(path, sizeof(path), "%s/.cache", home);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/.cache/prisoner-autotune.tsv", home);
+    } else {
+        return NULL;
+    }
+
+    return path;
+}
+
+
+static void _cpu_model(char *model, size_t size) {
+    FILE *file = fopen("/proc/cpuinfo", "r");
+    char line[LINE_LENGTH];
+
+    snprintf(model, size, "unknown");
+
+    if (file == NULL) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char *value = strchr(line, ':');
+
+        if (strncmp(line, "model name", 10) == 0 && value != NULL) {
+            value += strspn(value + 1, " \t") + 1;
+            value[strcspn(value, "\t\n")] = '\0';
+            snprintf(model, size, "%s", value);
+            break;
+        }
+    }
+
+    fclose(file);
+}
+
+
+// Everything but the evaluator, tab-separated, for matching cache lines.
+static void _cache_key(const prisoner_config *config, char *key, size_t size) {
+    char model[LINE_LENGTH / 2];
+
+    _cpu_model(model, sizeof(model));
+    snprintf(
+        key,
+        size,
+        "%s\t%u\t%u\t%s\t%d\t",
+        model,
+        config->count,
+        config->chances,
+        warden_names[config->warden],
+        config->relabel
+    );
+}
+
+
+static bool _cache_lookup(const char *cache_path, const char *key, enum evaluator *choice) {
+    FILE *file = fopen(cache_path, "r");
+    size_t key_length = strlen(key);
+    char line[LINE_LENGTH];
+    bool found = false;
+
+    if (file == NULL) {
+        return false;
+    }
+
+    while (!found && fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, key, key_length) != 0) {
+            continue;
+        }
+
+        line[strcspn(line, "\n")] = '\0';
+
+        // A name this build does not know is as good as a miss.
+        for (int i = 0; i < EVALUATOR_COUNT; i++) {
+            if (strcmp(line + key_length, evaluator_names[i]) == 0) {
+                *choice = i;
+                found = true;
+            }
+        }
+    }
+
+    fclose(file);
+
+    return found;
+}
+
+
+// Rewrites the cache beside itself with the key's line replaced, and renames it
+// over the old one, so that concurrent readers see either version whole.
+static int _cache_store(const char *cache_path, const char *key, enum evaluator choice) {
+    size_t key_length = strlen(key);
+    char line[LINE_LENGTH], *temporary;
+    FILE *old, *new;
+    int error = 0;
+
+    if (asprintf(&temporary, "%s.tmp", cache_path) < 0) {
+        return ENOMEM;
+    }
+
+    new = fopen(temporary, "w");
+
+    if (new == NULL) {
+        error = errno;
+        free(temporary);
+        return error;
+    }
+
+    old = fopen(cache_path, "r");
+
+    if (old != NULL) {
+        while (fgets(line, sizeof(line), old) != NULL) {
+            if (strncmp(line, key, key_length) != 0) {
+                fputs(line, new);
+            }
+        }
+
+        fclose(old);
+    } else {
+        fputs("# cpu\tprisoners\tchances\twarden\trelabel\tevaluator\n", new);
+    }
+
+    fprintf(new, "%s%s\n", key, evaluator_names[choice]);
+
+    if (ferror(new)) {
+        error = EIO;
+    }
+
+    if (fclose(new) != 0 && error == 0) {
+        error = errno;
+    }
+
+    if (error == 0 && rename(temporary, cache_path) != 0) {
+        error = errno;
+    }
+
+    if (error != 0) {
+        remove(temporary);
+    }
+
+    free(temporary);
+
+    return error;
+}
+
+
+static double _now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static int _pool_create(struct pool *pool, const prisoner_config *config, uint64_t seed) {
+    memset(pool, 0, sizeof(struct pool));
+    pool->ctx = prisoner_create(config);
+
+    if (pool->ctx == NULL) {
+        return errno;
+    }
+
+    pool->len = POOL_ELEMENTS / config->count;
+    pool->len = pool->len < 1 ? 1 : pool->len > POOL_ARRANGEMENTS ? POOL_ARRANGEMENTS : pool->len;
+    pool->arrangements = malloc((size_t) pool->len * config->count * sizeof(unsigned int));
+
+    if (pool->arrangements == NULL) {
+        prisoner_destroy(pool->ctx);
+        return ENOMEM;
+    }
+
+    prisoner_seed(pool->ctx, seed);
+    pool->boxes = pool->ctx->boxes;
+
+    for (unsigned int i = 0; i < pool->len; i++) {
+        _arrange_boxes(pool->ctx);
+        memcpy(
+            pool->arrangements + (size_t) i * config->count,
+            pool->boxes,
+            config->count * sizeof(unsigned int)
+        );
+    }
+
+    return 0;
+}
+
+
+static void _pool_destroy(struct pool *pool) {
+    // The context must free the boxes it allocated, not a pool entry.
+    pool->ctx->boxes = pool->boxes;
+    prisoner_destroy(pool->ctx);
+    free(pool->arrangements);
+}
+
+
+static double _time_batch(struct pool *pool, uint64_t iterations) {
+    unsigned int count = pool->ctx->config.count;
+    volatile uint64_t wins = 0;
+    double start = _now();
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        pool->ctx->boxes = pool->arrangements + (size_t) pool->next * count;
+        pool->next = (pool->next + 1) % pool->len;
+        wins += _evaluate(pool->ctx);
+    }
+
+    return _now() - start;
+}
+
+
+static int _compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+static void _measure(struct pool *pool, struct tuning *tuning) {
+    uint64_t iterations[EVALUATOR_COUNT];
+    double samples[EVALUATOR_COUNT][REPETITIONS];
+
+    // Enough trials per batch for the clock not to matter, which also warms up.
+    for (int evaluator = 0; evaluator < EVALUATOR_COUNT; evaluator++) {
+        pool->ctx->evaluator = evaluator;
+        iterations[evaluator] = 1;
+
+        while (_time_batch(pool, iterations[evaluator]) < BATCH_SECONDS) {
+            iterations[evaluator] *= 2;
+        }
+    }
+
+    for (int repetition = 0; repetition < REPETITIONS; repetition++) {
+        for (int evaluator = 0; evaluator < EVALUATOR_COUNT; evaluator++) {
+            pool->ctx->evaluator = evaluator;
+            samples[evaluator][repetition] = _time_batch(pool, iterations[evaluator])
+                / iterations[evaluator] * 1e9;
+        }
+    }
+
+    tuning->choice = EVALUATOR_OPTIMIZED;
+
+    for (int evaluator = 0; evaluator < EVALUATOR_COUNT; evaluator++) {
+        qsort(samples[evaluator], REPETITIONS, sizeof(double), _compare_doubles);
+        tuning->ns_per_trial[evaluator] = samples[evaluator][REPETITIONS / 2];
+
+        if (tuning->ns_per_trial[evaluator] < tuning->ns_per_trial[tuning->choice]) {
+            tuning->choice = evaluator;
+        }
+    }
+}
+
+
+int _autotune(
+    const prisoner_config *config,
+    uint64_t seed,
+    const char *cache_path,
+    bool force,
+    struct tuning *tuning
+) {
+    char key[LINE_LENGTH];
+    struct pool pool;
+
+    memset(tuning, 0, sizeof(struct tuning));
+
+    if (!_evaluator_applies(config)) {
+        return EINVAL;
+    }
+
+    _cache_key(config, key, sizeof(key));
+
+    if (!force && cache_path != NULL && _cache_lookup(cache_path, key, &tuning->choice)) {
+        tuning->cached = true;
+        return 0;
+    }
+
+    int error = _pool_create(&pool, config, seed);
+
+    if (error != 0) {
+        return error;
+    }
+
+    _measure(&pool, tuning);
+    _pool_destroy(&pool);
+
+    if (cache_path != NULL) {
+        error = _cache_store(cache_path, key, tuning->choice);
+    }
+
+    // Only a forced tuning exists to update the cache, so only it fails when it
+    // cannot.
+    return force ? error : 0;
+}
@@ -0,0 +1,45 @@
+#ifndef PRISONER_AUTOTUNE_H
+#define PRISONER_AUTOTUNE_H
+
+// Picks the fastest evaluator for a configuration on this machine by timing
+// each on the same arrangements, and remembers the choice in a cache file keyed
+// by the CPU model and the parameters that change what the evaluators see.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "engine.h"
+
+extern const char *const evaluator_names[EVALUATOR_COUNT];
+
+struct tuning {
+    enum evaluator choice;
+
+    // Whether `choice` came from the cache, in which case nothing was timed.
+    bool cached;
+
+    // The median time each evaluator took per trial.
+    double ns_per_trial[EVALUATOR_COUNT];
+};
+
+// Whether the evaluator can be chosen for `config` at all.
+bool _evaluator_applies(const prisoner_config *config);
+
+// Where the cache is kept unless told otherwise, or NULL if there is no home
+// directory to put it in.
+const char *_tuning_cache_default(void);
+
+// Looks the configuration up in `cache_path` unless `force`, and otherwise times
+// every evaluator and records the winner there. A cache that cannot be read is
+// treated as empty, and one that cannot be written is left as it was, which is
+// only an error when `force` is set. Returns 0 or an errno value, with `tuning`
+// filled in even if the cache could not be written.
+int _autotune(
+    const prisoner_config *config,
+    uint64_t seed,
+    const char *cache_path,
+    bool force,
+    struct tuning *tuning
+);
+
+#endif
@@ -0,0 +1,2414 @@
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <sched.h>
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prisoner.h"
+#include "engine.h"
+#include "options.h"
+#include "lehmer.h"
+
+
+// Benchmarks for libprisoner, one mode per subcommand:
+//  - kernels: times the library's kernels one at a time, over a grid of counts
+//    and chances. Each measurement is a number of repetitions of a batch of
+//    iterations, where the batch is sized during warmup to run for at least the
+//    minimum time, and is reported as the median time per iteration along with
+//    its median absolute deviation.
+//  - threads: runs one fixed parallel workload on more and more threads, laid
+//    out across the machine in different ways, to show where it stops scaling.
+//  - cache: sweeps the count geometrically through the cache sizes, timing the
+//    shuffle and the walk per element, to show what each level costs them.
+//  - compare: compares two runs of the kernels recorded in a history file,
+//    flagging any measurement that got significantly slower.
+
+#define MAX_COUNTS 32
+#define MAX_CHANCES 16
+#define MAX_REPETITIONS 1000
+
+// Evaluation kernels cycle through a pool of arrangements drawn up front, so they
+// are timed on many different loop structures rather than one. The pool is kept
+// small enough to stay in cache for small counts, where a real trial walks the
+// arrangement it has just shuffled.
+#define POOL_ARRANGEMENTS 256
+#define POOL_ELEMENTS (1 << 22)
+
+#define MAX_THREADS 1024
+
+// Where `kernels --history` appends its results by default, and where `compare`
+// reads them from.
+#define HISTORY_FILE "bench-history.jsonl"
+
+// The Makefile records the revision and flags the benchmark was built from.
+#ifndef BENCH_REVISION
+#define BENCH_REVISION "unknown"
+#endif
+
+#ifndef BENCH_CFLAGS
+#define BENCH_CFLAGS "unknown"
+#endif
+
+#if defined(__clang__)
+#define BENCH_COMPILER "clang " __clang_version__
+#elif defined(__GNUC__)
+#define BENCH_COMPILER "gcc " __VERSION__
+#else
+#define BENCH_COMPILER "unknown"
+#endif
+
+enum {
+    // Long options without a short form.
+    OPTION_SEED = 256,
+};
+
+enum format {
+    FORMAT_TEXT,
+    FORMAT_CSV,
+    FORMAT_JSONL,
+};
+
+// The context each kernel needs.
+enum variant {
+    VARIANT_RANDOM,
+    VARIANT_RELABEL,
+    VARIANT_LEAKED,
+    VARIANT_BUDGETS,
+    VARIANT_FUNCTION,
+};
+
+struct bench {
+    prisoner_ctx *ctx;
+    unsigned int *budgets;
+
+    // The context's own boxes, which evaluation kernels swap out for arrangements
+    // from the pool.
+    unsigned int *boxes;
+    unsigned int *pool;
+    unsigned int pool_len;
+    unsigned int next;
+
+    // The pool's arrangements encoded compactly, with room to encode one.
+    uint8_t *packed;
+    size_t packed_len;
+    unsigned int *scratch;
+};
+
+struct kernel {
+    const char *name;
+    enum variant variant;
+    bool uses_chances;
+    bool pooled;
+
+    // Whether an iteration handles a single value rather than `count` of them,
+    // in which case it is its own element.
+    bool scalar;
+
+    // Runs `iterations` iterations, returning something derived from every one
+    // of them so the compiler cannot drop any.
+    uint64_t (*run)(struct bench *bench, uint64_t iterations);
+};
+
+struct measurement {
+    const struct kernel *kernel;
+    unsigned int count;
+    unsigned int chances;
+    uint64_t iterations;
+    unsigned int repetitions;
+
+    // Nanoseconds per iteration for each repetition, in the order they ran.
+    double samples[MAX_REPETITIONS];
+    double median;
+    double mad;
+    double min;
+};
+
+static volatile uint64_t _sink;
+
+
+static void _next_arrangement(struct bench *bench) {
+    bench->ctx->boxes = bench->pool + (size_t) bench->next * bench->ctx->config.box_count;
+    bench->next = bench->next + 1 == bench->pool_len ? 0 : bench->next + 1;
+}
+
+
+static uint64_t _run_generate_range(struct bench *bench, uint64_t iterations) {
+    struct rng *rng = &bench->ctx->rng;
+    unsigned int max = bench->ctx->config.count;
+    uint64_t sum = 0;
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        sum += _generate_range(rng, max);
+    }
+
+    return sum;
+}
+
+
+static uint64_t _run_generate_boxes(struct bench *bench, uint64_t iterations) {
+    uint64_t sum = 0;
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        _generate_boxes(bench->ctx);
+        sum += bench->ctx->boxes[0];
+    }
+
+    return sum;
+}
+
+
+static uint64_t _run_arrange_boxes(struct bench *bench, uint64_t iterations) {
+    uint64_t sum = 0;
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        _arrange_boxes(bench->ctx);
+        sum += bench->ctx->boxes[0];
+    }
+
+    return sum;
+}
+
+
+static uint64_t _run_generate_mapping(struct bench *bench, uint64_t iterations) {
+    uint64_t sum = 0;
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        _generate_mapping(bench->ctx);
+        sum += bench->ctx->boxes[0];
+    }
+
+    return sum;
+}
+
+
+static uint64_t _run_optimized(struct bench *bench, uint64_t iterations) {
+    uint64_t sum = 0;
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        _next_arrangement(bench);
+        sum += run_optimized(bench->ctx);
+    }
+
+    return sum;
+}
+
+
+static uint64_t _run_bitset(struct bench *bench, uint64_t iterations) {
+    uint64_t sum = 0;
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        _next_arrangement(bench);
+        sum += run_bitset(bench->ctx);
+    }
+
+    return sum;
+}
+
+
+static uint64_t _run_budgets(struct bench *bench, uint64_t iterations) {
+    uint64_t sum = 0;
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        _next_arrangement(bench);
+        sum += run_budgets(bench->ctx);
+    }
+
+    return sum;
+}
+
+
+static uint64_t _run_mapping(struct bench *bench, uint64_t iterations) {
+    uint64_t sum = 0;
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        _next_arrangement(bench);
+        sum += run_mapping(bench->ctx);
+    }
+
+    return sum;
+}
+
+
+static uint64_t _run_cycle_lengths(struct bench *bench, uint64_t iterations) {
+    uint64_t sum = 0;
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        _next_arrangement(bench);
+        sum += _cycle_lengths(bench->ctx);
+    }
+
+    return sum;
+}
+
+
+static uint64_t _run_longest_loop(struct bench *bench, uint64_t iterations) {
+    uint64_t sum = 0;
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        _next_arrangement(bench);
+        sum += _longest_loop(bench->ctx);
+    }
+
+    return sum;
+}
+
+
+static uint64_t _run_lehmer_encode(struct bench *bench, uint64_t iterations) {
+    unsigned int count = bench->ctx->config.count;
+    uint64_t sum = 0;
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        uint8_t *dest = bench->packed + (size_t) bench->next * bench->packed_len;
+
+        _next_arrangement(bench);
+        _lehmer_encode(bench->ctx->boxes, count, bench->scratch, dest);
+        sum += dest[0];
+    }
+
+    return sum;
+}
+
+
+static uint64_t _run_lehmer_decode(struct bench *bench, uint64_t iterations) {
+    unsigned int count = bench->ctx->config.count;
+    uint64_t sum = 0;
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        const uint8_t *src = bench->packed + (size_t) bench->next * bench->packed_len;
+
+        bench->next = bench->next + 1 == bench->pool_len ? 0 : bench->next + 1;
+        sum += _lehmer_decode(src, count, bench->boxes) + bench->boxes[0];
+    }
+
+    return sum;
+}
+
+
+static uint64_t _run_trial(struct bench *bench, uint64_t iterations) {
+    return prisoner_run(bench->ctx, iterations);
+}
+
+
+static const struct kernel kernels[] = {
+    {"generate_range", VARIANT_RANDOM, false, false, true, _run_generate_range},
+    {"generate_boxes", VARIANT_RANDOM, false, false, false, _run_generate_boxes},
+    {"arrange_relabel", VARIANT_RELABEL, false, false, false, _run_arrange_boxes},
+    {"arrange_leaked", VARIANT_LEAKED, false, false, false, _run_arrange_boxes},
+    {"generate_mapping", VARIANT_FUNCTION, false, false, false, _run_generate_mapping},
+    {"run_optimized", VARIANT_RANDOM, true, true, false, _run_optimized},
+    {"run_bitset", VARIANT_RANDOM, true, true, false, _run_bitset},
+    {"run_budgets", VARIANT_BUDGETS, true, true, false, _run_budgets},
+    {"run_mapping", VARIANT_FUNCTION, true, true, false, _run_mapping},
+    {"cycle_lengths", VARIANT_RANDOM, false, true, false, _run_cycle_lengths},
+    {"longest_loop", VARIANT_RANDOM, false, true, false, _run_longest_loop},
+    {"lehmer_encode", VARIANT_RANDOM, false, true, false, _run_lehmer_encode},
+    {"lehmer_decode", VARIANT_RANDOM, false, true, false, _run_lehmer_decode},
+    {"trial", VARIANT_RANDOM, true, false, false, _run_trial},
+};
+
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+
+
+static void _bench_destroy(struct bench *bench) {
+    if (bench->ctx != NULL) {
+        bench->ctx->boxes = bench->boxes;
+        prisoner_destroy(bench->ctx);
+    }
+
+    free(bench->budgets);
+    free(bench->pool);
+    free(bench->packed);
+    free(bench->scratch);
+    memset(bench, 0, sizeof(struct bench));
+}
+
+
+static bool _bench_create(
+    struct bench *bench,
+    const struct kernel *kernel,
+    unsigned int count,
+    unsigned int chances,
+    unsigned int max_pool,
+    uint64_t seed
+) {
+    prisoner_config config = prisoner_config_default();
+
+    memset(bench, 0, sizeof(struct bench));
+    config.count = count;
+    config.chances = chances;
+
+    switch (kernel->variant) {
+        case VARIANT_RANDOM:
+            break;
+        case VARIANT_RELABEL:
+            config.warden = PRISONER_WARDEN_CYCLE;
+            config.relabel = true;
+            break;
+        case VARIANT_LEAKED:
+            config.warden = PRISONER_WARDEN_LEAKED;
+            break;
+        case VARIANT_BUDGETS:
+            bench->budgets = malloc(count * sizeof(unsigned int));
+
+            if (bench->budgets == NULL) {
+                errno = ENOMEM;
+                return false;
+            }
+
+            for (unsigned int prisoner = 0; prisoner < count; prisoner++) {
+                bench->budgets[prisoner] = chances;
+            }
+
+            config.budgets = bench->budgets;
+            break;
+        case VARIANT_FUNCTION:
+            config.mapping = PRISONER_MAPPING_FUNCTION;
+            break;
+    }
+
+    bench->ctx = prisoner_create(&config);
+
+    if (bench->ctx == NULL) {
+        int error = errno;
+
+        _bench_destroy(bench);
+        errno = error;
+        return false;
+    }
+
+    prisoner_seed(bench->ctx, seed);
+    bench->boxes = bench->ctx->boxes;
+
+    if (!kernel->pooled) {
+        return true;
+    }
+
+    bench->pool_len = POOL_ELEMENTS / count;
+
+    if (bench->pool_len > max_pool) {
+        bench->pool_len = max_pool;
+    } else if (bench->pool_len == 0) {
+        bench->pool_len = 1;
+    }
+
+    bench->pool = malloc((size_t) bench->pool_len * count * sizeof(unsigned int));
+
+    if (bench->pool == NULL) {
+        _bench_destroy(bench);
+        errno = ENOMEM;
+        return false;
+    }
+
+    for (unsigned int i = 0; i < bench->pool_len; i++) {
+        if (kernel->variant == VARIANT_FUNCTION) {
+            _generate_mapping(bench->ctx);
+        } else {
+            _generate_boxes(bench->ctx);
+        }
+
+        memcpy(bench->pool + (size_t) i * count, bench->boxes, count * sizeof(unsigned int));
+    }
+
+    if (kernel->variant == VARIANT_FUNCTION) {
+        return true;
+    }
+
+    // Only permutations can be encoded, and decoding needs them encoded first.
+    bench->packed_len = _lehmer_bytes(count);
+    bench->packed = malloc((size_t) bench->pool_len * bench->packed_len + 1);
+    bench->scratch = malloc(2 * (size_t) count * sizeof(unsigned int));
+
+    if (bench->packed == NULL || bench->scratch == NULL) {
+        _bench_destroy(bench);
+        errno = ENOMEM;
+        return false;
+    }
+
+    for (unsigned int i = 0; i < bench->pool_len; i++) {
+        _lehmer_encode(
+            bench->pool + (size_t) i * count,
+            count,
+            bench->scratch,
+            bench->packed + (size_t) i * bench->packed_len
+        );
+    }
+
+    return true;
+}
+
+
+static double _time_batch(struct bench *bench, const struct kernel *kernel, uint64_t iterations) {
+    struct timespec start_ts, end_ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_ts);
+    _sink += kernel->run(bench, iterations);
+    clock_gettime(CLOCK_MONOTONIC, &end_ts);
+
+    return (end_ts.tv_sec - start_ts.tv_sec) * 1e9 + (end_ts.tv_nsec - start_ts.tv_nsec);
+}
+
+
+static uint64_t _calibrate(struct bench *bench, const struct kernel *kernel, double min_ns) {
+    uint64_t iterations = 1;
+
+    for (;;) {
+        double elapsed = _time_batch(bench, kernel, iterations);
+
+        if (elapsed >= min_ns) {
+            return iterations;
+        }
+
+        // Aim a little past the target, but grow by at most 10x at a time so one
+        // unusually fast batch cannot overshoot it by much.
+        double scale = elapsed > 0 ? 1.2 * min_ns / elapsed : 10;
+
+        if (scale < 2) {
+            scale = 2;
+        } else if (scale > 10) {
+            scale = 10;
+        }
+
+        iterations = (uint64_t) ceil(iterations * scale);
+    }
+}
+
+
+static int _compare_doubles(const void *left, const void *right) {
+    double a = *(const double *) left, b = *(const double *) right;
+
+    return (a > b) - (a < b);
+}
+
+
+static double _median(double *values, unsigned int len) {
+    qsort(values, len, sizeof(double), _compare_doubles);
+
+    if (len % 2 == 1) {
+        return values[len / 2];
+    }
+
+    return (values[len / 2 - 1] + values[len / 2]) / 2;
+}
+
+
+static void _summarize(struct measurement *measurement) {
+    double sorted[MAX_REPETITIONS];
+    unsigned int len = measurement->repetitions;
+
+    memcpy(sorted, measurement->samples, len * sizeof(double));
+    measurement->median = _median(sorted, len);
+    measurement->min = sorted[0];
+
+    for (unsigned int i = 0; i < len; i++) {
+        sorted[i] = fabs(measurement->samples[i] - measurement->median);
+    }
+
+    measurement->mad = _median(sorted, len);
+}
+
+
+static void _measure(
+    struct bench *bench,
+    struct measurement *measurement,
+    unsigned int warmup,
+    double min_ns
+) {
+    const struct kernel *kernel = measurement->kernel;
+    uint64_t iterations = _calibrate(bench, kernel, min_ns);
+
+    for (unsigned int i = 0; i < warmup; i++) {
+        _time_batch(bench, kernel, iterations);
+    }
+
+    for (unsigned int i = 0; i < measurement->repetitions; i++) {
+        measurement->samples[i] = _time_batch(bench, kernel, iterations) / iterations;
+    }
+
+    measurement->iterations = iterations;
+    _summarize(measurement);
+}
+
+
+static void _print_kernels_header(enum format format) {
+    if (format == FORMAT_TEXT) {
+        printf(
+            "%-18s %10s %10s %5s %12s %14s %10s %12s\n",
+            "kernel", "count", "chances", "reps", "iterations",
+            "ns/trial", "mad", "ns/element"
+        );
+    } else if (format == FORMAT_CSV) {
+        printf(
+            "kernel,count,chances,repetitions,iterations,"
+            "median_ns,mad_ns,min_ns,ns_per_element\n"
+        );
+    }
+}
+
+
+static void _print_measurement(enum format format, const struct measurement *measurement) {
+    const char *name = measurement->kernel->name;
+    double per_element = measurement->kernel->scalar
+        ? measurement->median
+        : measurement->median / measurement->count;
+
+    switch (format) {
+        case FORMAT_TEXT:
+            printf(
+                "%-18s %10u %10u %5u %12llu %14.2f %10.2f %12.3f\n",
+                name,
+                measurement->count,
+                measurement->chances,
+                measurement->repetitions,
+                (unsigned long long) measurement->iterations,
+                measurement->median,
+                measurement->mad,
+                per_element
+            );
+            break;
+        case FORMAT_CSV:
+            printf(
+                "%s,%u,%u,%u,%llu,%.3f,%.3f,%.3f,%.5f\n",
+                name,
+                measurement->count,
+                measurement->chances,
+                measurement->repetitions,
+                (unsigned long long) measurement->iterations,
+                measurement->median,
+                measurement->mad,
+                measurement->min,
+                per_element
+            );
+            break;
+        case FORMAT_JSONL:
+            printf(
+                "{\"kernel\":\"%s\",\"count\":%u,\"chances\":%u,\"repetitions\":%u,"
+                "\"iterations\":%llu,\"median_ns\":%.3f,\"mad_ns\":%.3f,"
+                "\"min_ns\":%.3f,\"ns_per_element\":%.5f,\"samples_ns\":[",
+                name,
+                measurement->count,
+                measurement->chances,
+                measurement->repetitions,
+                (unsigned long long) measurement->iterations,
+                measurement->median,
+                measurement->mad,
+                measurement->min,
+                per_element
+            );
+
+            for (unsigned int i = 0; i < measurement->repetitions; i++) {
+                printf("%s%.3f", i == 0 ? "" : ",", measurement->samples[i]);
+            }
+
+            printf("]}\n");
+            break;
+    }
+
+    fflush(stdout);
+}
+
+
+static bool _parse_format(const char *arg, enum format *format) {
+    if (strcmp(arg, "text") == 0) {
+        *format = FORMAT_TEXT;
+    } else if (strcmp(arg, "csv") == 0) {
+        *format = FORMAT_CSV;
+    } else if (strcmp(arg, "jsonl") == 0) {
+        *format = FORMAT_JSONL;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+
+// Parses a comma-separated list of fractions in (0, 1].
+static bool _parse_fraction_list(
+    const char *arg,
+    double *values,
+    unsigned int max_len,
+    unsigned int *len
+) {
+    const char *token = arg;
+
+    *len = 0;
+
+    while (*len < max_len) {
+        char *end = NULL;
+
+        errno = 0;
+        values[*len] = strtod(token, &end);
+
+        if (errno != 0 || end == token || values[*len] <= 0 || values[*len] > 1) {
+            return false;
+        }
+
+        (*len)++;
+
+        if (*end == '\0') {
+            return true;
+        }
+
+        if (*end != ',') {
+            return false;
+        }
+
+        token = end + 1;
+    }
+
+    return false;
+}
+
+
+// Marks the kernels named in a comma-separated list.
+static bool _parse_kernels(const char *arg, bool *selected) {
+    const char *token = arg;
+
+    memset(selected, false, KERNEL_COUNT * sizeof(bool));
+
+    for (;;) {
+        size_t len = strcspn(token, ",");
+        bool found = false;
+
+        for (size_t i = 0; i < KERNEL_COUNT; i++) {
+            if (strlen(kernels[i].name) == len && strncmp(kernels[i].name, token, len) == 0) {
+                selected[i] = found = true;
+            }
+        }
+
+        if (!found) {
+            return false;
+        }
+
+        if (token[len] == '\0') {
+            return true;
+        }
+
+        token += len + 1;
+    }
+}
+
+
+// Identifies the run that a recorded measurement came from.
+struct run_info {
+    char id[32];
+    char revision[64];
+    char compiler[128];
+    char cflags[256];
+    char cpu[128];
+    char host[64];
+};
+
+
+// Copies `value` into `dest` with anything that would need escaping in a JSON
+// string replaced, so it can be written and read back without an escaper.
+static void _json_safe_copy(char *dest, size_t size, const char *value) {
+    size_t i = 0;
+
+    for (; i + 1 < size && value[i] != '\0'; i++) {
+        char c = value[i];
+
+        dest[i] = c == '"' || c == '\\' || (unsigned char) c < 0x20 ? '\'' : c;
+    }
+
+    dest[i] = '\0';
+}
+
+
+static void _run_info_init(struct run_info *run) {
+    time_t now = time(NULL);
+    char line[512], host[64] = "unknown";
+    FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+
+    // Runs are told apart by when they started, and by which process ran them in
+    // case two start in the same second.
+    size_t len = strftime(run->id, sizeof(run->id), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    snprintf(run->id + len, sizeof(run->id) - len, "-%ld", (long) getpid());
+    _json_safe_copy(run->revision, sizeof(run->revision), BENCH_REVISION);
+    _json_safe_copy(run->compiler, sizeof(run->compiler), BENCH_COMPILER);
+    _json_safe_copy(run->cflags, sizeof(run->cflags), BENCH_CFLAGS);
+    _json_safe_copy(run->cpu, sizeof(run->cpu), "unknown");
+
+    while (cpuinfo != NULL && fgets(line, sizeof(line), cpuinfo) != NULL) {
+        char *value = strchr(line, ':');
+
+        if (strncmp(line, "model name", 10) == 0 && value != NULL) {
+            value[strcspn(value, "\n")] = '\0';
+            _json_safe_copy(run->cpu, sizeof(run->cpu), value + 2);
+            break;
+        }
+    }
+
+    if (cpuinfo != NULL) {
+        fclose(cpuinfo);
+    }
+
+    gethostname(host, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    _json_safe_copy(run->host, sizeof(run->host), host);
+}
+
+
+static void _append_history(
+    FILE *history,
+    const struct run_info *run,
+    const struct measurement *measurement
+) {
+    fprintf(
+        history,
+        "{\"run\":\"%s\",\"revision\":\"%s\",\"compiler\":\"%s\",\"cflags\":\"%s\","
+        "\"cpu\":\"%s\",\"host\":\"%s\",\"kernel\":\"%s\",\"count\":%u,\"chances\":%u,"
+        "\"repetitions\":%u,\"iterations\":%llu,\"median_ns\":%.3f,\"mad_ns\":%.3f,"
+        "\"samples_ns\":[",
+        run->id,
+        run->revision,
+        run->compiler,
+        run->cflags,
+        run->cpu,
+        run->host,
+        measurement->kernel->name,
+        measurement->count,
+        measurement->chances,
+        measurement->repetitions,
+        (unsigned long long) measurement->iterations,
+        measurement->median,
+        measurement->mad
+    );
+
+    for (unsigned int i = 0; i < measurement->repetitions; i++) {
+        fprintf(history, "%s%.3f", i == 0 ? "" : ",", measurement->samples[i]);
+    }
+
+    fprintf(history, "]}\n");
+    fflush(history);
+}
+
+
+static void _kernels_usage(const char *name) {
+    fprintf(
+        stderr,
+        "usage: %s [kernels] [options]\n"
+        "       %s threads [options]\n"
+        "       %s cache [options]\n"
+        "       %s compare [options] [BASE [NEW]]\n"
+        "\n"
+        "  -k, --kernels LIST   comma-separated kernels to time (default: all)\n"
+        "  -n, --counts LIST    comma-separated numbers of prisoners (default:\n"
+        "                       10,100,...,100000000)\n"
+        "  -c, --chances LIST   comma-separated fractions of the count that each\n"
+        "                       prisoner may open (default: 0.5)\n"
+        "  -r, --repetitions N  timed repetitions per measurement (default: 10)\n"
+        "  -w, --warmup N       untimed repetitions after calibration (default: 2)\n"
+        "  -T, --min-time MS    minimum duration of each repetition (default: 10)\n"
+        "  -f, --format FORMAT  text, csv or jsonl (default: text)\n"
+        "  -H, --history FILE   also append the results, with the revision,\n"
+        "                       compiler, flags and CPU, to FILE for `compare`\n"
+        "      --seed N         seed for the random number generator (default: 0)\n"
+        "\n"
+        "kernels:",
+        name,
+        name,
+        name,
+        name
+    );
+
+    for (size_t i = 0; i < KERNEL_COUNT; i++) {
+        fprintf(stderr, "%s %s", i % 5 == 0 ? "\n " : "", kernels[i].name);
+    }
+
+    fprintf(stderr, "\n");
+}
+
+
+static int _kernels_main(int argc, char **argv) {
+    unsigned int counts[MAX_COUNTS] = {
+        10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+    };
+    unsigned int counts_len = 8;
+    double fractions[MAX_CHANCES] = {0.5};
+    unsigned int fractions_len = 1;
+    unsigned int repetitions = 10, warmup = 2, min_time = 10;
+    bool selected[KERNEL_COUNT];
+    enum format format = FORMAT_TEXT;
+    uint64_t seed = 0;
+    struct measurement *measurement;
+    const char *history_file = NULL;
+    FILE *history = NULL;
+    struct run_info run;
+    int option;
+
+    static const struct option options[] = {
+        {"kernels", required_argument, NULL, 'k'},
+        {"counts", required_argument, NULL, 'n'},
+        {"chances", required_argument, NULL, 'c'},
+        {"repetitions", required_argument, NULL, 'r'},
+        {"warmup", required_argument, NULL, 'w'},
+        {"min-time", required_argument, NULL, 'T'},
+        {"format", required_argument, NULL, 'f'},
+        {"history", required_argument, NULL, 'H'},
+        {"seed", required_argument, NULL, OPTION_SEED},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    for (size_t i = 0; i < KERNEL_COUNT; i++) {
+        selected[i] = true;
+    }
+
+    while ((option = getopt_long(argc, argv, "k:n:c:r:w:T:f:H:h", options, NULL)) != -1) {
+        bool valid = true;
+
+        switch (option) {
+            case 'k':
+                valid = _parse_kernels(optarg, selected);
+                break;
+            case 'n':
+                valid = _parse_uint_list(optarg, counts, MAX_COUNTS, &counts_len);
+
+                for (unsigned int i = 0; valid && i < counts_len; i++) {
+                    valid = counts[i] > 0;
+                }
+                break;
+            case 'c':
+                valid = _parse_fraction_list(optarg, fractions, MAX_CHANCES, &fractions_len);
+                break;
+            case 'r':
+                valid = _parse_uint(optarg, &repetitions)
+                    && repetitions > 0 && repetitions <= MAX_REPETITIONS;
+                break;
+            case 'w':
+                valid = _parse_uint(optarg, &warmup);
+                break;
+            case 'T':
+                valid = _parse_uint(optarg, &min_time) && min_time > 0;
+                break;
+            case 'f':
+                valid = _parse_format(optarg, &format);
+                break;
+            case 'H':
+                history_file = optarg;
+                break;
+            case OPTION_SEED:
+                valid = _parse_uint64(optarg, &seed);
+                break;
+            case 'h':
+                _kernels_usage(argv[0]);
+                return 0;
+            default:
+                valid = false;
+                optarg = NULL;
+                break;
+        }
+
+        if (!valid) {
+            if (optarg != NULL) {
+                fprintf(stderr, "%s: invalid value '%s'\n", argv[0], optarg);
+            }
+
+            _kernels_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (history_file != NULL) {
+        history = fopen(history_file, "a");
+
+        if (history == NULL) {
+            fprintf(stderr, "%s: could not open '%s': %s\n", argv[0], history_file, strerror(errno));
+            return 1;
+        }
+
+        _run_info_init(&run);
+    }
+
+    measurement = malloc(sizeof(struct measurement));
+
+    if (measurement == NULL) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+
+        if (history != NULL) {
+            fclose(history);
+        }
+
+        return 1;
+    }
+
+    _print_kernels_header(format);
+
+    for (size_t k = 0; k < KERNEL_COUNT; k++) {
+        const struct kernel *kernel = &kernels[k];
+
+        if (!selected[k]) {
+            continue;
+        }
+
+        for (unsigned int i = 0; i < counts_len; i++) {
+            // Kernels that never look at the chances are only timed once per count.
+            unsigned int chances_len = kernel->uses_chances ? fractions_len : 1;
+
+            for (unsigned int j = 0; j < chances_len; j++) {
+                unsigned int chances = (unsigned int) ceil(fractions[j] * counts[i]);
+                struct bench bench;
+
+                if (!_bench_create(&bench, kernel, counts[i], chances, POOL_ARRANGEMENTS, seed)) {
+                    fprintf(
+                        stderr,
+                        "%s: could not set up %s for %u prisoners: %s\n",
+                        argv[0],
+                        kernel->name,
+                        counts[i],
+                        strerror(errno)
+                    );
+                    free(measurement);
+
+                    if (history != NULL) {
+                        fclose(history);
+                    }
+
+                    return 1;
+                }
+
+                measurement->kernel = kernel;
+                measurement->count = counts[i];
+                measurement->chances = kernel->uses_chances ? chances : 0;
+                measurement->repetitions = repetitions;
+
+                _measure(&bench, measurement, warmup, min_time * 1e6);
+                _bench_destroy(&bench);
+                _print_measurement(format, measurement);
+
+                if (history != NULL) {
+                    _append_history(history, &run, measurement);
+                }
+            }
+        }
+    }
+
+    free(measurement);
+
+    if (history != NULL && fclose(history) != 0) {
+        fprintf(stderr, "%s: could not write '%s': %s\n", argv[0], history_file, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+
+// How the threads of a scaling run are placed on the machine.
+enum layout {
+    // Wherever the scheduler puts them.
+    LAYOUT_UNPINNED,
+    // Pinned one per physical core, so no two share a core's execution units.
+    LAYOUT_CORES,
+    // Pinned to every hardware thread, filling each core's SMT siblings before
+    // moving on to the next core.
+    LAYOUT_SMT,
+};
+
+static const char *layout_names[] = {"unpinned", "cores", "smt"};
+
+#define LAYOUT_COUNT (sizeof(layout_names) / sizeof(layout_names[0]))
+
+// The CPUs this process may run on, grouped by physical core.
+struct topology {
+    int cores[MAX_THREADS];
+    unsigned int cores_len;
+
+    // Every CPU, with the siblings of each core next to each other.
+    int cpus[MAX_THREADS];
+    unsigned int cpus_len;
+};
+
+struct cpu_core {
+    int cpu;
+    long core;
+};
+
+struct scaling_point {
+    enum layout layout;
+    unsigned int threads;
+    unsigned int repetitions;
+
+    // Wall time for each repetition, in the order they ran.
+    double samples[MAX_REPETITIONS];
+    double seconds;
+    double throughput;
+    double speedup;
+    double efficiency;
+
+    // The median across repetitions of how much longer the slowest thread ran
+    // than the average, and of the share of their wall time the threads were
+    // actually on a CPU.
+    double imbalance;
+    double cpu_share;
+};
+
+
+static long _read_topology_value(int cpu, const char *name) {
+    char path[128];
+    long value = -1;
+    FILE *file;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+    file = fopen(path, "r");
+
+    if (file == NULL) {
+        return -1;
+    }
+
+    if (fscanf(file, "%ld", &value) != 1) {
+        value = -1;
+    }
+
+    fclose(file);
+
+    return value;
+}
+
+
+static int _compare_cpu_cores(const void *left, const void *right) {
+    const struct cpu_core *a = left, *b = right;
+
+    if (a->core != b->core) {
+        return (a->core > b->core) - (a->core < b->core);
+    }
+
+    return (a->cpu > b->cpu) - (a->cpu < b->cpu);
+}
+
+
+static bool _detect_topology(struct topology *topology) {
+    struct cpu_core found[MAX_THREADS];
+    unsigned int found_len = 0;
+    cpu_set_t allowed;
+
+    memset(topology, 0, sizeof(struct topology));
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return false;
+    }
+
+    for (int cpu = 0; cpu < CPU_SETSIZE && found_len < MAX_THREADS; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) {
+            continue;
+        }
+
+        long package = _read_topology_value(cpu, "physical_package_id");
+        long core = _read_topology_value(cpu, "core_id");
+
+        // Without topology information, every CPU counts as a core of its own.
+        found[found_len].cpu = cpu;
+        found[found_len].core = package < 0 || core < 0
+            ? -1 - cpu
+            : (package << 20) | core;
+        found_len++;
+    }
+
+    qsort(found, found_len, sizeof(struct cpu_core), _compare_cpu_cores);
+
+    for (unsigned int i = 0; i < found_len; i++) {
+        topology->cpus[topology->cpus_len++] = found[i].cpu;
+
+        if (i == 0 || found[i].core != found[i - 1].core) {
+            topology->cores[topology->cores_len++] = found[i].cpu;
+        }
+    }
+
+    return found_len > 0;
+}
+
+
+static bool _measure_scaling(
+    struct scaling_point *point,
+    const struct topology *topology,
+    const prisoner_config *config,
+    uint64_t seed,
+    uint64_t trials
+) {
+    struct run_options options = {0};
+    double imbalances[MAX_REPETITIONS], cpu_shares[MAX_REPETITIONS];
+    // Each report holds the latency histograms, far too much for the stack.
+    struct thread_report *reports = calloc(point->threads, sizeof(struct thread_report));
+
+    if (reports == NULL) {
+        return false;
+    }
+
+    if (point->layout == LAYOUT_CORES) {
+        options.cpus = topology->cores;
+        options.cpus_len = topology->cores_len;
+    } else if (point->layout == LAYOUT_SMT) {
+        options.cpus = topology->cpus;
+        options.cpus_len = topology->cpus_len;
+    }
+
+    options.reports = reports;
+
+    for (unsigned int i = 0; i < point->repetitions; i++) {
+        prisoner_results results;
+        struct timespec start_ts, end_ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &start_ts);
+        errno = _run_parallel(config, seed, trials, point->threads, &options, &results);
+        clock_gettime(CLOCK_MONOTONIC, &end_ts);
+
+        if (errno != 0) {
+            free(reports);
+            return false;
+        }
+
+        double longest = 0, total = 0, cpu = 0;
+        unsigned int started = 0;
+
+        for (unsigned int t = 0; t < point->threads; t++) {
+            if (reports[t].trials == 0) {
+                continue;
+            }
+
+            started++;
+            total += reports[t].wall_seconds;
+            cpu += reports[t].cpu_seconds;
+
+            if (reports[t].wall_seconds > longest) {
+                longest = reports[t].wall_seconds;
+            }
+        }
+
+        point->samples[i] = (end_ts.tv_sec - start_ts.tv_sec)
+            + (end_ts.tv_nsec - start_ts.tv_nsec) / 1e9;
+        imbalances[i] = started > 0 && total > 0 ? longest / (total / started) - 1 : 0;
+        cpu_shares[i] = total > 0 ? cpu / total : 0;
+    }
+
+    free(reports);
+
+    double sorted[MAX_REPETITIONS];
+
+    memcpy(sorted, point->samples, point->repetitions * sizeof(double));
+    point->seconds = _median(sorted, point->repetitions);
+    point->throughput = trials / point->seconds;
+    point->imbalance = _median(imbalances, point->repetitions);
+    point->cpu_share = _median(cpu_shares, point->repetitions);
+
+    return true;
+}
+
+
+static void _print_scaling_header(enum format format) {
+    if (format == FORMAT_TEXT) {
+        printf(
+            "%-9s %7s %5s %10s %14s %8s %10s %9s %9s\n",
+            "layout", "threads", "reps", "seconds", "trials/s",
+            "speedup", "efficiency", "imbalance", "cpu share"
+        );
+    } else if (format == FORMAT_CSV) {
+        printf(
+            "layout,threads,repetitions,seconds,trials_per_second,"
+            "speedup,efficiency,imbalance,cpu_share\n"
+        );
+    }
+}
+
+
+static void _print_scaling_point(enum format format, const struct scaling_point *point) {
+    const char *name = layout_names[point->layout];
+
+    switch (format) {
+        case FORMAT_TEXT:
+            printf(
+                "%-9s %7u %5u %10.4f %14.0f %8.2f %9.1f%% %8.1f%% %8.1f%%\n",
+                name,
+                point->threads,
+                point->repetitions,
+                point->seconds,
+                point->throughput,
+                point->speedup,
+                point->efficiency * 100,
+                point->imbalance * 100,
+                point->cpu_share * 100
+            );
+            break;
+        case FORMAT_CSV:
+            printf(
+                "%s,%u,%u,%.6f,%.1f,%.4f,%.4f,%.4f,%.4f\n",
+                name,
+                point->threads,
+                point->repetitions,
+                point->seconds,
+                point->throughput,
+                point->speedup,
+                point->efficiency,
+                point->imbalance,
+                point->cpu_share
+            );
+            break;
+        case FORMAT_JSONL:
+            printf(
+                "{\"layout\":\"%s\",\"threads\":%u,\"repetitions\":%u,"
+                "\"seconds\":%.6f,\"trials_per_second\":%.1f,\"speedup\":%.4f,"
+                "\"efficiency\":%.4f,\"imbalance\":%.4f,\"cpu_share\":%.4f,"
+                "\"samples_s\":[",
+                name,
+                point->threads,
+                point->repetitions,
+                point->seconds,
+                point->throughput,
+                point->speedup,
+                point->efficiency,
+                point->imbalance,
+                point->cpu_share
+            );
+
+            for (unsigned int i = 0; i < point->repetitions; i++) {
+                printf("%s%.6f", i == 0 ? "" : ",", point->samples[i]);
+            }
+
+            printf("]}\n");
+            break;
+    }
+
+    fflush(stdout);
+}
+
+
+// Marks the layouts named in a comma-separated list.
+static bool _parse_layouts(const char *arg, bool *selected) {
+    const char *token = arg;
+
+    memset(selected, false, LAYOUT_COUNT * sizeof(bool));
+
+    for (;;) {
+        size_t len = strcspn(token, ",");
+        bool found = false;
+
+        for (size_t i = 0; i < LAYOUT_COUNT; i++) {
+            if (strlen(layout_names[i]) == len && strncmp(layout_names[i], token, len) == 0) {
+                selected[i] = found = true;
+            }
+        }
+
+        if (!found) {
+            return false;
+        }
+
+        if (token[len] == '\0') {
+            return true;
+        }
+
+        token += len + 1;
+    }
+}
+
+
+static void _threads_usage(const char *name) {
+    fprintf(
+        stderr,
+        "usage: %s threads [options]\n"
+        "  -p, --prisoners N    number of prisoners and boxes (default: 100)\n"
+        "  -c, --chances N      boxes each prisoner may open (default: 50)\n"
+        "  -i, --iterations N   trials in the workload (default: 4194304)\n"
+        "  -l, --layouts LIST   comma-separated thread placements: unpinned,\n"
+        "                       cores (one per physical core) or smt (filling\n"
+        "                       each core's hardware threads) (default: all)\n"
+        "  -T, --max-threads N  the most threads to try (default: every CPU this\n"
+        "                       process may use)\n"
+        "  -r, --repetitions N  timed runs per thread count (default: 3)\n"
+        "  -f, --format FORMAT  text, csv or jsonl (default: text)\n"
+        "      --seed N         seed for the random number generator (default: 0)\n",
+        name
+    );
+}
+
+
+static int _threads_main(int argc, char **argv) {
+    prisoner_config config = prisoner_config_default();
+    uint64_t trials = 1 << 22, seed = 0;
+    unsigned int repetitions = 3, max_threads = 0;
+    bool selected[LAYOUT_COUNT] = {true, true, true};
+    enum format format = FORMAT_TEXT;
+    struct topology topology;
+    struct scaling_point *point;
+    int option;
+
+    static const struct option options[] = {
+        {"prisoners", required_argument, NULL, 'p'},
+        {"chances", required_argument, NULL, 'c'},
+        {"iterations", required_argument, NULL, 'i'},
+        {"layouts", required_argument, NULL, 'l'},
+        {"max-threads", required_argument, NULL, 'T'},
+        {"repetitions", required_argument, NULL, 'r'},
+        {"format", required_argument, NULL, 'f'},
+        {"seed", required_argument, NULL, OPTION_SEED},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    while ((option = getopt_long(argc, argv, "p:c:i:l:T:r:f:h", options, NULL)) != -1) {
+        bool valid = true;
+
+        switch (option) {
+            case 'p':
+                valid = _parse_uint(optarg, &config.count) && config.count > 0;
+                break;
+            case 'c':
+                valid = _parse_uint(optarg, &config.chances);
+                break;
+            case 'i':
+                valid = _parse_uint64(optarg, &trials) && trials > 0;
+                break;
+            case 'l':
+                valid = _parse_layouts(optarg, selected);
+                break;
+            case 'T':
+                valid = _parse_uint(optarg, &max_threads)
+                    && max_threads > 0 && max_threads <= MAX_THREADS;
+                break;
+            case 'r':
+                valid = _parse_uint(optarg, &repetitions)
+                    && repetitions > 0 && repetitions <= MAX_REPETITIONS;
+                break;
+            case 'f':
+                valid = _parse_format(optarg, &format);
+                break;
+            case OPTION_SEED:
+                valid = _parse_uint64(optarg, &seed);
+                break;
+            case 'h':
+                _threads_usage(argv[0]);
+                return 0;
+            default:
+                valid = false;
+                optarg = NULL;
+                break;
+        }
+
+        if (!valid) {
+            if (optarg != NULL) {
+                fprintf(stderr, "%s: invalid value '%s'\n", argv[0], optarg);
+            }
+
+            _threads_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!_detect_topology(&topology)) {
+        fprintf(stderr, "%s: could not find the available CPUs\n", argv[0]);
+        return 1;
+    }
+
+    fprintf(
+        stderr,
+        "%u CPUs on %u cores; %llu trials of %u prisoners with %u chances\n",
+        topology.cpus_len,
+        topology.cores_len,
+        (unsigned long long) trials,
+        config.count,
+        config.chances
+    );
+
+    if (selected[LAYOUT_SMT] && topology.cpus_len == topology.cores_len) {
+        fprintf(stderr, "no core has more than one hardware thread; skipping smt\n");
+        selected[LAYOUT_SMT] = false;
+    }
+
+    point = malloc(sizeof(struct scaling_point));
+
+    if (point == NULL) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+
+    _print_scaling_header(format);
+
+    for (size_t layout = 0; layout < LAYOUT_COUNT; layout++) {
+        unsigned int limit = layout == LAYOUT_CORES ? topology.cores_len : topology.cpus_len;
+        double baseline = 0;
+
+        if (!selected[layout]) {
+            continue;
+        }
+
+        // Unpinned threads may outnumber the CPUs, but pinned ones would only
+        // wrap around onto CPUs that already have a thread.
+        if (max_threads != 0 && (max_threads < limit || layout == LAYOUT_UNPINNED)) {
+            limit = max_threads;
+        }
+
+        // Powers of two, and then the limit itself if it is not one.
+        for (unsigned int threads = 1;; threads *= 2) {
+            if (threads > limit) {
+                threads = limit;
+            }
+
+            point->layout = layout;
+            point->threads = threads;
+            point->repetitions = repetitions;
+
+            if (!_measure_scaling(point, &topology, &config, seed, trials)) {
+                fprintf(
+                    stderr,
+                    "%s: %u %s threads failed: %s\n",
+                    argv[0],
+                    threads,
+                    layout_names[layout],
+                    strerror(errno)
+                );
+                free(point);
+                return 1;
+            }
+
+            if (threads == 1) {
+                baseline = point->throughput;
+            }
+
+            point->speedup = point->throughput / baseline;
+            point->efficiency = point->speedup / threads;
+            _print_scaling_point(format, point);
+
+            if (threads == limit) {
+                break;
+            }
+        }
+    }
+
+    free(point);
+
+    return 0;
+}
+
+// The data cache levels, smallest first, as reported by sysfs.
+struct cache_levels {
+    char names[4][24];
+    unsigned long long sizes[4];
+    unsigned int len;
+};
+
+struct cache_point {
+    unsigned int count;
+    unsigned long long bytes;
+    const char *fits;
+
+    struct measurement shuffle;
+    struct measurement walk;
+};
+
+
+static bool _read_cache_field(int index, const char *name, char *value, size_t size) {
+    char path[128];
+    FILE *file;
+    bool found;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/%s", index, name);
+    file = fopen(path, "r");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    found = fgets(value, (int) size, file) != NULL;
+    fclose(file);
+    value[strcspn(value, "\n")] = '\0';
+
+    return found;
+}
+
+
+static void _detect_caches(struct cache_levels *caches) {
+    memset(caches, 0, sizeof(struct cache_levels));
+
+    for (int index = 0; index < 16 && caches->len < 4; index++) {
+        char level[16], type[32], size[32];
+        char *unit = NULL;
+
+        if (!_read_cache_field(index, "level", level, sizeof(level))
+            || !_read_cache_field(index, "type", type, sizeof(type))
+            || !_read_cache_field(index, "size", size, sizeof(size))) {
+            continue;
+        }
+
+        if (strcmp(type, "Instruction") == 0) {
+            continue;
+        }
+
+        unsigned long long bytes = strtoull(size, &unit, 10);
+
+        if (*unit == 'K') {
+            bytes <<= 10;
+        } else if (*unit == 'M') {
+            bytes <<= 20;
+        } else if (*unit == 'G') {
+            bytes <<= 30;
+        }
+
+        snprintf(
+            caches->names[caches->len],
+            sizeof(caches->names[caches->len]),
+            "L%s%s",
+            level,
+            strcmp(type, "Data") == 0 ? "d" : ""
+        );
+        caches->sizes[caches->len++] = bytes;
+    }
+}
+
+
+static const char *_smallest_fit(const struct cache_levels *caches, unsigned long long bytes) {
+    for (unsigned int i = 0; i < caches->len; i++) {
+        if (bytes <= caches->sizes[i]) {
+            return caches->names[i];
+        }
+    }
+
+    return "DRAM";
+}
+
+
+static const struct kernel *_find_kernel(const char *name) {
+    for (size_t i = 0; i < KERNEL_COUNT; i++) {
+        if (strcmp(kernels[i].name, name) == 0) {
+            return &kernels[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+static bool _measure_cache_kernel(
+    struct measurement *measurement,
+    const struct kernel *kernel,
+    unsigned int count,
+    unsigned int warmup,
+    double min_ns,
+    uint64_t seed
+) {
+    struct bench bench;
+
+    // With as many chances as prisoners, the walk never stops early and visits
+    // every box exactly once, so its cost per element is all memory access. It
+    // always walks the same arrangement, so that the working set is that one
+    // arrangement and nothing else.
+    if (!_bench_create(&bench, kernel, count, count, 1, seed)) {
+        return false;
+    }
+
+    measurement->kernel = kernel;
+    measurement->count = count;
+    measurement->chances = count;
+    _measure(&bench, measurement, warmup, min_ns);
+    _bench_destroy(&bench);
+
+    return true;
+}
+
+
+static void _print_cache_header(enum format format) {
+    if (format == FORMAT_TEXT) {
+        printf(
+            "%12s %14s %5s %14s %10s %14s %10s\n",
+            "count", "bytes", "fits", "shuffle ns/el", "mad", "walk ns/el", "mad"
+        );
+    } else if (format == FORMAT_CSV) {
+        printf(
+            "count,bytes,fits,repetitions,shuffle_ns_per_element,shuffle_mad_ns,"
+            "walk_ns_per_element,walk_mad_ns\n"
+        );
+    }
+}
+
+
+static void _print_cache_point(enum format format, const struct cache_point *point) {
+    double count = point->count;
+
+    switch (format) {
+        case FORMAT_TEXT:
+            printf(
+                "%12u %14llu %5s %14.3f %10.3f %14.3f %10.3f\n",
+                point->count,
+                point->bytes,
+                point->fits,
+                point->shuffle.median / count,
+                point->shuffle.mad / count,
+                point->walk.median / count,
+                point->walk.mad / count
+            );
+            break;
+        case FORMAT_CSV:
+            printf(
+                "%u,%llu,%s,%u,%.5f,%.5f,%.5f,%.5f\n",
+                point->count,
+                point->bytes,
+                point->fits,
+                point->shuffle.repetitions,
+                point->shuffle.median / count,
+                point->shuffle.mad / count,
+                point->walk.median / count,
+                point->walk.mad / count
+            );
+            break;
+        case FORMAT_JSONL:
+            printf(
+                "{\"count\":%u,\"bytes\":%llu,\"fits\":\"%s\",\"repetitions\":%u,"
+                "\"shuffle_ns_per_element\":%.5f,\"shuffle_mad_ns\":%.5f,"
+                "\"walk_ns_per_element\":%.5f,\"walk_mad_ns\":%.5f}\n",
+                point->count,
+                point->bytes,
+                point->fits,
+                point->shuffle.repetitions,
+                point->shuffle.median / count,
+                point->shuffle.mad / count,
+                point->walk.median / count,
+                point->walk.mad / count
+            );
+            break;
+    }
+
+    fflush(stdout);
+}
+
+
+static void _cache_usage(const char *name) {
+    fprintf(
+        stderr,
+        "usage: %s cache [options]\n"
+        "  -n, --min-count N    smallest number of prisoners (default: 16)\n"
+        "  -N, --max-count N    largest number of prisoners (default: 67108864)\n"
+        "  -s, --steps N        counts per doubling, spaced geometrically\n"
+        "                       (default: 4)\n"
+        "  -r, --repetitions N  timed repetitions per measurement (default: 5)\n"
+        "  -w, --warmup N       untimed repetitions after calibration (default: 1)\n"
+        "  -T, --min-time MS    minimum duration of each repetition (default: 10)\n"
+        "  -f, --format FORMAT  text, csv or jsonl (default: text)\n"
+        "      --seed N         seed for the random number generator (default: 0)\n",
+        name
+    );
+}
+
+
+static int _cache_main(int argc, char **argv) {
+    unsigned int min_count = 16, max_count = 1 << 26, steps = 4;
+    unsigned int repetitions = 5, warmup = 1, min_time = 10;
+    enum format format = FORMAT_TEXT;
+    uint64_t seed = 0;
+    struct cache_levels caches;
+    struct cache_point *point;
+    const struct kernel *shuffle = _find_kernel("generate_boxes");
+    const struct kernel *walk = _find_kernel("run_optimized");
+    unsigned int previous = 0, level = 0;
+    int option;
+
+    static const struct option options[] = {
+        {"min-count", required_argument, NULL, 'n'},
+        {"max-count", required_argument, NULL, 'N'},
+        {"steps", required_argument, NULL, 's'},
+        {"repetitions", required_argument, NULL, 'r'},
+        {"warmup", required_argument, NULL, 'w'},
+        {"min-time", required_argument, NULL, 'T'},
+        {"format", required_argument, NULL, 'f'},
+        {"seed", required_argument, NULL, OPTION_SEED},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    while ((option = getopt_long(argc, argv, "n:N:s:r:w:T:f:h", options, NULL)) != -1) {
+        bool valid = true;
+
+        switch (option) {
+            case 'n':
+                valid = _parse_uint(optarg, &min_count) && min_count > 1;
+                break;
+            case 'N':
+                valid = _parse_uint(optarg, &max_count) && max_count > 1;
+                break;
+            case 's':
+                valid = _parse_uint(optarg, &steps) && steps > 0;
+                break;
+            case 'r':
+                valid = _parse_uint(optarg, &repetitions)
+                    && repetitions > 0 && repetitions <= MAX_REPETITIONS;
+                break;
+            case 'w':
+                valid = _parse_uint(optarg, &warmup);
+                break;
+            case 'T':
+                valid = _parse_uint(optarg, &min_time) && min_time > 0;
+                break;
+            case 'f':
+                valid = _parse_format(optarg, &format);
+                break;
+            case OPTION_SEED:
+                valid = _parse_uint64(optarg, &seed);
+                break;
+            case 'h':
+                _cache_usage(argv[0]);
+                return 0;
+            default:
+                valid = false;
+                optarg = NULL;
+                break;
+        }
+
+        if (!valid) {
+            if (optarg != NULL) {
+                fprintf(stderr, "%s: invalid value '%s'\n", argv[0], optarg);
+            }
+
+            _cache_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    _detect_caches(&caches);
+
+    for (unsigned int i = 0; i < caches.len; i++) {
+        fprintf(stderr, "%s%s %llu KiB", i == 0 ? "" : ", ", caches.names[i], caches.sizes[i] >> 10);
+    }
+
+    fprintf(stderr, "%s", caches.len == 0 ? "no cache sizes found\n" : "\n");
+
+    point = malloc(sizeof(struct cache_point));
+
+    if (point == NULL) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+
+    _print_cache_header(format);
+
+    for (unsigned int step = 0;; step++) {
+        double exact = min_count * pow(2, (double) step / steps);
+        unsigned int count = (unsigned int) llround(exact);
+
+        if (exact > max_count) {
+            break;
+        }
+
+        if (count == previous) {
+            continue;
+        }
+
+        previous = count;
+
+        // The walk touches a box and a seen flag per element, and so is the larger
+        // of the two working sets.
+        point->count = count;
+        point->bytes = (unsigned long long) count * (sizeof(unsigned int) + sizeof(bool));
+        point->fits = _smallest_fit(&caches, point->bytes);
+        point->shuffle.repetitions = point->walk.repetitions = repetitions;
+
+        if (!_measure_cache_kernel(&point->shuffle, shuffle, count, warmup, min_time * 1e6, seed)
+            || !_measure_cache_kernel(&point->walk, walk, count, warmup, min_time * 1e6, seed)) {
+            fprintf(
+                stderr,
+                "%s: could not set up %u prisoners: %s\n",
+                argv[0],
+                count,
+                strerror(errno)
+            );
+            free(point);
+            return 1;
+        }
+
+        if (format == FORMAT_TEXT) {
+            // Mark each boundary as the working set grows past it.
+            while (level < caches.len && point->bytes > caches.sizes[level]) {
+                printf("---- %s (%llu KiB) ----\n", caches.names[level], caches.sizes[level] >> 10);
+                level++;
+            }
+        }
+
+        _print_cache_point(format, point);
+    }
+
+    free(point);
+
+    return 0;
+}
+
+// One measurement read back from a history file.
+struct history_entry {
+    char kernel[32];
+    unsigned int count;
+    unsigned int chances;
+    unsigned int repetitions;
+    double median;
+    double samples[MAX_REPETITIONS];
+};
+
+struct history_run {
+    char id[32];
+    char revision[64];
+    char cpu[128];
+
+    struct history_entry *entries;
+    size_t len;
+    size_t capacity;
+};
+
+struct comparison {
+    const struct history_entry *base;
+    const struct history_entry *next;
+    double change;
+
+    // One-sided p-values for the new run being slower, and faster.
+    double p_slower;
+    double p_faster;
+    const char *verdict;
+};
+
+struct ranked_sample {
+    double value;
+    bool next;
+};
+
+
+// Finds `"key":` in a line written by _append_history, returning what follows.
+static const char *_json_field(const char *line, const char *key) {
+    char pattern[64];
+    const char *found;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    found = strstr(line, pattern);
+
+    return found == NULL ? NULL : found + strlen(pattern);
+}
+
+
+static bool _json_string(const char *line, const char *key, char *value, size_t size) {
+    const char *field = _json_field(line, key);
+    size_t len;
+
+    if (field == NULL || *field != '"') {
+        return false;
+    }
+
+    field++;
+    len = strcspn(field, "\"");
+
+    if (field[len] != '"' || len >= size) {
+        return false;
+    }
+
+    memcpy(value, field, len);
+    value[len] = '\0';
+
+    return true;
+}
+
+
+static bool _json_number(const char *line, const char *key, double *value) {
+    const char *field = _json_field(line, key);
+    char *end = NULL;
+
+    if (field == NULL) {
+        return false;
+    }
+
+    *value = strtod(field, &end);
+
+    return end != field;
+}
+
+
+static unsigned int _json_numbers(
+    const char *line,
+    const char *key,
+    double *values,
+    unsigned int max_len
+) {
+    const char *field = _json_field(line, key);
+    unsigned int len = 0;
+
+    if (field == NULL || *field != '[') {
+        return 0;
+    }
+
+    field++;
+
+    while (len < max_len && *field != ']') {
+        char *end = NULL;
+
+        values[len] = strtod(field, &end);
+
+        if (end == field) {
+            return 0;
+        }
+
+        len++;
+        field = *end == ',' ? end + 1 : end;
+    }
+
+    return *field == ']' ? len : 0;
+}
+
+
+static bool _parse_history_entry(const char *line, struct history_entry *entry) {
+    double count, chances;
+
+    if (!_json_string(line, "kernel", entry->kernel, sizeof(entry->kernel))
+        || !_json_number(line, "count", &count)
+        || !_json_number(line, "chances", &chances)
+        || !_json_number(line, "median_ns", &entry->median)) {
+        return false;
+    }
+
+    entry->count = (unsigned int) count;
+    entry->chances = (unsigned int) chances;
+    entry->repetitions = _json_numbers(line, "samples_ns", entry->samples, MAX_REPETITIONS);
+
+    return entry->repetitions > 0;
+}
+
+
+static void _history_runs_free(struct history_run *runs, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        free(runs[i].entries);
+    }
+
+    free(runs);
+}
+
+
+// Reads every run in a history file, in the order they were recorded. Returns
+// NULL with errno set on failure.
+static struct history_run *_read_history(FILE *file, size_t *len) {
+    struct history_run *runs = NULL;
+    size_t capacity = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    struct history_entry entry;
+
+    *len = 0;
+
+    while (getline(&line, &line_size, file) != -1) {
+        char id[sizeof(runs->id)];
+        struct history_run *run;
+
+        if (!_json_string(line, "run", id, sizeof(id)) || !_parse_history_entry(line, &entry)) {
+            continue;
+        }
+
+        run = *len > 0 && strcmp(runs[*len - 1].id, id) == 0 ? &runs[*len - 1] : NULL;
+
+        if (run == NULL) {
+            if (*len == capacity) {
+                capacity = capacity == 0 ? 16 : capacity * 2;
+                struct history_run *grown = realloc(runs, capacity * sizeof(struct history_run));
+
+                if (grown == NULL) {
+                    break;
+                }
+
+                runs = grown;
+            }
+
+            run = &runs[(*len)++];
+            memset(run, 0, sizeof(struct history_run));
+            strcpy(run->id, id);
+
+            if (!_json_string(line, "revision", run->revision, sizeof(run->revision))) {
+                strcpy(run->revision, "unknown");
+            }
+
+            if (!_json_string(line, "cpu", run->cpu, sizeof(run->cpu))) {
+                strcpy(run->cpu, "unknown");
+            }
+        }
+
+        if (run->len == run->capacity) {
+            size_t entries = run->capacity == 0 ? 16 : run->capacity * 2;
+            struct history_entry *grown = realloc(
+                run->entries, entries * sizeof(struct history_entry)
+            );
+
+            if (grown == NULL) {
+                break;
+            }
+
+            run->entries = grown;
+            run->capacity = entries;
+        }
+
+        run->entries[run->len++] = entry;
+    }
+
+    free(line);
+
+    if (ferror(file) || !feof(file)) {
+        _history_runs_free(runs, *len);
+        errno = ferror(file) ? EIO : ENOMEM;
+        return NULL;
+    }
+
+    return runs;
+}
+
+
+// Finds a run by its id, or failing that the latest run of a revision.
+static const struct history_run *_find_run(
+    const struct history_run *runs,
+    size_t len,
+    const char *name
+) {
+    for (size_t i = 0; i < len; i++) {
+        if (strcmp(runs[i].id, name) == 0) {
+            return &runs[i];
+        }
+    }
+
+    for (size_t i = len; i > 0; i--) {
+        if (strcmp(runs[i - 1].revision, name) == 0) {
+            return &runs[i - 1];
+        }
+    }
+
+    return NULL;
+}
+
+
+static int _compare_ranked(const void *left, const void *right) {
+    const struct ranked_sample *a = left, *b = right;
+
+    return (a->value > b->value) - (a->value < b->value);
+}
+
+
+// The Mann-Whitney U test, through its normal approximation with corrections
+// for ties and continuity. It only assumes that the repetitions of each run are
+// independent, not that their times are normally distributed, which they rarely
+// are. Stores the one-sided p-values for `next` tending to be larger than
+// `base`, and smaller.
+static void _mann_whitney(
+    const double *base,
+    unsigned int base_len,
+    const double *next,
+    unsigned int next_len,
+    double *p_larger,
+    double *p_smaller
+) {
+    unsigned int len = base_len + next_len;
+    struct ranked_sample ranked[2 * MAX_REPETITIONS];
+    double rank_sum = 0, ties = 0;
+
+    for (unsigned int i = 0; i < base_len; i++) {
+        ranked[i].value = base[i];
+        ranked[i].next = false;
+    }
+
+    for (unsigned int i = 0; i < next_len; i++) {
+        ranked[base_len + i].value = next[i];
+        ranked[base_len + i].next = true;
+    }
+
+    qsort(ranked, len, sizeof(struct ranked_sample), _compare_ranked);
+
+    // Tied values share the average of the ranks they span.
+    for (unsigned int first = 0; first < len;) {
+        unsigned int last = first;
+
+        while (last + 1 < len && ranked[last + 1].value == ranked[first].value) {
+            last++;
+        }
+
+        double tied = last - first + 1, rank = (first + last) / 2.0 + 1;
+
+        for (unsigned int i = first; i <= last; i++) {
+            rank_sum += ranked[i].next ? rank : 0;
+        }
+
+        ties += tied * tied * tied - tied;
+        first = last + 1;
+    }
+
+    double u = rank_sum - next_len * (next_len + 1) / 2.0;
+    double mean = base_len * (double) next_len / 2;
+    double variance = base_len * (double) next_len / 12
+        * ((len + 1) - ties / ((double) len * (len - 1)));
+
+    if (variance <= 0) {
+        *p_larger = *p_smaller = 1;
+        return;
+    }
+
+    double spread = sqrt(variance);
+
+    *p_larger = 0.5 * erfc((u - mean - 0.5) / spread / M_SQRT2);
+    *p_smaller = 0.5 * erfc((mean - u - 0.5) / spread / M_SQRT2);
+}
+
+
+static void _print_comparison_header(enum format format) {
+    if (format == FORMAT_TEXT) {
+        printf(
+            "%-18s %10s %10s %14s %14s %9s %10s  %s\n",
+            "kernel", "count", "chances", "base ns", "new ns", "change", "p", "verdict"
+        );
+    } else if (format == FORMAT_CSV) {
+        printf("kernel,count,chances,base_ns,new_ns,change,p_slower,p_faster,verdict\n");
+    }
+}
+
+
+static void _print_comparison(enum format format, const struct comparison *comparison) {
+    const struct history_entry *base = comparison->base, *next = comparison->next;
+    double p = comparison->change >= 0 ? comparison->p_slower : comparison->p_faster;
+
+    switch (format) {
+        case FORMAT_TEXT:
+            printf(
+                "%-18s %10u %10u %14.2f %14.2f %+8.1f%% %10.2g  %s\n",
+                next->kernel,
+                next->count,
+                next->chances,
+                base->median,
+                next->median,
+                comparison->change * 100,
+                p,
+                comparison->verdict
+            );
+            break;
+        case FORMAT_CSV:
+            printf(
+                "%s,%u,%u,%.3f,%.3f,%.5f,%.3g,%.3g,%s\n",
+                next->kernel,
+                next->count,
+                next->chances,
+                base->median,
+                next->median,
+                comparison->change,
+                comparison->p_slower,
+                comparison->p_faster,
+                comparison->verdict
+            );
+            break;
+        case FORMAT_JSONL:
+            printf(
+                "{\"kernel\":\"%s\",\"count\":%u,\"chances\":%u,\"base_ns\":%.3f,"
+                "\"new_ns\":%.3f,\"change\":%.5f,\"p_slower\":%.3g,\"p_faster\":%.3g,"
+                "\"verdict\":\"%s\"}\n",
+                next->kernel,
+                next->count,
+                next->chances,
+                base->median,
+                next->median,
+                comparison->change,
+                comparison->p_slower,
+                comparison->p_faster,
+                comparison->verdict
+            );
+            break;
+    }
+}
+
+
+static void _compare_usage(const char *name) {
+    fprintf(
+        stderr,
+        "usage: %s compare [options] [BASE [NEW]]\n"
+        "Compares two runs recorded with `kernels --history`, each named by its id\n"
+        "or by a revision for that revision's latest run. NEW defaults to the\n"
+        "latest run, and BASE to the one before NEW. Exits with status 2 if any\n"
+        "measurement got significantly slower.\n"
+        "\n"
+        "  -H, --history FILE   the history file (default: " HISTORY_FILE ")\n"
+        "  -a, --alpha P        significance level of each test (default: 0.01)\n"
+        "  -t, --threshold PCT  smallest change in the median worth flagging\n"
+        "                       (default: 2)\n"
+        "  -f, --format FORMAT  text, csv or jsonl (default: text)\n",
+        name
+    );
+}
+
+
+static int _compare_main(int argc, char **argv) {
+    const char *history_file = HISTORY_FILE;
+    double alpha = 0.01, threshold = 2;
+    enum format format = FORMAT_TEXT;
+    struct history_run *runs;
+    const struct history_run *base, *next;
+    size_t runs_len;
+    unsigned int compared = 0, slower = 0, faster = 0;
+    FILE *file;
+    int option;
+
+    static const struct option options[] = {
+        {"history", required_argument, NULL, 'H'},
+        {"alpha", required_argument, NULL, 'a'},
+        {"threshold", required_argument, NULL, 't'},
+        {"format", required_argument, NULL, 'f'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    while ((option = getopt_long(argc, argv, "H:a:t:f:h", options, NULL)) != -1) {
+        bool valid = true;
+
+        switch (option) {
+            case 'H':
+                history_file = optarg;
+                break;
+            case 'a':
+                valid = _parse_double(optarg, &alpha) && alpha > 0 && alpha < 1;
+                break;
+            case 't':
+                valid = _parse_double(optarg, &threshold) && threshold >= 0;
+                break;
+            case 'f':
+                valid = _parse_format(optarg, &format);
+                break;
+            case 'h':
+                _compare_usage(argv[0]);
+                return 0;
+            default:
+                valid = false;
+                optarg = NULL;
+                break;
+        }
+
+        if (!valid) {
+            if (optarg != NULL) {
+                fprintf(stderr, "%s: invalid value '%s'\n", argv[0], optarg);
+            }
+
+            _compare_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind > 2) {
+        _compare_usage(argv[0]);
+        return 1;
+    }
+
+    file = fopen(history_file, "r");
+
+    if (file == NULL) {
+        fprintf(stderr, "%s: could not open '%s': %s\n", argv[0], history_file, strerror(errno));
+        return 1;
+    }
+
+    runs = _read_history(file, &runs_len);
+    fclose(file);
+
+    if (runs == NULL) {
+        fprintf(stderr, "%s: could not read '%s': %s\n", argv[0], history_file, strerror(errno));
+        return 1;
+    }
+
+    next = argc - optind == 2
+        ? _find_run(runs, runs_len, argv[optind + 1])
+        : runs_len > 0 ? &runs[runs_len - 1] : NULL;
+
+    if (argc - optind >= 1) {
+        base = _find_run(runs, runs_len, argv[optind]);
+    } else {
+        base = next != NULL && next > runs ? next - 1 : NULL;
+    }
+
+    if (base == NULL || next == NULL) {
+        fprintf(stderr, "%s: '%s' does not hold both runs to compare\n", argv[0], history_file);
+        _history_runs_free(runs, runs_len);
+        return 1;
+    }
+
+    fprintf(stderr, "base: %s (%s) on %s\n", base->id, base->revision, base->cpu);
+    fprintf(stderr, "new:  %s (%s) on %s\n", next->id, next->revision, next->cpu);
+
+    if (strcmp(base->cpu, next->cpu) != 0) {
+        fprintf(stderr, "warning: the runs were recorded on different CPUs\n");
+    }
+
+    _print_comparison_header(format);
+
+    for (size_t i = 0; i < next->len; i++) {
+        struct comparison comparison = {.next = &next->entries[i], .base = NULL};
+
+        for (size_t j = 0; j < base->len && comparison.base == NULL; j++) {
+            const struct history_entry *entry = &base->entries[j];
+
+            if (strcmp(entry->kernel, comparison.next->kernel) == 0
+                && entry->count == comparison.next->count
+                && entry->chances == comparison.next->chances) {
+                comparison.base = entry;
+            }
+        }
+
+        if (comparison.base == NULL) {
+            continue;
+        }
+
+        _mann_whitney(
+            comparison.base->samples,
+            comparison.base->repetitions,
+            comparison.next->samples,
+            comparison.next->repetitions,
+            &comparison.p_slower,
+            &comparison.p_faster
+        );
+
+        // A change has to be both significant and big enough to matter.
+        comparison.change = comparison.next->median / comparison.base->median - 1;
+        comparison.verdict = "same";
+
+        if (comparison.p_slower < alpha && comparison.change * 100 > threshold) {
+            comparison.verdict = "SLOWER";
+            slower++;
+        } else if (comparison.p_faster < alpha && -comparison.change * 100 > threshold) {
+            comparison.verdict = "faster";
+            faster++;
+        }
+
+        compared++;
+        _print_comparison(format, &comparison);
+    }
+
+    fprintf(
+        stderr,
+        "%u measurements compared: %u slower, %u faster\n",
+        compared,
+        slower,
+        faster
+    );
+
+    _history_runs_free(runs, runs_len);
+
+    return slower > 0 ? 2 : 0;
+}
+
+
+int main(int argc, char **argv) {
+    // The mode comes first, and its options are parsed as if it were the whole
+    // command line.
+    if (argc > 1 && strcmp(argv[1], "threads") == 0) {
+        argv[1] = argv[0];
+        return _threads_main(argc - 1, argv + 1);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "cache") == 0) {
+        argv[1] = argv[0];
+        return _cache_main(argc - 1, argv + 1);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "compare") == 0) {
+        argv[1] = argv[0];
+        return _compare_main(argc - 1, argv + 1);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "kernels") == 0) {
+        argv[1] = argv[0];
+        return _kernels_main(argc - 1, argv + 1);
+    }
+
+    return _kernels_main(argc, argv);
+}
@@ -0,0 +1,452 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "corpus.h"
+#include "lehmer.h"
+
+
+// Whether 4-byte fixed-width elements can be used where they are mapped.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CORPUS_IN_PLACE true
+#else
+#define CORPUS_IN_PLACE false
+#endif
+
+// The range check looks at this many elements at once, which the compiler turns
+// into whatever vector instructions the target has.
+typedef unsigned int lanes __attribute__((vector_size(32)));
+#define LANES (sizeof(lanes) / sizeof(unsigned int))
+
+const char *const corpus_encoding_names[CORPUS_ENCODING_COUNT] = {
+    "fixed",
+    "lehmer",
+};
+
+struct job {
+    const struct corpus *corpus;
+    unsigned int chances;
+    enum evaluator evaluator;
+    int results_fd;
+    uint64_t chunks;
+    atomic_uint_fast64_t next_chunk;
+};
+
+struct worker {
+    struct job *job;
+    pthread_t thread;
+    uint64_t wins;
+    uint64_t invalid;
+    uint64_t first_invalid;
+    int error;
+};
+
+
+static size_t _stride(const struct corpus_header *header) {
+    return header->encoding == CORPUS_LEHMER
+        ? _lehmer_bytes(header->count)
+        : (size_t) header->count * header->width;
+}
+
+
+int _corpus_open(struct corpus *corpus, const char *path) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    memset(corpus, 0, sizeof(struct corpus));
+
+    if (fd < 0) {
+        return errno;
+    }
+
+    if (fstat(fd, &st) != 0) {
+        int error = errno;
+
+        close(fd);
+        return error;
+    }
+
+    if ((size_t) st.st_size < sizeof(struct corpus_header)) {
+        close(fd);
+        return EINVAL;
+    }
+
+    void *data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int error = data == MAP_FAILED ? errno : 0;
+
+    // The mapping keeps the file open.
+    close(fd);
+
+    if (error != 0) {
+        return error;
+    }
+
+    const struct corpus_header *header = data;
+
+    corpus->data = data;
+    corpus->size = (size_t) st.st_size;
+    corpus->header = *header;
+    corpus->records = corpus->data + sizeof(struct corpus_header);
+
+    bool fixed = header->encoding == CORPUS_FIXED;
+
+    if (memcmp(header->magic, CORPUS_MAGIC, sizeof(CORPUS_MAGIC)) != 0
+        || header->version != CORPUS_VERSION
+        || header->encoding >= CORPUS_ENCODING_COUNT
+        || header->count == 0
+        || (fixed && header->width != 1 && header->width != 2 && header->width != 4)
+        || (fixed && header->width < 4 && header->count - 1 > (1u << (8 * header->width)) - 1)
+        || (!fixed && header->width != 0)) {
+        _corpus_close(corpus);
+        return EINVAL;
+    }
+
+    corpus->stride = _stride(header);
+
+    if (corpus->stride == 0
+        || (corpus->size - sizeof(struct corpus_header)) / corpus->stride != header->permutations
+        || (corpus->size - sizeof(struct corpus_header)) % corpus->stride != 0) {
+        _corpus_close(corpus);
+        return EINVAL;
+    }
+
+    // Each permutation is read once, in order.
+    madvise(data, corpus->size, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+    return 0;
+}
+
+
+void _corpus_close(struct corpus *corpus) {
+    if (corpus->data != NULL) {
+        munmap((void *) corpus->data, corpus->size);
+    }
+
+    memset(corpus, 0, sizeof(struct corpus));
+}
+
+
+static void _store_le32(uint8_t *dest, uint32_t value) {
+    for (unsigned int i = 0; i < 4; i++) {
+        dest[i] = (uint8_t) (value >> (8 * i));
+    }
+}
+
+
+int _corpus_write(
+    const char *path,
+    prisoner_ctx *ctx,
+    enum corpus_encoding encoding,
+    uint64_t seed,
+    uint64_t permutations
+) {
+    unsigned int count = ctx->config.count;
+    struct corpus_header header = {
+        .version = CORPUS_VERSION,
+        .encoding = encoding,
+        .width = encoding == CORPUS_FIXED ? 4 : 0,
+        .count = count,
+        .permutations = permutations,
+    };
+    size_t stride = _stride(&header);
+    uint8_t *record = malloc(stride > 0 ? stride : 1);
+    unsigned int *scratch = malloc(2 * (size_t) count * sizeof(unsigned int));
+    FILE *file = NULL;
+    int error = 0;
+
+    memcpy(header.magic, CORPUS_MAGIC, sizeof(CORPUS_MAGIC));
+
+    if (record == NULL || scratch == NULL) {
+        error = ENOMEM;
+        goto done;
+    }
+
+    file = fopen(path, "wb");
+
+    if (file == NULL) {
+        error = errno;
+        goto done;
+    }
+
+    fwrite(&header, sizeof(header), 1, file);
+
+    for (uint64_t i = 0; i < permutations && !ferror(file); i++) {
+        // Seeded chunk by chunk as a run is, so the corpus holds its arrangements.
+        if (i % CHUNK_TRIALS == 0) {
+            prisoner_seed(ctx, _chunk_seed(seed, i / CHUNK_TRIALS));
+        }
+
+        _arrange_boxes(ctx);
+
+        if (encoding == CORPUS_LEHMER) {
+            _lehmer_encode(ctx->boxes, count, scratch, record);
+        } else {
+            for (unsigned int box = 0; box < count; box++) {
+                _store_le32(record + 4 * (size_t) box, ctx->boxes[box]);
+            }
+        }
+
+        fwrite(record, 1, stride, file);
+    }
+
+    if (ferror(file)) {
+        error = EIO;
+    }
+
+    if (fclose(file) != 0 && error == 0) {
+        error = errno;
+    }
+
+    if (error != 0) {
+        remove(path);
+    }
+
+done:
+    free(record);
+    free(scratch);
+
+    return error;
+}
+
+
+// Whether every element is below `count`, looking at LANES at a time.
+static bool _in_range(const unsigned int *boxes, unsigned int count) {
+    lanes limit = (lanes) {0} + count, over = {0};
+    unsigned int i = 0, any = 0;
+
+    for (; i + LANES <= count; i += LANES) {
+        lanes values;
+
+        memcpy(&values, boxes + i, sizeof(values));
+        over |= (lanes) (values >= limit);
+    }
+
+    for (unsigned int lane = 0; lane < LANES; lane++) {
+        any |= over[lane];
+    }
+
+    for (; i < count; i++) {
+        any |= boxes[i] >= count;
+    }
+
+    return any == 0;
+}
+
+
+// Whether `boxes` is a permutation: in range, and then with no slip twice, which
+// `seen` records without branching.
+static bool _is_permutation(const unsigned int *boxes, unsigned int count, uint64_t *seen) {
+    uint64_t repeated = 0;
+
+    if (!_in_range(boxes, count)) {
+        return false;
+    }
+
+    memset(seen, 0, (count + 63) / 64 * sizeof(uint64_t));
+
+    for (unsigned int i = 0; i < count; i++) {
+        uint64_t bit = (uint64_t) 1 << (boxes[i] % 64);
+
+        repeated |= seen[boxes[i] / 64] & bit;
+        seen[boxes[i] / 64] |= bit;
+    }
+
+    return repeated == 0;
+}
+
+
+// Points `ctx->boxes` at the permutation in `record`, widening or decoding it into
+// `own` when it cannot be used as it is, and reports whether it is valid.
+static bool _load(
+    const struct corpus_header *header,
+    const uint8_t *record,
+    prisoner_ctx *ctx,
+    unsigned int *own
+) {
+    unsigned int count = header->count;
+
+    if (header->encoding == CORPUS_LEHMER) {
+        ctx->boxes = own;
+        return _lehmer_decode(record, count, own);
+    }
+
+    if (header->width == 4 && CORPUS_IN_PLACE) {
+        // Corpora are mapped page-aligned and the header is a multiple of 4 bytes,
+        // so every element is aligned.
+        ctx->boxes = (unsigned int *) record;
+    } else {
+        for (unsigned int box = 0; box < count; box++) {
+            const uint8_t *element = record + (size_t) box * header->width;
+            unsigned int value = 0;
+
+            for (unsigned int byte = 0; byte < header->width; byte++) {
+                value |= (unsigned int) element[byte] << (8 * byte);
+            }
+
+            own[box] = value;
+        }
+
+        ctx->boxes = own;
+    }
+
+    return _is_permutation(ctx->boxes, count, ctx->visited);
+}
+
+
+static void *_worker_main(void *arg) {
+    struct worker *worker = arg;
+    struct job *job = worker->job;
+    const struct corpus *corpus = job->corpus;
+    prisoner_config config = prisoner_config_default();
+    uint8_t *outcomes = job->results_fd >= 0 ? malloc(CORPUS_CHUNK) : NULL;
+
+    config.count = corpus->header.count;
+    config.chances = job->chances;
+
+    prisoner_ctx *ctx = prisoner_create(&config);
+
+    if (ctx == NULL || (job->results_fd >= 0 && outcomes == NULL)) {
+        worker->error = ctx == NULL ? errno : ENOMEM;
+        prisoner_destroy(ctx);
+        free(outcomes);
+        return NULL;
+    }
+
+    unsigned int *own = ctx->boxes;
+
+    ctx->evaluator = job->evaluator;
+    worker->first_invalid = UINT64_MAX;
+
+    for (;;) {
+        uint64_t chunk = atomic_fetch_add_explicit(&job->next_chunk, 1, memory_order_relaxed);
+
+        if (chunk >= job->chunks || worker->error != 0) {
+            break;
+        }
+
+        uint64_t first = chunk * CORPUS_CHUNK;
+        uint64_t len = corpus->header.permutations - first < CORPUS_CHUNK
+            ? corpus->header.permutations - first
+            : CORPUS_CHUNK;
+
+        for (uint64_t i = 0; i < len; i++) {
+            const uint8_t *record = corpus->records + (first + i) * corpus->stride;
+            uint8_t outcome = CORPUS_INVALID;
+
+            if (_load(&corpus->header, record, ctx, own)) {
+                outcome = _evaluate(ctx) ? CORPUS_WON : CORPUS_LOST;
+                worker->wins += outcome == CORPUS_WON;
+            } else {
+                worker->invalid++;
+
+                if (first + i < worker->first_invalid) {
+                    worker->first_invalid = first + i;
+                }
+            }
+
+            if (outcomes != NULL) {
+                outcomes[i] = outcome;
+            }
+        }
+
+        // Each chunk's outcomes land at its own offset, so they come out in order
+        // however the chunks were shared out.
+        if (outcomes != NULL
+            && pwrite(job->results_fd, outcomes, len, (off_t) first) != (ssize_t) len) {
+            worker->error = errno != 0 ? errno : EIO;
+        }
+    }
+
+    // The context must free the boxes it allocated, not a mapped permutation.
+    ctx->boxes = own;
+    prisoner_destroy(ctx);
+    free(outcomes);
+
+    return NULL;
+}
+
+
+int _run_corpus(
+    const struct corpus *corpus,
+    unsigned int chances,
+    enum evaluator evaluator,
+    unsigned int threads,
+    int results_fd,
+    struct corpus_results *results
+) {
+    struct job job = {
+        .corpus = corpus,
+        .chances = chances,
+        .evaluator = evaluator,
+        .results_fd = results_fd,
+        .chunks = (corpus->header.permutations + CORPUS_CHUNK - 1) / CORPUS_CHUNK,
+    };
+    unsigned int started = 0;
+    int error = 0;
+
+    memset(results, 0, sizeof(struct corpus_results));
+
+    if (threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (unsigned int) online : 1;
+    }
+
+    if (threads > job.chunks) {
+        threads = job.chunks > 0 ? (unsigned int) job.chunks : 1;
+    }
+
+    struct worker *workers = calloc(threads, sizeof(struct worker));
+
+    if (workers == NULL) {
+        return ENOMEM;
+    }
+
+    atomic_init(&job.next_chunk, 0);
+
+    for (; started < threads; started++) {
+        workers[started].job = &job;
+
+        if (pthread_create(&workers[started].thread, NULL, _worker_main, &workers[started]) != 0) {
+            // Any that did start pick up the chunks meant for the rest.
+            break;
+        }
+    }
+
+    if (started == 0) {
+        free(workers);
+        return EAGAIN;
+    }
+
+    results->permutations = corpus->header.permutations;
+    results->first_invalid = UINT64_MAX;
+
+    for (unsigned int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+
+        if (workers[i].error != 0) {
+            error = workers[i].error;
+        }
+
+        results->wins += workers[i].wins;
+        results->invalid += workers[i].invalid;
+
+        if (workers[i].invalid > 0 && workers[i].first_invalid < results->first_invalid) {
+            results->first_invalid = workers[i].first_invalid;
+        }
+    }
+
+    free(workers);
+
+    return error;
+}
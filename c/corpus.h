@@ -0,0 +1,105 @@
+#ifndef PRISONER_CORPUS_H
+#define PRISONER_CORPUS_H
+
+// Corpora of permutations produced elsewhere, evaluated in place of the ones the
+// library shuffles. A corpus is a header followed by its permutations back to
+// back, each taking the same number of bytes:
+//
+//   header   struct corpus_header
+//   fixed    `count` little-endian unsigned integers of `width` bytes each
+//   lehmer   the permutation packed as in lehmer.h, in `_lehmer_bytes(count)`
+//            bytes
+//
+// Corpora are memory-mapped rather than read. Workers claim chunks of them, and
+// evaluate 4-byte fixed-width permutations straight from the mapping; narrower
+// ones are widened, and packed ones decoded, into each worker's own boxes. Every
+// permutation is checked before it is evaluated, since a repeated slip would
+// send the walks around forever.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "engine.h"
+
+#define CORPUS_MAGIC "PRPERMS"
+#define CORPUS_VERSION 1
+
+// Workers claim permutations this many at a time.
+#define CORPUS_CHUNK 16384
+
+enum corpus_encoding {
+    CORPUS_FIXED,
+    CORPUS_LEHMER,
+    CORPUS_ENCODING_COUNT,
+};
+
+PRISONER_INTERNAL extern const char *const corpus_encoding_names[CORPUS_ENCODING_COUNT];
+
+// What the results file holds for each permutation, in order.
+enum corpus_outcome {
+    CORPUS_LOST,
+    CORPUS_WON,
+    CORPUS_INVALID,
+};
+
+struct corpus_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t encoding;
+    // Bytes per element for fixed-width corpora, 1, 2 or 4, and 0 otherwise.
+    uint32_t width;
+    uint32_t count;
+    uint64_t permutations;
+};
+
+struct corpus {
+    struct corpus_header header;
+
+    // The whole file as mapped, and where its permutations start in it.
+    const uint8_t *data;
+    size_t size;
+    const uint8_t *records;
+    size_t stride;
+};
+
+struct corpus_results {
+    uint64_t permutations;
+    uint64_t wins;
+    uint64_t invalid;
+    // The index of the first invalid permutation, if there are any.
+    uint64_t first_invalid;
+};
+
+// Maps the corpus at `path`. Returns 0 or an errno value, EINVAL for a file that
+// is not a corpus this build can read or whose size does not match its header.
+PRISONER_INTERNAL int _corpus_open(struct corpus *corpus, const char *path);
+
+PRISONER_INTERNAL void _corpus_close(struct corpus *corpus);
+
+// Writes a corpus of `permutations` permutations of `count` elements, 4 bytes
+// each when fixed-width, drawn by `ctx` with `_arrange_boxes` and reseeded for
+// every chunk of trials, so they are the arrangements a run with `seed` evaluates.
+// Returns 0 or an errno value.
+PRISONER_INTERNAL int _corpus_write(
+    const char *path,
+    prisoner_ctx *ctx,
+    enum corpus_encoding encoding,
+    uint64_t seed,
+    uint64_t permutations
+);
+
+// Evaluates every permutation in `corpus` with `chances` and `evaluator`, on
+// `threads` threads, or one per CPU if zero. If `results_fd` is not negative, a
+// byte per permutation, one of `enum corpus_outcome`, is written there at the
+// permutation's offset as each chunk finishes. Returns 0 or an errno value.
+PRISONER_INTERNAL int _run_corpus(
+    const struct corpus *corpus,
+    unsigned int chances,
+    enum evaluator evaluator,
+    unsigned int threads,
+    int results_fd,
+    struct corpus_results *results
+);
+
+#endif
@@ -0,0 +1,211 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "counters.h"
+
+
+const char *const counter_names[COUNTER_COUNT] = {
+    "cycles",
+    "instructions",
+    "branch-misses",
+    "L1d-misses",
+    "LLC-misses",
+    "dTLB-misses",
+    "task-clock-ns",
+    "page-faults",
+};
+
+
+#ifdef __linux__
+
+static void _counter_attr(enum counter counter, struct perf_event_attr *attr) {
+    memset(attr, 0, sizeof(struct perf_event_attr));
+    attr->size = sizeof(struct perf_event_attr);
+    attr->type = PERF_TYPE_HARDWARE;
+
+    switch (counter) {
+        case COUNTER_CYCLES:
+            attr->config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case COUNTER_INSTRUCTIONS:
+            attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case COUNTER_BRANCH_MISSES:
+            attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        case COUNTER_L1D_MISSES:
+            attr->type = PERF_TYPE_HW_CACHE;
+            attr->config = PERF_COUNT_HW_CACHE_L1D
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case COUNTER_LLC_MISSES:
+            attr->type = PERF_TYPE_HW_CACHE;
+            attr->config = PERF_COUNT_HW_CACHE_LL
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case COUNTER_DTLB_MISSES:
+            attr->type = PERF_TYPE_HW_CACHE;
+            attr->config = PERF_COUNT_HW_CACHE_DTLB
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case COUNTER_TASK_CLOCK:
+            attr->type = PERF_TYPE_SOFTWARE;
+            attr->config = PERF_COUNT_SW_TASK_CLOCK;
+            break;
+        case COUNTER_PAGE_FAULTS:
+            attr->type = PERF_TYPE_SOFTWARE;
+            attr->config = PERF_COUNT_SW_PAGE_FAULTS;
+            break;
+        case COUNTER_COUNT:
+            break;
+    }
+
+    attr->read_format = PERF_FORMAT_GROUP
+        | PERF_FORMAT_TOTAL_TIME_ENABLED
+        | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr->exclude_kernel = 1;
+    attr->exclude_hv = 1;
+}
+
+
+int _counters_open(struct counters *counters) {
+    int error = ENOENT;
+
+    memset(counters, 0, sizeof(struct counters));
+    counters->leader = -1;
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        struct perf_event_attr attr;
+
+        _counter_attr(i, &attr);
+
+        // The leader starts disabled, and so holds the whole group back until
+        // everything is open.
+        attr.disabled = counters->leader == -1;
+        counters->fds[i] = (int) syscall(
+            SYS_perf_event_open, &attr, 0, -1, counters->leader, 0
+        );
+        counters->slots[i] = -1;
+
+        if (counters->fds[i] == -1) {
+            error = errno;
+            continue;
+        }
+
+        if (counters->leader == -1) {
+            counters->leader = counters->fds[i];
+        }
+
+        counters->slots[i] = (int) counters->opened++;
+    }
+
+    if (counters->leader == -1) {
+        return error;
+    }
+
+    ioctl(counters->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(counters->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+    return 0;
+}
+
+
+void _counters_close(struct counters *counters) {
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (counters->slots[i] != -1) {
+            close(counters->fds[i]);
+            counters->slots[i] = -1;
+        }
+    }
+
+    counters->leader = -1;
+    counters->opened = 0;
+}
+
+
+void _counters_sample(struct counters *counters, struct counter_values *into) {
+    // nr, time_enabled and time_running, then one value per event.
+    uint64_t buffer[3 + COUNTER_COUNT];
+    struct counter_values now = {0};
+
+    if (counters->leader == -1 || read(counters->leader, buffer, sizeof(buffer)) < 24) {
+        return;
+    }
+
+    now.enabled = buffer[1];
+    now.running = buffer[2];
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (counters->slots[i] != -1 && (uint64_t) counters->slots[i] < buffer[0]) {
+            now.values[i] = buffer[3 + counters->slots[i]];
+        }
+    }
+
+    into->enabled += now.enabled - counters->last.enabled;
+    into->running += now.running - counters->last.running;
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        into->values[i] += now.values[i] - counters->last.values[i];
+    }
+
+    counters->last = now;
+}
+
+#else
+
+int _counters_open(struct counters *counters) {
+    memset(counters, 0, sizeof(struct counters));
+    counters->leader = -1;
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        counters->slots[i] = -1;
+    }
+
+    return ENOSYS;
+}
+
+
+void _counters_close(struct counters *counters) {
+}
+
+
+void _counters_sample(struct counters *counters, struct counter_values *into) {
+}
+
+#endif
+
+
+bool _counters_available(const struct counters *counters, enum counter counter) {
+    return counters->slots[counter] != -1;
+}
+
+
+void _counter_values_add(struct counter_values *into, const struct counter_values *values) {
+    into->enabled += values->enabled;
+    into->running += values->running;
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        into->values[i] += values->values[i];
+    }
+}
+
+
+double _counter_value_scaled(const struct counter_values *values, enum counter counter) {
+    if (values->running == 0) {
+        return 0;
+    }
+
+    return (double) values->values[counter] * values->enabled / values->running;
+}
@@ -0,0 +1,82 @@
+#ifndef PRISONER_COUNTERS_H
+#define PRISONER_COUNTERS_H
+
+// Hardware performance counters for the calling thread, read through
+// perf_event_open. Every event is opened in one group so that a single read
+// samples them all at the same instant, and only user space is counted, so the
+// reads themselves do not show up in the numbers. Events the machine does not
+// support are left out, and on anything but Linux nothing can be opened at all.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef PRISONER_INTERNAL
+#define PRISONER_INTERNAL __attribute__((visibility("hidden")))
+#endif
+
+enum counter {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_L1D_MISSES,
+    COUNTER_LLC_MISSES,
+    COUNTER_DTLB_MISSES,
+    // Software events, which work even where the hardware is not exposed, such
+    // as in most virtual machines.
+    COUNTER_TASK_CLOCK,
+    COUNTER_PAGE_FAULTS,
+    COUNTER_COUNT,
+};
+
+PRISONER_INTERNAL extern const char *const counter_names[COUNTER_COUNT];
+
+struct counter_values {
+    uint64_t values[COUNTER_COUNT];
+
+    // How long the group was enabled and actually on the PMU. They differ when
+    // the kernel had to multiplex it with other events.
+    uint64_t enabled;
+    uint64_t running;
+};
+
+struct counters {
+    int leader;
+    int fds[COUNTER_COUNT];
+
+    // Where each event's value is in a group read, or -1 if it did not open.
+    int slots[COUNTER_COUNT];
+    unsigned int opened;
+
+    struct counter_values last;
+};
+
+// Opens every supported event for the calling thread and starts counting.
+// Returns 0, or an errno value if not even one event could be opened.
+PRISONER_INTERNAL int _counters_open(struct counters *counters);
+PRISONER_INTERNAL void _counters_close(struct counters *counters);
+
+PRISONER_INTERNAL bool _counters_available(
+    const struct counters *counters,
+    enum counter counter
+);
+
+// Adds everything counted since the previous sample, or since opening, to
+// `into`.
+PRISONER_INTERNAL void _counters_sample(
+    struct counters *counters,
+    struct counter_values *into
+);
+
+// Adds `values` to `into`.
+PRISONER_INTERNAL void _counter_values_add(
+    struct counter_values *into,
+    const struct counter_values *values
+);
+
+// The value of `counter` scaled up for any time the group was not running.
+PRISONER_INTERNAL double _counter_value_scaled(
+    const struct counter_values *values,
+    enum counter counter
+);
+
+#endif
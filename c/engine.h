@@ -0,0 +1,209 @@
+#ifndef PRISONER_ENGINE_H
+#define PRISONER_ENGINE_H
+
+// The internals of libprisoner, shared with the tools in this directory that need
+// to drive individual kernels rather than whole trials. None of this is part of
+// the stable API in prisoner.h: the kernels are hidden from the shared library's
+// exports, so only code linked against libprisoner.a can call them.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "prisoner.h"
+
+#ifndef PRISONER_INTERNAL
+#define PRISONER_INTERNAL __attribute__((visibility("hidden")))
+#endif
+
+#include "counters.h"
+#include "latency.h"
+#include "progress.h"
+
+// The interchangeable ways of evaluating a permutation without budgets, which
+// all give the same outcome but trade memory for work differently.
+enum evaluator {
+    // run_optimized.
+    EVALUATOR_OPTIMIZED,
+    // Winning exactly when the longest loop fits in the chances.
+    EVALUATOR_LONGEST_LOOP,
+    // run_bitset.
+    EVALUATOR_BITSET,
+    EVALUATOR_COUNT,
+};
+
+// The two halves of a trial, which are counted separately when counters are on.
+enum phase {
+    // Arranging the boxes.
+    PHASE_SHUFFLE,
+    // Playing the game on them.
+    PHASE_EVALUATE,
+    PHASE_COUNT,
+};
+
+
+// xoshiro256**, seeded through splitmix64. Unlike rand(), its state lives in the
+// context, so contexts never contend for (or disturb) each other's streams.
+struct rng {
+    uint64_t state[4];
+};
+
+struct prisoner_ctx {
+    prisoner_config config;
+    bool mapped;
+
+    struct rng rng;
+
+    unsigned int *boxes;
+    bool *slips_seen;
+
+    // The adversarial modes keep the warden's chosen layout fixed, and the
+    // prisoners defend against it with a secret relabeling that is redrawn for
+    // every trial. Only allocated when there is a warden or a relabeling.
+    unsigned int *layout;
+    unsigned int *relabeling;
+    unsigned int *inverse;
+
+    // When set, prisoner `p` may open `budgets[p]` boxes rather than `chances`.
+    unsigned int *budgets;
+
+    // Loop lengths found by the swaps variant.
+    unsigned int *lengths;
+
+    // The random-mapping variant follows every box to the loop it ends up in.
+    // `visited` is also run_bitset's record of the boxes seen, so it is always
+    // allocated.
+    // Each box on the current walk is flagged in `on_path` until the walk ends,
+    // and is then given its distance from the loop and that loop's length.
+    uint64_t *visited;
+    uint64_t *on_path;
+    unsigned int *path;
+    unsigned int *tail_length;
+    unsigned int *loop_length;
+    prisoner_mapping_stats stats;
+
+    // If not NULL, every trial adds what the counters saw during each phase to
+    // `phases`.
+    struct counters *counters;
+    struct counter_values phases[PHASE_COUNT];
+
+    // If not NULL, how long every trial took is recorded in the histogram for its
+    // outcome, which counts the counters' own reads too.
+    struct histogram *latency;
+
+    // How trials with neither a mapping nor budgets are evaluated.
+    enum evaluator evaluator;
+};
+
+
+static inline uint64_t _rotl(uint64_t value, int shift) {
+    return (value << shift) | (value >> (64 - shift));
+}
+
+
+static inline uint64_t _next(struct rng *rng) {
+    uint64_t *s = rng->state;
+    uint64_t result = _rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = _rotl(s[3], 45);
+
+    return result;
+}
+
+
+// Seeds `rng` as prisoner_seed seeds a context's.
+PRISONER_INTERNAL void _rng_seed(struct rng *rng, uint64_t seed);
+
+
+static inline unsigned int _generate_range(struct rng *rng, unsigned int max) {
+    return (unsigned int) ((_next(rng) >> 32) % max);
+}
+
+
+// Arrangements: each fills in `ctx->boxes` for the next trial.
+PRISONER_INTERNAL void _shuffle(struct rng *rng, unsigned int *permutation, unsigned int count);
+PRISONER_INTERNAL void _generate_boxes(prisoner_ctx *ctx);
+PRISONER_INTERNAL void _arrange_boxes(prisoner_ctx *ctx);
+PRISONER_INTERNAL void _generate_mapping(prisoner_ctx *ctx);
+
+// Evaluations: each reads `ctx->boxes` and nothing else that changes between
+// trials, so they can be pointed at any arrangement of the right size.
+PRISONER_INTERNAL bool run_optimized(prisoner_ctx *ctx);
+PRISONER_INTERNAL bool run_bitset(prisoner_ctx *ctx);
+PRISONER_INTERNAL bool run_budgets(prisoner_ctx *ctx);
+PRISONER_INTERNAL bool run_mapping(prisoner_ctx *ctx);
+PRISONER_INTERNAL unsigned int _cycle_lengths(prisoner_ctx *ctx);
+PRISONER_INTERNAL unsigned int _longest_loop(prisoner_ctx *ctx);
+
+// Evaluates a permutation without budgets with `ctx->evaluator`.
+PRISONER_INTERNAL bool _evaluate(prisoner_ctx *ctx);
+
+// Parallel runs hand out trials in chunks of this many, each with its own seed, so
+// the results depend only on the seed and not on how many threads there are or
+// which thread runs which chunk.
+#define CHUNK_TRIALS 16384
+
+// The seed a parallel run seeds its context with before a chunk's trials.
+PRISONER_INTERNAL uint64_t _chunk_seed(uint64_t seed, uint64_t chunk);
+
+// How much of a parallel run one thread did.
+struct thread_report {
+    uint64_t trials;
+
+    // From the thread starting to it running out of chunks, and the CPU time it
+    // used in that span.
+    double wall_seconds;
+    double cpu_seconds;
+
+    // What the thread's counters saw in each phase, if they were on.
+    struct counter_values phases[PHASE_COUNT];
+
+    // How long each of the thread's trials took, by outcome, if that was on.
+    struct histogram latency[OUTCOME_COUNT];
+};
+
+struct trace_writer;
+
+struct run_options {
+    // If not NULL, worker `i` is pinned to CPU `cpus[i % cpus_len]`.
+    const int *cpus;
+    unsigned int cpus_len;
+
+    // Whether every worker opens its own counters. A worker that cannot fails
+    // the run.
+    bool counters;
+
+    // Whether every worker times each of its trials.
+    bool latency;
+
+    // If not NULL, worker `i` publishes its progress in `progress->slots[i]`
+    // after every chunk. There must be a slot for every worker.
+    struct progress *progress;
+
+    // How every worker evaluates its trials, where there is a choice.
+    enum evaluator evaluator;
+
+    // If not NULL, every worker records its trials to this trace.
+    struct trace_writer *trace;
+
+    // If not NULL, what each worker did. Unless `threads` is zero, this must have
+    // room for that many; any beyond the number of chunks in the run are zeroed.
+    struct thread_report *reports;
+};
+
+// prisoner_run_parallel with extra options, which may be NULL.
+PRISONER_INTERNAL int _run_parallel(
+    const prisoner_config *config,
+    uint64_t seed,
+    uint64_t trials,
+    unsigned int threads,
+    const struct run_options *options,
+    prisoner_results *results
+);
+
+#endif
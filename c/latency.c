@@ -0,0 +1,101 @@
+#include <time.h>
+#include <stdint.h>
+
+#include "latency.h"
+
+
+void _histogram_add(struct histogram *into, const struct histogram *values) {
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        into->counts[i] += values->counts[i];
+    }
+
+    into->total += values->total;
+
+    if (values->max > into->max) {
+        into->max = values->max;
+    }
+}
+
+
+// The largest value that falls into `bucket`.
+static uint64_t _bucket_high(unsigned int bucket) {
+    if (bucket < (2u << HISTOGRAM_SUB_BITS)) {
+        return bucket;
+    }
+
+    unsigned int shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+    uint64_t low = (uint64_t) ((bucket & ((1u << HISTOGRAM_SUB_BITS) - 1))
+        + (1u << HISTOGRAM_SUB_BITS)) << shift;
+
+    return low + ((uint64_t) 1 << shift) - 1;
+}
+
+
+uint64_t _histogram_quantile(const struct histogram *histogram, double quantile) {
+    double exact = quantile * (double) histogram->total;
+    uint64_t rank = (uint64_t) exact, seen = 0;
+
+    if (histogram->total == 0) {
+        return 0;
+    }
+
+    // Rounded up, and at least the first value.
+    if (rank < exact || rank == 0) {
+        rank++;
+    }
+
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->counts[i];
+
+        if (seen >= rank) {
+            uint64_t high = _bucket_high(i);
+
+            return high < histogram->max ? high : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static double _monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+double _ticks_per_ns(void) {
+    double start_ns = _monotonic_ns(), end_ns;
+    uint64_t start = _ticks(), end;
+
+    // Long enough for the clocks' own resolution not to matter.
+    do {
+        end_ns = _monotonic_ns();
+        end = _ticks();
+    } while (end_ns - start_ns < 20e6);
+
+    return (double) (end - start) / (end_ns - start_ns);
+}
+
+
+const char *_ticks_source(void) {
+    return "rdtsc";
+}
+
+#else
+
+double _ticks_per_ns(void) {
+    return 1;
+}
+
+
+const char *_ticks_source(void) {
+    return "CLOCK_MONOTONIC";
+}
+
+#endif
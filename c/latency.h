@@ -0,0 +1,94 @@
+#ifndef PRISONER_LATENCY_H
+#define PRISONER_LATENCY_H
+
+// Per-trial latency, in ticks of the cheapest clock the machine has: the
+// timestamp counter on x86, and the monotonic clock in nanoseconds anywhere else.
+// Ticks go into log-bucketed histograms in the style of HdrHistogram, which keep
+// every value to within about 3% in a fixed 15K, so recording one is a couple of
+// shifts and an increment.
+
+#include <time.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef PRISONER_INTERNAL
+#define PRISONER_INTERNAL __attribute__((visibility("hidden")))
+#endif
+
+// Each power of two is split into 2^HISTOGRAM_SUB_BITS buckets, and values below
+// twice that are counted exactly.
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+struct histogram {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+};
+
+// Trials are timed separately by how they ended, since a loss can stop early.
+enum outcome {
+    OUTCOME_LOST,
+    OUTCOME_WON,
+    OUTCOME_COUNT,
+};
+
+
+static inline uint64_t _ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    // The builtin rather than x86intrin.h, whose _rotl would clash with ours. It
+    // is not serializing, so a few instructions either side may leak across,
+    // which is noise next to a trial.
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+
+static inline unsigned int _histogram_bucket(uint64_t value) {
+    if (value < (2u << HISTOGRAM_SUB_BITS)) {
+        return (unsigned int) value;
+    }
+
+    unsigned int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+
+    return ((shift + 1) << HISTOGRAM_SUB_BITS)
+        + (unsigned int) (value >> shift) - (1u << HISTOGRAM_SUB_BITS);
+}
+
+
+static inline void _histogram_record(struct histogram *histogram, uint64_t value) {
+    histogram->counts[_histogram_bucket(value)]++;
+    histogram->total++;
+
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+// Adds every value in `values` to `into`.
+PRISONER_INTERNAL void _histogram_add(
+    struct histogram *into,
+    const struct histogram *values
+);
+
+// The smallest value that at least `quantile` of the recorded ones are no
+// larger than, to within the width of its bucket. Zero if nothing was recorded.
+PRISONER_INTERNAL uint64_t _histogram_quantile(
+    const struct histogram *histogram,
+    double quantile
+);
+
+// How many ticks make a nanosecond, measured against the monotonic clock over a
+// few milliseconds when ticks are not already nanoseconds.
+PRISONER_INTERNAL double _ticks_per_ns(void);
+
+// A name for where ticks come from.
+PRISONER_INTERNAL const char *_ticks_source(void);
+
+#endif
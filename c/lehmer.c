@@ -0,0 +1,242 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "lehmer.h"
+
+
+struct bit_writer {
+    uint8_t *dest;
+    uint64_t bits;
+    unsigned int len;
+};
+
+struct bit_reader {
+    const uint8_t *src;
+    uint64_t bits;
+    unsigned int len;
+};
+
+
+// How many digits from `first` on fit in one block, and the product of their
+// radices, which is below 2^64. The last digit's radix is 1, so every block
+// holds at least one.
+static unsigned int _block(unsigned int count, unsigned int first, uint64_t *radix) {
+    uint64_t product = 1, next;
+    unsigned int i = first;
+
+    while (i < count && !__builtin_mul_overflow(product, (uint64_t) (count - i), &next)) {
+        product = next;
+        i++;
+    }
+
+    *radix = product;
+
+    return i - first;
+}
+
+
+// Enough bits for every value below `radix`.
+static inline unsigned int _block_bits(uint64_t radix) {
+    return radix <= 1 ? 0 : 64 - __builtin_clzll(radix - 1);
+}
+
+
+static inline void _store_le(uint8_t *dest, uint64_t value, unsigned int bytes) {
+    for (unsigned int i = 0; i < bytes; i++) {
+        dest[i] = (uint8_t) (value >> (8 * i));
+    }
+}
+
+
+static inline void _put_bits(struct bit_writer *writer, uint64_t value, unsigned int bits) {
+    if (bits == 0) {
+        return;
+    }
+
+    writer->bits |= value << writer->len;
+
+    if (writer->len + bits < 64) {
+        writer->len += bits;
+        return;
+    }
+
+    _store_le(writer->dest, writer->bits, 8);
+    writer->dest += 8;
+
+    // What did not fit in the word just stored.
+    unsigned int stored = 64 - writer->len;
+
+    writer->bits = stored < 64 ? value >> stored : 0;
+    writer->len = writer->len + bits - 64;
+}
+
+
+static inline void _flush_bits(struct bit_writer *writer) {
+    _store_le(writer->dest, writer->bits, (writer->len + 7) / 8);
+}
+
+
+static inline uint64_t _get_narrow_bits(struct bit_reader *reader, unsigned int bits) {
+    // Bytes are only read as they are needed, so nothing past the encoding is.
+    while (reader->len < bits) {
+        reader->bits |= (uint64_t) *reader->src++ << reader->len;
+        reader->len += 8;
+    }
+
+    uint64_t value = reader->bits & ((UINT64_C(1) << bits) - 1);
+
+    reader->bits >>= bits;
+    reader->len -= bits;
+
+    return value;
+}
+
+
+static inline uint64_t _get_bits(struct bit_reader *reader, unsigned int bits) {
+    if (bits <= 32) {
+        return _get_narrow_bits(reader, bits);
+    }
+
+    uint64_t low = _get_narrow_bits(reader, 32);
+
+    return low | _get_narrow_bits(reader, bits - 32) << 32;
+}
+
+
+size_t _lehmer_bytes(unsigned int count) {
+    uint64_t bits = 0, radix;
+
+    for (unsigned int i = 0; i < count; ) {
+        i += _block(count, i, &radix);
+        bits += _block_bits(radix);
+    }
+
+    return (size_t) ((bits + 7) / 8);
+}
+
+
+static void _invert(
+    const unsigned int *boxes,
+    unsigned int count,
+    unsigned int *permutation,
+    unsigned int *inverse
+) {
+    memcpy(permutation, boxes, count * sizeof(unsigned int));
+
+    for (unsigned int i = 0; i < count; i++) {
+        inverse[permutation[i]] = i;
+    }
+}
+
+
+// Takes the digits from `first` to `first + len` off the permutation, as a
+// mixed-radix number with the first digit least significant. Each one is where
+// the largest remaining element is, and is removed by swapping it into place.
+static uint64_t _take_digits(
+    unsigned int *permutation,
+    unsigned int *inverse,
+    unsigned int count,
+    unsigned int first,
+    unsigned int len
+) {
+    uint64_t value = 0, place = 1;
+
+    for (unsigned int i = first; i < first + len; i++) {
+        unsigned int size = count - i, last = size - 1;
+        unsigned int digit = permutation[last], slot = inverse[last];
+
+        permutation[slot] = digit;
+        inverse[digit] = slot;
+        value += digit * place;
+        place *= size;
+    }
+
+    return value;
+}
+
+
+// The reverse of `_take_digits`, on `boxes` as it was when they were taken.
+static void _apply_digits(
+    unsigned int *boxes,
+    unsigned int count,
+    unsigned int first,
+    unsigned int len,
+    uint64_t value
+) {
+    for (unsigned int i = first; i < first + len; i++) {
+        unsigned int size = count - i, last = size - 1;
+        unsigned int digit = (unsigned int) (value % size), swapped = boxes[last];
+
+        value /= size;
+        boxes[last] = boxes[digit];
+        boxes[digit] = swapped;
+    }
+}
+
+
+static void _identity(unsigned int *boxes, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        boxes[i] = i;
+    }
+}
+
+
+void _lehmer_encode(
+    const unsigned int *boxes,
+    unsigned int count,
+    unsigned int *scratch,
+    uint8_t *dest
+) {
+    unsigned int *permutation = scratch, *inverse = scratch + count;
+    struct bit_writer writer = {dest, 0, 0};
+    uint64_t radix;
+
+    _invert(boxes, count, permutation, inverse);
+
+    for (unsigned int i = 0, len; i < count; i += len) {
+        len = _block(count, i, &radix);
+        _put_bits(&writer, _take_digits(permutation, inverse, count, i, len), _block_bits(radix));
+    }
+
+    _flush_bits(&writer);
+}
+
+
+bool _lehmer_decode(const uint8_t *src, unsigned int count, unsigned int *boxes) {
+    struct bit_reader reader = {src, 0, 0};
+    uint64_t radix;
+
+    // Digits are taken from the largest element down, so they are applied to
+    // the identity in the same order to put each back.
+    _identity(boxes, count);
+
+    for (unsigned int i = 0, len; i < count; i += len) {
+        len = _block(count, i, &radix);
+
+        uint64_t value = _get_bits(&reader, _block_bits(radix));
+
+        if (value >= radix) {
+            return false;
+        }
+
+        _apply_digits(boxes, count, i, len, value);
+    }
+
+    return true;
+}
+
+
+uint64_t _lehmer_rank(const unsigned int *boxes, unsigned int count, unsigned int *scratch) {
+    unsigned int *permutation = scratch, *inverse = scratch + count;
+
+    _invert(boxes, count, permutation, inverse);
+
+    return _take_digits(permutation, inverse, count, 0, count);
+}
+
+
+void _lehmer_unrank(uint64_t rank, unsigned int count, unsigned int *boxes) {
+    _identity(boxes, count);
+    _apply_digits(boxes, count, 0, count, rank);
+}
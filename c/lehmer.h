@@ -0,0 +1,59 @@
+#ifndef PRISONER_LEHMER_H
+#define PRISONER_LEHMER_H
+
+// Compact encodings of permutations, for storing and sending them. A permutation
+// of `count` elements is written as its Myrvold-Ruskey digits, a Lehmer-style
+// code whose i-th digit is below `count - i` and which, unlike the lexicographic
+// Lehmer code, ranks and unranks in linear time with a swap per digit.
+//
+// Packing every digit into one big mixed-radix number would take the minimum,
+// ceil(log2(count!)) bits, but quadratic time. Instead, consecutive digits are
+// combined into blocks whose radices multiply to less than 2^64, and each block
+// is written in just enough bits for its largest value. That wastes under a bit
+// per block: 100 elements take 67 bytes rather than 400 as unsigned ints, where
+// log2(100!) rounds up to 66. The bits are packed least significant first, so
+// encodings read the same on any machine.
+//
+// Up to LEHMER_MAX_RANKED elements fit in a single block, whose value is then the
+// permutation's rank among all count! of them.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef PRISONER_INTERNAL
+#define PRISONER_INTERNAL __attribute__((visibility("hidden")))
+#endif
+
+// 20! is the largest factorial below 2^64.
+#define LEHMER_MAX_RANKED 20
+
+// How many bytes `_lehmer_encode` writes for `count` elements.
+PRISONER_INTERNAL size_t _lehmer_bytes(unsigned int count);
+
+// Encodes `boxes`, which must be a permutation of 0 to `count - 1`, to `dest`.
+// `scratch` must have room for `2 * count` values.
+PRISONER_INTERNAL void _lehmer_encode(
+    const unsigned int *boxes,
+    unsigned int count,
+    unsigned int *scratch,
+    uint8_t *dest
+);
+
+// Decodes `count` elements from `src` to `boxes`. Returns false if `src` holds
+// a digit out of range, which no encoding does.
+PRISONER_INTERNAL bool _lehmer_decode(const uint8_t *src, unsigned int count, unsigned int *boxes);
+
+// The rank of `boxes`, a permutation of at most LEHMER_MAX_RANKED elements,
+// below `count!`. `scratch` must have room for `2 * count` values.
+PRISONER_INTERNAL uint64_t _lehmer_rank(
+    const unsigned int *boxes,
+    unsigned int count,
+    unsigned int *scratch
+);
+
+// The permutation of `count` elements, at most LEHMER_MAX_RANKED, with `rank`,
+// which must be below `count!`.
+PRISONER_INTERNAL void _lehmer_unrank(uint64_t rank, unsigned int count, unsigned int *boxes);
+
+#endif
@@ -0,0 +1,1078 @@
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <sched.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "prisoner.h"
+#include "engine.h"
+#include "trace.h"
+
+
+static uint64_t _splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+
+    return z ^ (z >> 31);
+}
+
+
+void _shuffle(struct rng *rng, unsigned int *permutation, unsigned int count) {
+    for (unsigned int i = count - 1; i > 0; i--) {
+        unsigned int to_swap = _generate_range(rng, i + 1);
+        unsigned int left = permutation[i], right = permutation[to_swap];
+
+        permutation[to_swap] = left;
+        permutation[i] = right;
+    }
+}
+
+
+void _generate_boxes(prisoner_ctx *ctx) {
+    // Now, redistribute the slips randomly.
+    _shuffle(&ctx->rng, ctx->boxes, ctx->config.count);
+}
+
+
+static void _compose_permutations(
+    unsigned int *dest,
+    const unsigned int *outer,
+    const unsigned int *inner,
+    unsigned int count
+) {
+    // dest = outer ∘ inner. Every load is independent of the last, so this is a
+    // plain gather rather than a chain of dependent loads, and it is safe for
+    // `dest` to be the same array as `inner`.
+    for (unsigned int i = 0; i < count; i++) {
+        dest[i] = outer[inner[i]];
+    }
+}
+
+
+static void _invert_permutation(
+    unsigned int *dest,
+    const unsigned int *permutation,
+    unsigned int count
+) {
+    for (unsigned int i = 0; i < count; i++) {
+        dest[permutation[i]] = i;
+    }
+}
+
+
+void _arrange_boxes(prisoner_ctx *ctx) {
+    unsigned int count = ctx->config.count;
+
+    if (ctx->config.warden == PRISONER_WARDEN_RANDOM) {
+        _generate_boxes(ctx);
+        return;
+    }
+
+    if (!ctx->config.relabel) {
+        // The boxes already hold the warden's layout, and nothing changes it.
+        return;
+    }
+
+    // Prisoner `p` starts at box `relabeling[p]`, and on finding slip `s` moves on
+    // to box `relabeling[s]`, so they are walking the loops of boxes ∘ relabeling.
+    // That is uniformly distributed whatever the warden does, as long as the
+    // relabeling stays secret.
+    _shuffle(&ctx->rng, ctx->relabeling, count);
+
+    const unsigned int *arranged = ctx->layout;
+
+    if (ctx->config.warden == PRISONER_WARDEN_LEAKED) {
+        // Knowing the relabeling, the warden plants layout ∘ relabeling⁻¹, which
+        // the prisoners' own relabeling turns straight back into the long loop.
+        _invert_permutation(ctx->inverse, ctx->relabeling, count);
+        _compose_permutations(ctx->inverse, ctx->layout, ctx->inverse, count);
+        arranged = ctx->inverse;
+    }
+
+    // Compose once up front, rather than paying for a second dependent load on
+    // every step of the walk below.
+    _compose_permutations(ctx->boxes, arranged, ctx->relabeling, count);
+}
+
+
+bool run_optimized(prisoner_ctx *ctx) {
+    unsigned int count = ctx->config.count, chances = ctx->config.chances;
+    const unsigned int *boxes = ctx->boxes;
+    bool *slips_seen = ctx->slips_seen;
+
+    memset(slips_seen, false, count * sizeof(bool));
+
+    for (unsigned int prisoner = 0; prisoner < count; prisoner++) {
+        unsigned int next_box = prisoner;
+
+        if (slips_seen[prisoner] == true) {
+            continue;
+        }
+
+        for (unsigned int _i = 0; _i <= chances; _i++) {
+            if (_i == chances) {
+                return false;
+            }
+
+            unsigned int slip = boxes[next_box];
+            slips_seen[slip] = true;
+
+            if (slip == prisoner) {
+                break;
+            }
+
+            next_box = slip;
+        }
+    }
+
+    return true;
+}
+
+
+unsigned int _cycle_lengths(prisoner_ctx *ctx) {
+    unsigned int count = ctx->config.count, cycles = 0;
+    const unsigned int *boxes = ctx->boxes;
+    bool *slips_seen = ctx->slips_seen;
+
+    memset(slips_seen, false, count * sizeof(bool));
+
+    for (unsigned int prisoner = 0; prisoner < count; prisoner++) {
+        unsigned int next_box = prisoner, length = 0;
+
+        if (slips_seen[prisoner] == true) {
+            continue;
+        }
+
+        do {
+            slips_seen[next_box] = true;
+            next_box = boxes[next_box];
+            length++;
+        } while (next_box != prisoner);
+
+        ctx->lengths[cycles++] = length;
+    }
+
+    return cycles;
+}
+
+
+unsigned int _longest_loop(prisoner_ctx *ctx) {
+    // Once the longest loop found covers at least as many boxes as have not been
+    // visited yet, nothing left can be any longer.
+    unsigned int count = ctx->config.count, longest = 0, remaining = count;
+    const unsigned int *boxes = ctx->boxes;
+    bool *slips_seen = ctx->slips_seen;
+
+    memset(slips_seen, false, count * sizeof(bool));
+
+    for (unsigned int prisoner = 0; prisoner < count && remaining > longest; prisoner++) {
+        unsigned int next_box = prisoner, length = 0;
+
+        if (slips_seen[prisoner] == true) {
+            continue;
+        }
+
+        do {
+            slips_seen[next_box] = true;
+            next_box = boxes[next_box];
+            length++;
+        } while (next_box != prisoner);
+
+        remaining -= length;
+
+        if (length > longest) {
+            longest = length;
+        }
+    }
+
+    return longest;
+}
+
+
+static unsigned int _halvings_needed(unsigned int length, unsigned int chances) {
+    if (length <= chances) {
+        return 0;
+    }
+
+    return 1
+        + _halvings_needed(length / 2, chances)
+        + _halvings_needed(length - length / 2, chances);
+}
+
+
+static unsigned int _swaps_needed(
+    const unsigned int *lengths,
+    unsigned int cycles,
+    unsigned int chances,
+    prisoner_swap_policy policy,
+    unsigned int limit
+) {
+    // Swapping the slips in two boxes on the same loop splits it in two, at
+    // whatever point the swapper likes, and no swap can do better than that. So
+    // a loop of length `L` needs ceil(L / chances) - 1 swaps to be cut into
+    // pieces that every prisoner on it can get through.
+    unsigned int needed = 0;
+
+    if (chances == 0) {
+        return limit;
+    }
+
+    for (unsigned int i = 0; i < cycles && needed < limit; i++) {
+        if (lengths[i] <= chances) {
+            continue;
+        }
+
+        if (policy == PRISONER_SWAP_OPTIMAL) {
+            needed += (lengths[i] + chances - 1) / chances - 1;
+        } else {
+            needed += _halvings_needed(lengths[i], chances);
+        }
+    }
+
+    return needed < limit ? needed : limit;
+}
+
+
+bool run_budgets(prisoner_ctx *ctx) {
+    // Every prisoner on a loop needs exactly that loop's length in openings, so
+    // a loop succeeds only if it is no longer than the smallest budget of the
+    // prisoners on it. The smallest budget only ever shrinks as the loop is
+    // followed, so the walk can stop as soon as the loop outgrows it.
+    unsigned int count = ctx->config.count;
+    const unsigned int *boxes = ctx->boxes, *budgets = ctx->budgets;
+    bool *slips_seen = ctx->slips_seen;
+
+    memset(slips_seen, false, count * sizeof(bool));
+
+    for (unsigned int prisoner = 0; prisoner < count; prisoner++) {
+        unsigned int next_box = prisoner, length = 0;
+        unsigned int budget = budgets[prisoner];
+
+        if (slips_seen[prisoner] == true) {
+            continue;
+        }
+
+        do {
+            slips_seen[next_box] = true;
+
+            if (budgets[next_box] < budget) {
+                budget = budgets[next_box];
+            }
+
+            if (++length > budget) {
+                return false;
+            }
+
+            next_box = boxes[next_box];
+        } while (next_box != prisoner);
+    }
+
+    return true;
+}
+
+
+static inline bool _bit_test(const uint64_t *bits, unsigned int index) {
+    return (bits[index / 64] >> (index % 64)) & 1;
+}
+
+
+static inline void _bit_set(uint64_t *bits, unsigned int index) {
+    bits[index / 64] |= (uint64_t) 1 << (index % 64);
+}
+
+
+bool run_bitset(prisoner_ctx *ctx) {
+    // run_optimized with the boxes seen kept in a bitset, which is an eighth of
+    // the size, and which finds the next prisoner still to walk 64 at a time.
+    unsigned int count = ctx->config.count, chances = ctx->config.chances;
+    const unsigned int *boxes = ctx->boxes;
+    uint64_t *seen = ctx->visited;
+    unsigned int words = (count + 63) / 64;
+    uint64_t last_mask = count % 64 == 0 ? ~(uint64_t) 0 : ((uint64_t) 1 << (count % 64)) - 1;
+
+    memset(seen, 0, words * sizeof(uint64_t));
+
+    for (unsigned int word = 0; word < words; word++) {
+        uint64_t mask = word + 1 == words ? last_mask : ~(uint64_t) 0;
+        uint64_t unseen;
+
+        while ((unseen = ~seen[word] & mask) != 0) {
+            unsigned int prisoner = word * 64 + (unsigned int) __builtin_ctzll(unseen);
+            unsigned int next_box = prisoner, opened = 0;
+
+            do {
+                if (opened == chances) {
+                    return false;
+                }
+
+                next_box = boxes[next_box];
+                _bit_set(seen, next_box);
+                opened++;
+            } while (next_box != prisoner);
+        }
+    }
+
+    return true;
+}
+
+
+bool _evaluate(prisoner_ctx *ctx) {
+    switch (ctx->evaluator) {
+        case EVALUATOR_LONGEST_LOOP:
+            return _longest_loop(ctx) <= ctx->config.chances;
+        case EVALUATOR_BITSET:
+            return run_bitset(ctx);
+        default:
+            return run_optimized(ctx);
+    }
+}
+
+
+static inline void _bit_clear(uint64_t *bits, unsigned int index) {
+    bits[index / 64] &= ~((uint64_t) 1 << (index % 64));
+}
+
+
+void _generate_mapping(prisoner_ctx *ctx) {
+    unsigned int box_count = ctx->config.box_count;
+
+    if (ctx->config.mapping == PRISONER_MAPPING_PERMUTATION) {
+        _shuffle(&ctx->rng, ctx->boxes, box_count);
+        return;
+    }
+
+    for (unsigned int box = 0; box < box_count; box++) {
+        ctx->boxes[box] = _generate_range(&ctx->rng, box_count);
+    }
+}
+
+
+bool run_mapping(prisoner_ctx *ctx) {
+    // Following slips from any box eventually lands on a loop, so the boxes fall
+    // into components shaped like the letter rho: a loop with tails feeding into
+    // it. Prisoner `p` only ever sees their own slip if box `p` is on a loop
+    // (and not a tail), in which case it takes exactly that loop's length.
+    unsigned int count = ctx->config.count, box_count = ctx->config.box_count;
+    unsigned int chances = ctx->config.chances;
+    unsigned int prisoners_found = 0, longest_loop = 0, longest_tail = 0;
+    const unsigned int *boxes = ctx->boxes;
+    uint64_t *visited = ctx->visited, *on_path = ctx->on_path;
+    unsigned int *path = ctx->path;
+    unsigned int *tail_length = ctx->tail_length, *loop_length = ctx->loop_length;
+    prisoner_mapping_stats *stats = &ctx->stats;
+
+    memset(visited, 0, ((box_count + 63) / 64) * sizeof(uint64_t));
+
+    for (unsigned int start = 0; start < box_count; start++) {
+        unsigned int next_box = start, length = 0;
+
+        if (_bit_test(visited, start)) {
+            continue;
+        }
+
+        while (!_bit_test(visited, next_box)) {
+            _bit_set(visited, next_box);
+            _bit_set(on_path, next_box);
+            path[length++] = next_box;
+            next_box = boxes[next_box];
+        }
+
+        unsigned int tail = 0, loop;
+
+        if (_bit_test(on_path, next_box)) {
+            // The walk closed a new loop, starting at `next_box`.
+            unsigned int first = length - 1;
+
+            while (path[first] != next_box) {
+                first--;
+            }
+
+            loop = length - first;
+            tail = first;
+
+            stats->components++;
+            stats->cyclic_boxes += loop;
+
+            if (loop > longest_loop) {
+                longest_loop = loop;
+            }
+        } else {
+            // The walk ran into a component that has already been mapped.
+            loop = loop_length[next_box];
+            tail = length + tail_length[next_box];
+        }
+
+        if (tail > longest_tail) {
+            longest_tail = tail;
+        }
+
+        for (unsigned int i = 0; i < length; i++) {
+            unsigned int box = path[i];
+
+            _bit_clear(on_path, box);
+            tail_length[box] = tail > i ? tail - i : 0;
+            loop_length[box] = loop;
+        }
+    }
+
+    for (unsigned int prisoner = 0; prisoner < count; prisoner++) {
+        if (tail_length[prisoner] == 0 && loop_length[prisoner] <= chances) {
+            prisoners_found++;
+        }
+    }
+
+    stats->longest_cycle += longest_loop;
+    stats->longest_tail += longest_tail;
+    stats->prisoners_found += prisoners_found;
+
+    return prisoners_found == count;
+}
+
+
+prisoner_config prisoner_config_default(void) {
+    prisoner_config config = {
+        .count = 100,
+        .chances = 50,
+        .box_count = 0,
+        .mapping = PRISONER_MAPPING_PERMUTATION,
+        .warden = PRISONER_WARDEN_RANDOM,
+        .relabel = false,
+        .budgets = NULL,
+    };
+
+    return config;
+}
+
+
+prisoner_ctx *prisoner_create(const prisoner_config *config) {
+    prisoner_ctx *ctx;
+    unsigned int box_count;
+
+    if (config == NULL || config->count == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    box_count = config->box_count == 0 ? config->count : config->box_count;
+    bool mapped = box_count != config->count
+        || config->mapping != PRISONER_MAPPING_PERMUTATION;
+
+    if (box_count < config->count) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (mapped && (
+        config->warden != PRISONER_WARDEN_RANDOM
+        || config->relabel
+        || config->budgets != NULL
+    )) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    ctx = calloc(1, sizeof(prisoner_ctx));
+
+    if (ctx == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ctx->config = *config;
+    ctx->config.box_count = box_count;
+    ctx->config.budgets = NULL;
+    ctx->mapped = mapped;
+
+    if (config->warden == PRISONER_WARDEN_LEAKED) {
+        // A leak only means anything if there is a relabeling to leak.
+        ctx->config.relabel = true;
+    }
+
+    size_t size = box_count * sizeof(unsigned int);
+    bool allocated = true;
+
+    ctx->boxes = malloc(size);
+    ctx->slips_seen = malloc(box_count * sizeof(bool));
+    allocated = ctx->boxes != NULL && ctx->slips_seen != NULL;
+
+    size_t words = (box_count + 63) / 64;
+
+    ctx->visited = calloc(words, sizeof(uint64_t));
+    allocated = allocated && ctx->visited != NULL;
+
+    if (mapped) {
+        ctx->on_path = calloc(words, sizeof(uint64_t));
+        ctx->path = malloc(size);
+        ctx->tail_length = malloc(size);
+        ctx->loop_length = malloc(size);
+        allocated = allocated && ctx->on_path != NULL
+            && ctx->path != NULL && ctx->tail_length != NULL
+            && ctx->loop_length != NULL;
+    } else {
+        ctx->lengths = malloc(size);
+        allocated = allocated && ctx->lengths != NULL;
+    }
+
+    if (config->warden != PRISONER_WARDEN_RANDOM) {
+        ctx->layout = malloc(size);
+        ctx->relabeling = malloc(size);
+        ctx->inverse = malloc(size);
+        allocated = allocated && ctx->layout != NULL && ctx->relabeling != NULL
+            && ctx->inverse != NULL;
+    }
+
+    if (config->budgets != NULL) {
+        ctx->budgets = malloc(size);
+        allocated = allocated && ctx->budgets != NULL;
+    }
+
+    if (!allocated) {
+        prisoner_destroy(ctx);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (ctx->layout != NULL) {
+        // The warden's layout, if they choose one, is a single loop through every
+        // box.
+        for (unsigned int slip = 0; slip < box_count; slip++) {
+            ctx->layout[slip] = (slip + 1) % box_count;
+        }
+    }
+
+    if (config->budgets != NULL) {
+        memcpy(ctx->budgets, config->budgets, size);
+    }
+
+    prisoner_seed(ctx, 0);
+
+    return ctx;
+}
+
+
+void prisoner_destroy(prisoner_ctx *ctx) {
+    if (ctx == NULL) {
+        return;
+    }
+
+    free(ctx->boxes);
+    free(ctx->slips_seen);
+    free(ctx->layout);
+    free(ctx->relabeling);
+    free(ctx->inverse);
+    free(ctx->budgets);
+    free(ctx->lengths);
+    free(ctx->visited);
+    free(ctx->on_path);
+    free(ctx->path);
+    free(ctx->tail_length);
+    free(ctx->loop_length);
+    free(ctx);
+}
+
+
+void _rng_seed(struct rng *rng, uint64_t seed) {
+    for (int i = 0; i < 4; i++) {
+        rng->state[i] = _splitmix64(&seed);
+    }
+}
+
+
+void prisoner_seed(prisoner_ctx *ctx, uint64_t seed) {
+    unsigned int box_count = ctx->config.box_count;
+
+    _rng_seed(&ctx->rng, seed);
+
+    // Each shuffle starts from the last arrangement, so that has to be reset too
+    // for the same seed to replay the same trials.
+    for (unsigned int slip = 0; slip < box_count; slip++) {
+        ctx->boxes[slip] = slip;
+    }
+
+    if (ctx->layout != NULL) {
+        for (unsigned int slip = 0; slip < box_count; slip++) {
+            ctx->relabeling[slip] = slip;
+        }
+
+        memcpy(ctx->boxes, ctx->layout, box_count * sizeof(unsigned int));
+    }
+}
+
+
+static bool _trial_counted(prisoner_ctx *ctx) {
+    struct counter_values between = {0};
+    bool won;
+
+    // Anything counted since the last trial ended belongs to neither phase.
+    _counters_sample(ctx->counters, &between);
+
+    if (ctx->mapped) {
+        _generate_mapping(ctx);
+    } else {
+        _arrange_boxes(ctx);
+    }
+
+    _counters_sample(ctx->counters, &ctx->phases[PHASE_SHUFFLE]);
+
+    if (ctx->mapped) {
+        won = run_mapping(ctx);
+    } else if (ctx->budgets != NULL) {
+        won = run_budgets(ctx);
+    } else {
+        won = _evaluate(ctx);
+    }
+
+    _counters_sample(ctx->counters, &ctx->phases[PHASE_EVALUATE]);
+
+    return won;
+}
+
+
+static inline bool _trial(prisoner_ctx *ctx) {
+    if (ctx->mapped) {
+        _generate_mapping(ctx);
+        return run_mapping(ctx);
+    }
+
+    _arrange_boxes(ctx);
+
+    if (ctx->budgets != NULL) {
+        return run_budgets(ctx);
+    }
+
+    return _evaluate(ctx);
+}
+
+
+static bool _trial_measured(prisoner_ctx *ctx) {
+    uint64_t start = _ticks();
+    bool won = ctx->counters != NULL ? _trial_counted(ctx) : _trial(ctx);
+
+    if (ctx->latency != NULL) {
+        _histogram_record(&ctx->latency[won ? OUTCOME_WON : OUTCOME_LOST], _ticks() - start);
+    }
+
+    return won;
+}
+
+
+bool prisoner_trial(prisoner_ctx *ctx) {
+    if (ctx->counters != NULL || ctx->latency != NULL) {
+        return _trial_measured(ctx);
+    }
+
+    return _trial(ctx);
+}
+
+
+uint64_t prisoner_trial_batch(prisoner_ctx *ctx, bool *results, size_t trials) {
+    uint64_t wins = 0;
+
+    for (size_t i = 0; i < trials; i++) {
+        results[i] = prisoner_trial(ctx);
+        wins += results[i];
+    }
+
+    return wins;
+}
+
+
+uint64_t prisoner_run(prisoner_ctx *ctx, uint64_t trials) {
+    uint64_t wins = 0;
+
+    for (uint64_t i = 0; i < trials; i++) {
+        wins += prisoner_trial(ctx);
+    }
+
+    return wins;
+}
+
+
+bool prisoner_trial_swaps(
+    prisoner_ctx *ctx,
+    const unsigned int *chances,
+    size_t chances_len,
+    prisoner_swap_policy policy,
+    unsigned int limit,
+    unsigned int *needed
+) {
+    if (ctx->mapped) {
+        return false;
+    }
+
+    // One pass over the boxes finds every loop, after which each budget only
+    // needs to look at the handful of loop lengths.
+    _arrange_boxes(ctx);
+
+    unsigned int cycles = _cycle_lengths(ctx);
+
+    for (size_t j = 0; j < chances_len; j++) {
+        needed[j] = _swaps_needed(ctx->lengths, cycles, chances[j], policy, limit);
+    }
+
+    return true;
+}
+
+
+void prisoner_mapping_stats_get(
+    const prisoner_ctx *ctx,
+    prisoner_mapping_stats *stats
+) {
+    *stats = ctx->stats;
+}
+
+
+const unsigned int *prisoner_boxes(const prisoner_ctx *ctx) {
+    return ctx->boxes;
+}
+
+
+unsigned int prisoner_trial_longest_loop(prisoner_ctx *ctx) {
+    if (ctx->mapped || ctx->budgets != NULL) {
+        return 0;
+    }
+
+    _arrange_boxes(ctx);
+
+    return _longest_loop(ctx);
+}
+
+
+struct job {
+    const prisoner_config *config;
+    uint64_t seed;
+    uint64_t trials;
+    uint64_t chunks;
+    atomic_uint_fast64_t next_chunk;
+    bool sweep;
+    struct run_options options;
+};
+
+struct worker {
+    struct job *job;
+    unsigned int index;
+    pthread_t thread;
+    int error;
+
+    struct thread_report report;
+    uint64_t wins;
+    prisoner_mapping_stats mapping;
+
+    // For sweeps, how many trials had each longest loop length.
+    uint64_t *longest;
+};
+
+
+uint64_t _chunk_seed(uint64_t seed, uint64_t chunk) {
+    uint64_t state = seed ^ (chunk * 0xd1b54a32d192ed03);
+
+    return _splitmix64(&state);
+}
+
+
+// Rounds up without overflowing, which the usual (trials + CHUNK_TRIALS - 1)
+// would for trials near UINT64_MAX, leaving no chunks at all.
+static uint64_t _chunk_count(uint64_t trials) {
+    return trials / CHUNK_TRIALS + (trials % CHUNK_TRIALS != 0);
+}
+
+
+static double _seconds(clockid_t clock) {
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void *_worker_main(void *arg) {
+    struct worker *worker = arg;
+    struct job *job = worker->job;
+    double wall_start = _seconds(CLOCK_MONOTONIC);
+    double cpu_start = _seconds(CLOCK_THREAD_CPUTIME_ID);
+
+    const struct run_options *options = &job->options;
+    struct counters counters;
+
+    if (options->cpus != NULL && options->cpus_len > 0) {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(options->cpus[worker->index % options->cpus_len], &cpus);
+        worker->error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+        if (worker->error != 0) {
+            return NULL;
+        }
+    }
+
+    prisoner_ctx *ctx = prisoner_create(job->config);
+
+    if (ctx == NULL) {
+        worker->error = errno;
+        return NULL;
+    }
+
+    if (options->counters) {
+        // Counters only count the thread that opened them.
+        worker->error = _counters_open(&counters);
+
+        if (worker->error != 0) {
+            prisoner_destroy(ctx);
+            return NULL;
+        }
+
+        ctx->counters = &counters;
+    }
+
+    if (options->latency) {
+        ctx->latency = worker->report.latency;
+    }
+
+    ctx->evaluator = options->evaluator;
+
+    for (;;) {
+        uint64_t chunk = atomic_fetch_add_explicit(
+            &job->next_chunk, 1, memory_order_relaxed
+        );
+
+        if (chunk >= job->chunks) {
+            break;
+        }
+
+        uint64_t first = chunk * CHUNK_TRIALS;
+        uint64_t trials = job->trials - first < CHUNK_TRIALS
+            ? job->trials - first
+            : CHUNK_TRIALS;
+
+        prisoner_seed(ctx, _chunk_seed(job->seed, chunk));
+        worker->report.trials += trials;
+
+        if (job->sweep) {
+            for (uint64_t i = 0; i < trials; i++) {
+                worker->longest[prisoner_trial_longest_loop(ctx)]++;
+            }
+        } else if (options->trace != NULL) {
+            worker->wins += _trace_chunk(options->trace, ctx, chunk, trials);
+        } else {
+            worker->wins += prisoner_run(ctx, trials);
+        }
+
+        if (options->progress != NULL && worker->index < options->progress->slots_len) {
+            struct progress_slot *slot = &options->progress->slots[worker->index];
+
+            // Only this worker writes its slot, so plain stores of the totals do.
+            atomic_store_explicit(&slot->trials, worker->report.trials, memory_order_relaxed);
+            atomic_store_explicit(&slot->wins, worker->wins, memory_order_relaxed);
+        }
+    }
+
+    prisoner_mapping_stats_get(ctx, &worker->mapping);
+
+    if (options->counters) {
+        memcpy(worker->report.phases, ctx->phases, sizeof(ctx->phases));
+        _counters_close(&counters);
+    }
+
+    prisoner_destroy(ctx);
+
+    worker->report.wall_seconds = _seconds(CLOCK_MONOTONIC) - wall_start;
+    worker->report.cpu_seconds = _seconds(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+
+    return NULL;
+}
+
+
+static unsigned int _thread_count(unsigned int threads, uint64_t chunks) {
+    if (threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (unsigned int) online : 1;
+    }
+
+    if (threads > chunks) {
+        threads = chunks > 0 ? (unsigned int) chunks : 1;
+    }
+
+    return threads;
+}
+
+
+static int _run_job(struct job *job, struct worker *workers, unsigned int threads) {
+    unsigned int started = 0;
+    int error = 0;
+
+    atomic_init(&job->next_chunk, 0);
+
+    for (; started < threads; started++) {
+        workers[started].job = job;
+        workers[started].index = started;
+
+        if (pthread_create(&workers[started].thread, NULL, _worker_main, &workers[started]) != 0) {
+            // Chunks are claimed as threads go, so any that did start will pick up
+            // the work meant for the rest.
+            break;
+        }
+    }
+
+    if (started == 0) {
+        return EAGAIN;
+    }
+
+    for (unsigned int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+
+        if (workers[i].error != 0) {
+            error = workers[i].error;
+        }
+    }
+
+    return error;
+}
+
+
+int prisoner_run_parallel(
+    const prisoner_config *config,
+    uint64_t seed,
+    uint64_t trials,
+    unsigned int threads,
+    prisoner_results *results
+) {
+    return _run_parallel(config, seed, trials, threads, NULL, results);
+}
+
+
+int _run_parallel(
+    const prisoner_config *config,
+    uint64_t seed,
+    uint64_t trials,
+    unsigned int threads,
+    const struct run_options *options,
+    prisoner_results *results
+) {
+    struct job job = {
+        .config = config,
+        .seed = seed,
+        .trials = trials,
+        .chunks = _chunk_count(trials),
+        .sweep = false,
+    };
+    struct thread_report *reports = options != NULL ? options->reports : NULL;
+    unsigned int requested = threads;
+
+    if (options != NULL) {
+        job.options = *options;
+    }
+
+    threads = _thread_count(threads, job.chunks);
+
+    struct worker *workers = calloc(threads, sizeof(struct worker));
+
+    memset(results, 0, sizeof(prisoner_results));
+
+    if (workers == NULL) {
+        return ENOMEM;
+    }
+
+    int error = _run_job(&job, workers, threads);
+
+    if (error == 0) {
+        results->trials = trials;
+
+        for (unsigned int i = 0; i < threads; i++) {
+            results->wins += workers[i].wins;
+            results->mapping.components += workers[i].mapping.components;
+            results->mapping.cyclic_boxes += workers[i].mapping.cyclic_boxes;
+            results->mapping.longest_cycle += workers[i].mapping.longest_cycle;
+            results->mapping.longest_tail += workers[i].mapping.longest_tail;
+            results->mapping.prisoners_found += workers[i].mapping.prisoners_found;
+        }
+    }
+
+    if (reports != NULL) {
+        memset(reports, 0, requested * sizeof(struct thread_report));
+
+        for (unsigned int i = 0; i < threads && i < requested; i++) {
+            reports[i] = workers[i].report;
+        }
+    }
+
+    free(workers);
+
+    return error;
+}
+
+
+int prisoner_sweep(
+    const prisoner_config *config,
+    uint64_t seed,
+    uint64_t trials,
+    unsigned int threads,
+    uint64_t *wins
+) {
+    struct job job = {
+        .config = config,
+        .seed = seed,
+        .trials = trials,
+        .chunks = _chunk_count(trials),
+        .sweep = true,
+    };
+    unsigned int count = config->count;
+    bool mapped = (config->box_count != 0 && config->box_count != count)
+        || config->mapping != PRISONER_MAPPING_PERMUTATION;
+    int error = 0;
+
+    memset(wins, 0, (count + 1) * sizeof(uint64_t));
+
+    if (count == 0 || mapped || config->budgets != NULL) {
+        return EINVAL;
+    }
+
+    threads = _thread_count(threads, job.chunks);
+
+    struct worker *workers = calloc(threads, sizeof(struct worker));
+
+    if (workers == NULL) {
+        return ENOMEM;
+    }
+
+    for (unsigned int i = 0; i < threads && error == 0; i++) {
+        workers[i].longest = calloc(count + 1, sizeof(uint64_t));
+        error = workers[i].longest == NULL ? ENOMEM : 0;
+    }
+
+    if (error == 0) {
+        error = _run_job(&job, workers, threads);
+    }
+
+    if (error == 0) {
+        // A trial whose longest loop has length `L` is won by every budget of at
+        // least `L`.
+        for (unsigned int i = 0; i < threads; i++) {
+            for (unsigned int length = 0; length <= count; length++) {
+                wins[length] += workers[i].longest[length];
+            }
+        }
+
+        for (unsigned int chances = 1; chances <= count; chances++) {
+            wins[chances] += wins[chances - 1];
+        }
+    }
+
+    for (unsigned int i = 0; i < threads; i++) {
+        free(workers[i].longest);
+    }
+
+    free(workers);
+
+    return error;
+}
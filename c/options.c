@@ -0,0 +1,76 @@
+#include <math.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "options.h"
+
+bool _parse_uint(const char *arg, unsigned int *value) {
+    char *end = NULL;
+    unsigned long parsed;
+
+    errno = 0;
+    parsed = strtoul(arg, &end, 10);
+
+    if (errno != 0 || end == arg || *end != '\0' || parsed > (unsigned int) -1) {
+        return false;
+    }
+
+    *value = (unsigned int) parsed;
+    return true;
+}
+
+bool _parse_uint64(const char *arg, uint64_t *value) {
+    char *end = NULL;
+    unsigned long long parsed;
+
+    errno = 0;
+    parsed = strtoull(arg, &end, 10);
+
+    if (errno != 0 || end == arg || *end != '\0') {
+        return false;
+    }
+
+    *value = (uint64_t) parsed;
+    return true;
+}
+
+bool _parse_double(const char *arg, double *value) {
+    char *end = NULL;
+
+    errno = 0;
+    *value = strtod(arg, &end);
+
+    return errno == 0 && end != arg && *end == '\0' && isfinite(*value);
+}
+
+bool _parse_uint_list(
+    const char *arg,
+    unsigned int *values,
+    unsigned int max_len,
+    unsigned int *len
+) {
+    char buffer[256];
+    char *save = NULL;
+
+    if (strlen(arg) >= sizeof(buffer)) {
+        return false;
+    }
+
+    strcpy(buffer, arg);
+    *len = 0;
+
+    for (char *token = strtok_r(buffer, ",", &save);
+         token != NULL;
+         token = strtok_r(NULL, ",", &save)) {
+        if (*len == max_len || !_parse_uint(token, &values[*len])) {
+            return false;
+        }
+
+        (*len)++;
+    }
+
+    return *len > 0;
+}
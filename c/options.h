@@ -0,0 +1,23 @@
+#ifndef PRISONER_OPTIONS_H
+#define PRISONER_OPTIONS_H
+
+// Command line parsing shared by the tools in this directory. Each returns false
+// if `arg` is not entirely a valid value.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+bool _parse_uint(const char *arg, unsigned int *value);
+bool _parse_uint64(const char *arg, uint64_t *value);
+// A finite number, such as 0.5 or 1e-3.
+bool _parse_double(const char *arg, double *value);
+
+// A comma-separated list of at most `max_len` values.
+bool _parse_uint_list(
+    const char *arg,
+    unsigned int *values,
+    unsigned int max_len,
+    unsigned int *len
+);
+
+#endif
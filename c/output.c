@@ -0,0 +1,182 @@
+#include <math.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "output.h"
+
+
+#define Z_CONFIDENCE 1.959964
+
+const char *const output_format_names[OUTPUT_FORMAT_COUNT] = {
+    "text",
+    "jsonl",
+    "csv",
+    "binary",
+};
+
+const char *const warden_names[] = {"random", "cycle", "leaked"};
+const char *const mapping_names[] = {"permutation", "function"};
+
+
+void _wilson_interval(uint64_t wins, uint64_t trials, double *low, double *high) {
+    if (trials == 0) {
+        *low = 0;
+        *high = 1;
+        return;
+    }
+
+    double n = (double) trials, p = wins / n, z2 = Z_CONFIDENCE * Z_CONFIDENCE;
+    double center = (p + z2 / (2 * n)) / (1 + z2 / n);
+    double half = Z_CONFIDENCE * sqrt(p * (1 - p) / n + z2 / (4 * n * n)) / (1 + z2 / n);
+
+    *low = center - half > 0 ? center - half : 0;
+    *high = center + half < 1 ? center + half : 1;
+}
+
+
+int _output_open(struct output *output, const char *path, enum output_format format) {
+    memset(output, 0, sizeof(struct output));
+    output->format = format;
+    output->file = path != NULL ? fopen(path, format == OUTPUT_BINARY ? "wb" : "w") : stdout;
+
+    if (output->file == NULL) {
+        return errno;
+    }
+
+    // Headers go out even if no record follows, so an empty result still parses.
+    if (format == OUTPUT_CSV) {
+        fprintf(
+            output->file,
+            "prisoners,boxes,chances,warden,relabel,mapping,swaps,engine,seed,threads,"
+            "trials,wins,rate,ci_low,ci_high,seconds,trials_per_second\n"
+        );
+    } else if (format == OUTPUT_BINARY) {
+        struct output_header header = {
+            .version = OUTPUT_VERSION,
+            .record_size = sizeof(struct result_record),
+        };
+
+        memcpy(header.magic, OUTPUT_MAGIC, sizeof(header.magic));
+        fwrite(&header, sizeof(header), 1, output->file);
+    }
+
+    fflush(output->file);
+
+    return 0;
+}
+
+
+void _output_result(struct output *output, const struct result *result) {
+    const prisoner_config *config = result->config;
+    unsigned int boxes = config->box_count != 0 ? config->box_count : config->count;
+    double rate = result->trials > 0 ? (double) result->wins / result->trials : 0;
+    double throughput = result->seconds > 0 ? result->trials / result->seconds : 0;
+    double low, high;
+    char swaps[16] = "";
+
+    _wilson_interval(result->wins, result->trials, &low, &high);
+
+    if (result->swapped) {
+        snprintf(swaps, sizeof(swaps), "%u", result->swaps);
+    }
+
+    switch (output->format) {
+        case OUTPUT_TEXT:
+            return;
+        case OUTPUT_JSONL:
+            fprintf(
+                output->file,
+                "{\"prisoners\":%u,\"boxes\":%u,\"chances\":%u,\"warden\":\"%s\","
+                "\"relabel\":%s,\"mapping\":\"%s\",\"swaps\":%s,\"engine\":\"%s\","
+                "\"seed\":%llu,\"threads\":%u,\"trials\":%llu,\"wins\":%llu,"
+                "\"rate\":%.9g,\"ci_low\":%.9g,\"ci_high\":%.9g,\"seconds\":%.6f,"
+                "\"trials_per_second\":%.1f}\n",
+                config->count,
+                boxes,
+                config->chances,
+                warden_names[config->warden],
+                config->relabel ? "true" : "false",
+                mapping_names[config->mapping],
+                result->swapped ? swaps : "null",
+                result->engine,
+                (unsigned long long) result->seed,
+                result->threads,
+                (unsigned long long) result->trials,
+                (unsigned long long) result->wins,
+                rate,
+                low,
+                high,
+                result->seconds,
+                throughput
+            );
+            break;
+        case OUTPUT_CSV:
+            fprintf(
+                output->file,
+                "%u,%u,%u,%s,%d,%s,%s,%s,%llu,%u,%llu,%llu,%.9g,%.9g,%.9g,%.6f,%.1f\n",
+                config->count,
+                boxes,
+                config->chances,
+                warden_names[config->warden],
+                config->relabel,
+                mapping_names[config->mapping],
+                swaps,
+                result->engine,
+                (unsigned long long) result->seed,
+                result->threads,
+                (unsigned long long) result->trials,
+                (unsigned long long) result->wins,
+                rate,
+                low,
+                high,
+                result->seconds,
+                throughput
+            );
+            break;
+        case OUTPUT_BINARY: {
+            struct result_record record = {
+                .seed = result->seed,
+                .trials = result->trials,
+                .wins = result->wins,
+                .prisoners = config->count,
+                .boxes = boxes,
+                .chances = config->chances,
+                .swaps = result->swapped ? result->swaps : OUTPUT_NO_SWAPS,
+                .threads = result->threads,
+                .warden = (uint8_t) config->warden,
+                .relabel = config->relabel,
+                .mapping = (uint8_t) config->mapping,
+                .rate = rate,
+                .ci_low = low,
+                .ci_high = high,
+                .seconds = result->seconds,
+            };
+
+            strncpy(record.engine, result->engine, sizeof(record.engine) - 1);
+            fwrite(&record, sizeof(record), 1, output->file);
+            break;
+        }
+        default:
+            break;
+    }
+
+    fflush(output->file);
+}
+
+
+int _output_close(struct output *output) {
+    int error = ferror(output->file) ? EIO : 0;
+
+    if (output->file != stdout) {
+        if (fclose(output->file) != 0 && error == 0) {
+            error = errno;
+        }
+    } else if (fflush(stdout) != 0 && error == 0) {
+        error = errno;
+    }
+
+    return error;
+}
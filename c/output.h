@@ -0,0 +1,100 @@
+#ifndef PRISONER_OUTPUT_H
+#define PRISONER_OUTPUT_H
+
+// Results in forms other programs can read, one record per point: a whole run,
+// one point of a sweep, or one number of swaps and chances. Records are written
+// and flushed as each point finishes, so a consumer can follow a sweep as it
+// goes. JSON Lines and CSV records carry the same fields, CSV after a header
+// line. The binary form is an output_header followed by fixed-size
+// result_records, in the byte order of the machine that wrote them.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "prisoner.h"
+
+#define OUTPUT_MAGIC "PRRESULT"
+#define OUTPUT_VERSION 1
+
+// In a binary record, the number of swaps of a run without any.
+#define OUTPUT_NO_SWAPS UINT32_MAX
+
+enum output_format {
+    // Only the usual human-readable report.
+    OUTPUT_TEXT,
+    OUTPUT_JSONL,
+    OUTPUT_CSV,
+    OUTPUT_BINARY,
+    OUTPUT_FORMAT_COUNT,
+};
+
+extern const char *const output_format_names[OUTPUT_FORMAT_COUNT];
+// Indexed by prisoner_warden and prisoner_mapping, and shared by every report and
+// the autotuning cache's keys so that they all name things the same way.
+extern const char *const warden_names[];
+extern const char *const mapping_names[];
+
+// The engines a record can name besides the evaluators.
+#define ENGINE_SWAPS "swaps"
+#define ENGINE_MAPPING "mapping"
+#define ENGINE_BUDGETS "budgets"
+
+struct result {
+    const prisoner_config *config;
+    const char *engine;
+    uint64_t seed;
+    unsigned int threads;
+    bool swapped;
+    unsigned int swaps;
+    uint64_t trials;
+    uint64_t wins;
+    double seconds;
+};
+
+struct output_header {
+    char magic[8];
+    uint32_t version;
+    // sizeof(struct result_record), so readers can skip fields they do not know.
+    uint32_t record_size;
+};
+
+struct result_record {
+    uint64_t seed;
+    uint64_t trials;
+    uint64_t wins;
+    uint32_t prisoners;
+    uint32_t boxes;
+    uint32_t chances;
+    uint32_t swaps;
+    uint32_t threads;
+    uint8_t warden;
+    uint8_t relabel;
+    uint8_t mapping;
+    uint8_t reserved;
+    char engine[16];
+    double rate;
+    double ci_low;
+    double ci_high;
+    double seconds;
+};
+
+struct output {
+    FILE *file;
+    enum output_format format;
+};
+
+// Starts writing records to `path`, or stdout if it is NULL. Returns 0 or an
+// errno value.
+int _output_open(struct output *output, const char *path, enum output_format format);
+
+void _output_result(struct output *output, const struct result *result);
+
+// Returns 0, or an errno value if anything could not be written.
+int _output_close(struct output *output);
+
+// The 95% Wilson score interval for `wins` of `trials`, which unlike the normal
+// approximation stays within [0, 1] and is not empty when every trial is lost.
+void _wilson_interval(uint64_t wins, uint64_t trials, double *low, double *high);
+
+#endif
@@ -1,82 +1,1399 @@
 #include <time.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 
+#include "prisoner.h"
+#include "engine.h"
+#include "options.h"
+#include "progress.h"
+#include "resources.h"
+#include "autotune.h"
+#include "trace.h"
+#include "corpus.h"
+#include "output.h"
 
-static unsigned int *boxes = NULL;
-static bool *slips_seen = NULL;
 
-unsigned int _generate_range(unsigned int max) {
-    return rand() % max;
+#define MAX_CHANCES_LIST 16
+#define MAX_PRISONERS_LIST 16
+
+// How many differing trials replay describes before it only counts them.
+#define MAX_DIFFERENCES_SHOWN 20
+
+enum {
+    // Long options without a short form.
+    OPTION_SEED = 256,
+    OPTION_COUNTERS,
+    OPTION_LATENCY,
+    OPTION_PROGRESS,
+    OPTION_METRICS,
+    OPTION_RESOURCES,
+    OPTION_TUNE,
+    OPTION_TUNE_CACHE,
+    OPTION_TRACE,
+    OPTION_TRACE_PAYLOAD,
+    OPTION_REPLAY,
+    OPTION_CORPUS,
+    OPTION_CORPUS_RESULTS,
+    OPTION_WRITE_CORPUS,
+    OPTION_CORPUS_ENCODING,
+};
+
+typedef enum resources_format {
+    RESOURCES_NONE,
+    RESOURCES_TEXT,
+    RESOURCES_JSON,
+} resources_format;
+
+// How often progress is reported when only --metrics is given, in seconds.
+#define DEFAULT_PROGRESS_INTERVAL 5
+
+static const char *const phase_names[PHASE_COUNT] = {"shuffle", "evaluate"};
+
+bool _parse_swap_policy(const char *arg, prisoner_swap_policy *policy) {
+    if (strcmp(arg, "optimal") == 0) {
+        *policy = PRISONER_SWAP_OPTIMAL;
+    } else if (strcmp(arg, "halve") == 0) {
+        *policy = PRISONER_SWAP_HALVE;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+bool _parse_range(const char *arg, unsigned int *low, unsigned int *high) {
+    char buffer[64];
+    char *separator;
+
+    if (strlen(arg) >= sizeof(buffer)) {
+        return false;
+    }
+
+    strcpy(buffer, arg);
+    separator = strchr(buffer, ':');
+
+    if (separator == NULL) {
+        return false;
+    }
+
+    *separator = '\0';
+
+    return _parse_uint(buffer, low)
+        && _parse_uint(separator + 1, high)
+        && *low <= *high;
 }
 
+bool _load_budgets(const char *filename, unsigned int *budgets, unsigned int count) {
+    FILE *file = fopen(filename, "r");
+    unsigned int loaded = 0, budget;
 
-void _generate_boxes(unsigned int count) {
-    // Now, redistribute the slips randomly.
-    for (unsigned int i = count - 1; i > 0; i--) {
-        unsigned int to_swap = _generate_range(i + 1);
-        unsigned int left = boxes[i], right = boxes[to_swap];
+    if (file == NULL) {
+        return false;
+    }
 
-        boxes[to_swap] = left;
-        boxes[i] = right;
+    while (loaded <= count && fscanf(file, "%u", &budget) == 1) {
+        if (loaded < count) {
+            budgets[loaded] = budget;
+        }
+
+        loaded++;
     }
+
+    bool complete = loaded == count && feof(file);
+
+    fclose(file);
+
+    return complete;
+}
+
+bool _parse_mapping(const char *arg, prisoner_mapping *mapping) {
+    if (strcmp(arg, "permutation") == 0) {
+        *mapping = PRISONER_MAPPING_PERMUTATION;
+    } else if (strcmp(arg, "function") == 0) {
+        *mapping = PRISONER_MAPPING_FUNCTION;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+bool _parse_warden(const char *arg, prisoner_warden *warden) {
+    if (strcmp(arg, "random") == 0) {
+        *warden = PRISONER_WARDEN_RANDOM;
+    } else if (strcmp(arg, "cycle") == 0) {
+        *warden = PRISONER_WARDEN_CYCLE;
+    } else if (strcmp(arg, "leaked") == 0) {
+        *warden = PRISONER_WARDEN_LEAKED;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static void _print_counter_values(
+    FILE *out,
+    const struct counters *available,
+    const struct counter_values *phases,
+    uint64_t trials
+) {
+    fprintf(out, "  %-16s", "");
+
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        fprintf(out, "  %14s", phase_names[phase]);
+    }
+
+    fprintf(out, "\n");
+
+    for (int counter = 0; counter < COUNTER_COUNT; counter++) {
+        fprintf(out, "  %-16s", counter_names[counter]);
+
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            if (_counters_available(available, counter) && trials > 0) {
+                fprintf(out, "  %14.2f", _counter_value_scaled(&phases[phase], counter) / trials);
+            } else {
+                fprintf(out, "  %14s", "-");
+            }
+        }
+
+        fprintf(out, "\n");
+    }
+
+    fprintf(out, "  %-16s", "IPC");
+
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        double cycles = _counter_value_scaled(&phases[phase], COUNTER_CYCLES);
+
+        if (_counters_available(available, COUNTER_CYCLES)
+            && _counters_available(available, COUNTER_INSTRUCTIONS)
+            && cycles > 0) {
+            fprintf(
+                out,
+                "  %14.3f",
+                _counter_value_scaled(&phases[phase], COUNTER_INSTRUCTIONS) / cycles
+            );
+        } else {
+            fprintf(out, "  %14s", "-");
+        }
+    }
+
+    fprintf(out, "\n");
 }
 
 
-bool run_optimized(unsigned int count, unsigned int chances) {
-    memset(slips_seen, false, count * sizeof(bool));
+// Prints what the counters saw per trial in each phase, for every thread and then
+// for all of them together.
+static void _print_counters(
+    FILE *out,
+    const struct counters *available,
+    const struct thread_report *reports,
+    unsigned int threads
+) {
+    struct counter_values total[PHASE_COUNT] = {0};
+    uint64_t trials = 0;
+    bool multiplexed = false;
 
-    for (unsigned int prisoner = 0; prisoner < count; prisoner++) {
-        unsigned int next_box = prisoner;
+    fprintf(out, "counters per trial (user space only; - if not supported here):\n");
 
-        if (slips_seen[prisoner] == true) {
+    for (unsigned int i = 0; i < threads; i++) {
+        if (reports[i].trials == 0) {
             continue;
         }
 
-        for (unsigned int _i = 0; _i <= chances; _i++) {
-            if (_i == chances) {
-                return false;
+        fprintf(out, "thread %u, %llu trials:\n", i, (unsigned long long) reports[i].trials);
+        _print_counter_values(out, available, reports[i].phases, reports[i].trials);
+        trials += reports[i].trials;
+
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            _counter_values_add(&total[phase], &reports[i].phases[phase]);
+            multiplexed |= reports[i].phases[phase].running
+                < reports[i].phases[phase].enabled;
+        }
+    }
+
+    fprintf(out, "all threads, %llu trials:\n", (unsigned long long) trials);
+    _print_counter_values(out, available, total, trials);
+
+    if (multiplexed) {
+        fprintf(out, "(the counters were multiplexed, so these are scaled estimates)\n");
+    }
+}
+
+
+// Prints the quantiles of every thread's per-trial latency together, for each
+// outcome and then for all trials.
+static void _print_latency(FILE *out, const struct thread_report *reports, unsigned int threads) {
+    static const char *const names[OUTCOME_COUNT] = {"lost", "won"};
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    struct histogram *totals = calloc(OUTCOME_COUNT + 1, sizeof(struct histogram));
+    double ticks_per_ns = _ticks_per_ns();
+
+    if (totals == NULL) {
+        return;
+    }
+
+    for (unsigned int i = 0; i < threads; i++) {
+        for (int outcome = 0; outcome < OUTCOME_COUNT; outcome++) {
+            _histogram_add(&totals[outcome], &reports[i].latency[outcome]);
+            _histogram_add(&totals[OUTCOME_COUNT], &reports[i].latency[outcome]);
+        }
+    }
+
+    fprintf(
+        out,
+        "latency per trial in ns (%s, %.3f ticks per ns):\n"
+        "  %-8s  %12s  %10s  %10s  %10s  %10s  %10s\n",
+        _ticks_source(),
+        ticks_per_ns,
+        "outcome", "trials", "p50", "p90", "p99", "p999", "max"
+    );
+
+    for (int row = 0; row <= OUTCOME_COUNT; row++) {
+        fprintf(
+            out,
+            "  %-8s  %12llu",
+            row < OUTCOME_COUNT ? names[row] : "all",
+            (unsigned long long) totals[row].total
+        );
+
+        for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+            double quantile = _histogram_quantile(&totals[row], quantiles[i]);
+
+            fprintf(out, "  %10.0f", quantile / ticks_per_ns);
+        }
+
+        fprintf(out, "  %10.0f\n", totals[row].max / ticks_per_ns);
+    }
+
+    free(totals);
+}
+
+
+bool _parse_resources_format(const char *arg, resources_format *format) {
+    if (strcmp(arg, "text") == 0) {
+        *format = RESOURCES_TEXT;
+    } else if (strcmp(arg, "json") == 0) {
+        *format = RESOURCES_JSON;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+
+// Any evaluator by name, or "auto" to leave the choice to the autotuner.
+bool _parse_evaluator(const char *arg, enum evaluator *evaluator, bool *automatic) {
+    *automatic = strcmp(arg, "auto") == 0;
+
+    for (int i = 0; i < EVALUATOR_COUNT && !*automatic; i++) {
+        if (strcmp(arg, evaluator_names[i]) == 0) {
+            *evaluator = i;
+            return true;
+        }
+    }
+
+    return *automatic;
+}
+
+
+bool _parse_trace_payload(const char *arg, enum trace_payload *payload) {
+    for (int i = 0; i < TRACE_PAYLOAD_COUNT; i++) {
+        if (strcmp(arg, trace_payload_names[i]) == 0) {
+            *payload = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+bool _parse_output_format(const char *arg, enum output_format *format) {
+    for (int i = 0; i < OUTPUT_FORMAT_COUNT; i++) {
+        if (strcmp(arg, output_format_names[i]) == 0) {
+            *format = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+static double _elapsed(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+static unsigned int _resolve_threads(unsigned int threads) {
+    if (threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (unsigned int) online : 1;
+    }
+
+    return threads;
+}
+
+
+// Runs every combination of the numbers of prisoners and chances, in that order,
+// each with the same seed so that neighbouring points are compared on the same
+// luck, and reports each point as soon as it finishes.
+static int _sweep_main(
+    const char *name,
+    prisoner_config config,
+    const unsigned int *prisoners_list,
+    unsigned int prisoners_len,
+    const unsigned int *chances_list,
+    unsigned int chances_len,
+    uint64_t seed,
+    unsigned int runs,
+    unsigned int threads,
+    enum evaluator evaluator,
+    const char *engine,
+    struct output *output
+) {
+    struct run_options run_options = {.evaluator = evaluator};
+
+    for (unsigned int i = 0; i < prisoners_len; i++) {
+        for (unsigned int j = 0; j < chances_len; j++) {
+            struct timespec start_ts, end_ts;
+            prisoner_results results;
+
+            config.count = prisoners_list[i];
+            config.chances = chances_list[j];
+            timespec_get(&start_ts, TIME_UTC);
+
+            int error = _run_parallel(&config, seed, runs, threads, &run_options, &results);
+
+            timespec_get(&end_ts, TIME_UTC);
+
+            if (error != 0) {
+                fprintf(stderr, "%s: simulation failed: %s\n", name, strerror(error));
+                return 1;
             }
 
-            unsigned int slip = boxes[next_box];
-            slips_seen[slip] = true;
+            struct result result = {
+                .config = &config,
+                .engine = engine,
+                .seed = seed,
+                .threads = _resolve_threads(threads),
+                .trials = results.trials,
+                .wins = results.wins,
+                .seconds = _elapsed(&start_ts, &end_ts),
+            };
 
-            if (slip == prisoner) {
-                break;
+            if (output->format == OUTPUT_TEXT) {
+                printf(
+                    "prisoners %u, chances %u: complete in %.3f seconds! of %u runs, "
+                    "%llu were successful (%.2f%%)\n",
+                    config.count,
+                    config.chances,
+                    result.seconds,
+                    runs,
+                    (unsigned long long) results.wins,
+                    ((double) results.wins / (double) runs) * 100
+                );
+                fflush(stdout);
             }
 
-            next_box = slip;
+            _output_result(output, &result);
         }
     }
 
-    return true;
+    return 0;
+}
+
+
+bool _parse_corpus_encoding(const char *arg, enum corpus_encoding *encoding) {
+    for (int i = 0; i < CORPUS_ENCODING_COUNT; i++) {
+        if (strcmp(arg, corpus_encoding_names[i]) == 0) {
+            *encoding = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+// Evaluates the corpus, already open, and reports how it went.
+static int _corpus_main(
+    const char *name,
+    const struct corpus *corpus,
+    unsigned int chances,
+    enum evaluator evaluator,
+    unsigned int threads,
+    const char *results_path
+) {
+    struct corpus_results results;
+    struct timespec start_ts, end_ts;
+    int results_fd = -1;
+
+    if (results_path != NULL) {
+        results_fd = open(results_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (results_fd < 0) {
+            fprintf(stderr, "%s: could not create '%s': %s\n", name, results_path, strerror(errno));
+            return 1;
+        }
+    }
+
+    timespec_get(&start_ts, TIME_UTC);
+
+    int error = _run_corpus(corpus, chances, evaluator, threads, results_fd, &results);
+
+    timespec_get(&end_ts, TIME_UTC);
+
+    if (results_fd >= 0 && close(results_fd) != 0 && error == 0) {
+        error = errno;
+    }
+
+    if (error != 0) {
+        fprintf(stderr, "%s: could not evaluate the corpus: %s\n", name, strerror(error));
+        return 1;
+    }
+
+    double duration = (end_ts.tv_sec - start_ts.tv_sec) + (end_ts.tv_nsec - start_ts.tv_nsec) / 1e9;
+    uint64_t valid = results.permutations - results.invalid;
+
+    printf(
+        "complete in %.3f seconds! of %llu permutations, %llu were successful (%.2f%%)\n",
+        duration,
+        (unsigned long long) valid,
+        (unsigned long long) results.wins,
+        valid > 0 ? (double) results.wins / (double) valid * 100 : 0.0
+    );
+    printf(
+        "read %.1f MB of %s permutations of %u at %.2f GB/s\n",
+        corpus->size / 1e6,
+        corpus_encoding_names[corpus->header.encoding],
+        corpus->header.count,
+        duration > 0 ? corpus->size / duration / 1e9 : 0.0
+    );
+
+    if (results.invalid > 0) {
+        printf(
+            "%llu were not permutations and were skipped, the first at index %llu\n",
+            (unsigned long long) results.invalid,
+            (unsigned long long) results.first_invalid
+        );
+    }
+
+    return 0;
+}
+
+
+// Replays a trace with `evaluator`, or the one it was recorded with if that is
+// negative. Exits 0 if every trial replayed as recorded, 2 if any did not, and 1
+// if the trace could not be read.
+static int _replay_main(const char *name, const char *path, int evaluator) {
+    struct trace_header header;
+    struct replay_summary summary;
+
+    // Peek at the header first, so that a trace recorded with an evaluator this
+    // build does not know is still read as a trace.
+    FILE *file = fopen(path, "rb");
+
+    if (file == NULL) {
+        fprintf(stderr, "%s: could not open '%s': %s\n", name, path, strerror(errno));
+        return 1;
+    }
+
+    bool read = fread(&header, sizeof(header), 1, file) == 1;
+
+    fclose(file);
+
+    if (evaluator < 0) {
+        evaluator = read && header.evaluator < EVALUATOR_COUNT
+            ? (int) header.evaluator
+            : EVALUATOR_OPTIMIZED;
+    }
+
+    int error = _trace_replay(path, evaluator, stdout, MAX_DIFFERENCES_SHOWN, &header, &summary);
+
+    if (error == EINVAL) {
+        fprintf(
+            stderr,
+            "%s: '%s' is cut short or not a trace this version can read\n",
+            name,
+            path
+        );
+        return 1;
+    } else if (error != 0) {
+        fprintf(stderr, "%s: could not replay '%s': %s\n", name, path, strerror(error));
+        return 1;
+    }
+
+    printf(
+        "replayed %llu trials of %u prisoners with %u chances, warden %s%s, seed %llu, "
+        "with %s (recorded with %s): %llu outcomes",
+        (unsigned long long) summary.trials,
+        header.count,
+        header.chances,
+        header.warden < 3 ? warden_names[header.warden] : "unknown",
+        header.relabel ? ", relabeled" : "",
+        (unsigned long long) header.seed,
+        evaluator_names[evaluator],
+        header.evaluator < EVALUATOR_COUNT ? evaluator_names[header.evaluator] : "unknown",
+        (unsigned long long) summary.outcome_differences
+    );
+
+    if (header.payload != TRACE_PAYLOAD_NONE) {
+        printf(
+            " and %llu arrangements",
+            (unsigned long long) summary.arrangement_differences
+        );
+    }
+
+    printf(" differ\n");
+
+    if (summary.trials != header.trials) {
+        fprintf(
+            stderr,
+            "%s: warning: the trace holds %llu of the %llu trials run\n",
+            name,
+            (unsigned long long) summary.trials,
+            (unsigned long long) header.trials
+        );
+    }
+
+    return summary.outcome_differences + summary.arrangement_differences > 0 ? 2 : 0;
+}
+
+
+static void _print_tuning(const struct tuning *tuning, const char *cache_path) {
+    if (tuning->cached) {
+        printf(
+            "evaluator: %s, from the tuning cache at %s\n",
+            evaluator_names[tuning->choice],
+            cache_path
+        );
+        return;
+    }
+
+    printf("evaluator: %s, the fastest of", evaluator_names[tuning->choice]);
+
+    for (int i = 0; i < EVALUATOR_COUNT; i++) {
+        printf(
+            "%s %s %.1f ns",
+            i == 0 ? "" : ",",
+            evaluator_names[i],
+            tuning->ns_per_trial[i]
+        );
+    }
+
+    printf(" per trial\n");
+}
+
+
+// The configuration a run's costs belong to, for the JSON report.
+struct run_summary {
+    const prisoner_config *config;
+    const char *engine;
+    unsigned int threads;
+    unsigned int runs;
+    // Negative when a run has no single success count, as with --swaps.
+    long long wins;
+    double wall_seconds;
+};
+
+
+static void _print_resources(
+    FILE *out,
+    const struct run_summary *run,
+    const struct resource_usage *usage,
+    resources_format format
+) {
+    double cpu_seconds = usage->user_seconds + usage->system_seconds;
+    double per_cpu_second = cpu_seconds > 0 ? run->runs / cpu_seconds : 0;
+
+    if (format == RESOURCES_TEXT) {
+        fprintf(
+            out,
+            "cpu: %.3fs user, %.3fs system, %.0f trials per CPU-second\n"
+            "memory: %.1f MiB peak resident, %.1f MiB peak virtual\n"
+            "page faults: %llu major, %llu minor\n"
+            "context switches: %llu voluntary, %llu involuntary\n",
+            usage->user_seconds,
+            usage->system_seconds,
+            per_cpu_second,
+            usage->peak_rss / 1048576.0,
+            usage->peak_virtual / 1048576.0,
+            (unsigned long long) usage->major_faults,
+            (unsigned long long) usage->minor_faults,
+            (unsigned long long) usage->voluntary_switches,
+            (unsigned long long) usage->involuntary_switches
+        );
+        return;
+    }
+
+    fprintf(
+        out,
+        "{\"prisoners\":%u,\"chances\":%u,\"boxes\":%u,\"engine\":\"%s\","
+        "\"warden\":\"%s\",\"relabel\":%s,\"threads\":%u,\"trials\":%u,",
+        run->config->count,
+        run->config->chances,
+        run->config->box_count != 0 ? run->config->box_count : run->config->count,
+        run->engine,
+        warden_names[run->config->warden],
+        run->config->relabel ? "true" : "false",
+        run->threads,
+        run->runs
+    );
+
+    if (run->wins >= 0) {
+        fprintf(out, "\"wins\":%lld,", run->wins);
+    } else {
+        fprintf(out, "\"wins\":null,");
+    }
+
+    fprintf(
+        out,
+        "\"wall_seconds\":%.6f,\"user_seconds\":%.6f,\"system_seconds\":%.6f,"
+        "\"cpu_seconds\":%.6f,\"trials_per_cpu_second\":%.1f,"
+        "\"peak_rss_bytes\":%llu,\"peak_virtual_bytes\":%llu,"
+        "\"major_faults\":%llu,\"minor_faults\":%llu,"
+        "\"voluntary_context_switches\":%llu,\"involuntary_context_switches\":%llu}\n",
+        run->wall_seconds,
+        usage->user_seconds,
+        usage->system_seconds,
+        cpu_seconds,
+        per_cpu_second,
+        (unsigned long long) usage->peak_rss,
+        (unsigned long long) usage->peak_virtual,
+        (unsigned long long) usage->major_faults,
+        (unsigned long long) usage->minor_faults,
+        (unsigned long long) usage->voluntary_switches,
+        (unsigned long long) usage->involuntary_switches
+    );
+}
+
+
+void _usage(const char *name) {
+    fprintf(
+        stderr,
+        "usage: %s [options]\n"
+        "  -p, --prisoners N    number of prisoners and boxes (default: 100); a\n"
+        "                       comma-separated list sweeps over each in turn\n"
+        "  -c, --chances N      boxes each prisoner may open (default: 50); a\n"
+        "                       comma-separated list sweeps over each, or with\n"
+        "                       --swaps, is the list of budgets\n"
+        "  -i, --iterations N   number of trials to run (default: 1000000)\n"
+        "  -w, --warden MODE    how the slips are arranged: random, cycle or\n"
+        "                       leaked (default: random)\n"
+        "  -r, --relabel        prisoners apply a secret random relabeling\n"
+        "  -s, --swaps K        let one prisoner swap up to K pairs of slips first,\n"
+        "                       and report the success rate for every k <= K\n"
+        "  -S, --swap-policy P  how those swaps are chosen: optimal or halve\n"
+        "                       (default: optimal)\n"
+        "  -b, --boxes N        number of boxes, at least the number of prisoners\n"
+        "                       (default: one per prisoner)\n"
+        "  -m, --mapping MODE   how slips are put in boxes: permutation, or\n"
+        "                       function to let slips repeat (default: permutation)\n"
+        "  -B, --budgets FILE   read each prisoner's number of chances from FILE,\n"
+        "                       one whitespace-separated value per prisoner\n"
+        "  -R, --budget-range LO:HI\n"
+        "                       draw each prisoner's number of chances uniformly\n"
+        "                       from LO to HI, once for the whole run\n"
+        "  -t, --threads N      worker threads, or 0 for one per CPU (default: 0)\n"
+        "  -e, --evaluator E    how to evaluate plain permutations: optimized,\n"
+        "                       longest-loop, bitset, or auto for the fastest on\n"
+        "                       this machine, from the tuning cache when it has\n"
+        "                       been measured before (default: optimized)\n"
+        "      --tune           time every evaluator for these parameters, record\n"
+        "                       the fastest in the tuning cache and exit\n"
+        "      --tune-cache FILE\n"
+        "                       where the tuning cache is (default:\n"
+        "                       ~/.cache/prisoner-autotune.tsv)\n"
+        "      --trace FILE     record every trial to FILE, for --replay\n"
+        "      --trace-payload P\n"
+        "                       what each trial's record holds besides its outcome:\n"
+        "                       none, permutation, cycles for the loop lengths, or\n"
+        "                       lehmer for the permutation packed compactly\n"
+        "                       (default: none)\n"
+        "      --replay FILE    re-evaluate every trial recorded in FILE, with the\n"
+        "                       evaluator given by -e or else the one it was\n"
+        "                       recorded with, report any that differ and exit\n"
+        "      --corpus FILE    evaluate the permutations in FILE, of as many\n"
+        "                       prisoners as it says, instead of shuffling\n"
+        "      --corpus-results FILE\n"
+        "                       with --corpus, write each permutation's outcome to\n"
+        "                       FILE as a byte: 0 lost, 1 won, 2 not a permutation\n"
+        "      --write-corpus FILE\n"
+        "                       write the arrangements a run would evaluate to FILE\n"
+        "                       as a corpus, and exit\n"
+        "      --corpus-encoding E\n"
+        "                       how --write-corpus stores them: fixed, as 4-byte\n"
+        "                       integers, or lehmer, packed (default: fixed)\n"
+        "      --counters       read the hardware performance counters around each\n"
+        "                       phase of every trial and report them per thread\n"
+        "      --latency        time every trial and report latency quantiles for\n"
+        "                       the trials won and lost\n"
+        "      --progress S     report progress to stderr every S seconds, which may\n"
+        "                       be fractional\n"
+        "      --metrics FILE   keep FILE up to date with the progress in the\n"
+        "                       Prometheus text format, replacing it atomically\n"
+        "      --resources FMT  report the CPU time, memory, page faults and context\n"
+        "                       switches the run cost, as text or json\n"
+        "  -f, --format F       also report the results as jsonl, csv or binary\n"
+        "                       records, one per run or point of a sweep, streamed\n"
+        "                       as each finishes (default: text, only the report)\n"
+        "  -o, --output FILE    where -f writes its records, rather than in place of\n"
+        "                       the report on stdout\n"
+        "      --seed N         seed for the random number generator (default:\n"
+        "                       the current time)\n",
+        name
+    );
 }
 
 int main(int argc, char **argv) {
-    unsigned int count = 100, chances = 50;
-    size_t size = count * sizeof(unsigned int);
+    prisoner_config config = prisoner_config_default();
+    prisoner_ctx *ctx;
+    unsigned int chances_list[MAX_CHANCES_LIST] = {50}, chances_len = 1;
+    unsigned int prisoners_list[MAX_PRISONERS_LIST] = {100}, prisoners_len = 1;
+    unsigned int max_swaps = 0;
+    bool swaps = false;
+    prisoner_swap_policy policy = PRISONER_SWAP_OPTIMAL;
+    prisoner_mapping_stats stats = {0};
+    const char *budgets_file = NULL;
+    unsigned int *budgets = NULL;
+    unsigned int budget_low = 0, budget_high = 0;
+    bool budget_range = false;
+    uint64_t seed = (uint64_t) time(NULL);
+    unsigned int runs = 1 * 1000 * 1000, wins = 0, threads = 0;
+    bool counters = false, latency = false;
+    double progress_interval = 0;
+    const char *metrics_path = NULL;
+    struct progress progress;
+    resources_format resources = RESOURCES_NONE;
+    enum evaluator evaluator = EVALUATOR_OPTIMIZED;
+    bool automatic = false, tune = false;
+    const char *tune_cache = NULL;
+    bool evaluator_chosen = false;
+    const char *trace_path = NULL, *replay_path = NULL;
+    enum trace_payload trace_payload = TRACE_PAYLOAD_NONE;
+    struct trace_writer trace;
+    const char *corpus_path = NULL, *corpus_results = NULL, *write_corpus = NULL;
+    enum corpus_encoding corpus_encoding = CORPUS_FIXED;
+    struct corpus corpus;
+    enum output_format format = OUTPUT_TEXT;
+    const char *output_path = NULL;
+    struct output output;
+    struct counters probe, supported;
+    struct thread_report *reports = NULL;
+    prisoner_results results = {0};
     struct timespec start_ts, end_ts, diff_ts;
     float duration;
+    int option;
 
-    boxes = malloc(size);
-    slips_seen = malloc(size);
+    static const struct option options[] = {
+        {"prisoners", required_argument, NULL, 'p'},
+        {"chances", required_argument, NULL, 'c'},
+        {"iterations", required_argument, NULL, 'i'},
+        {"warden", required_argument, NULL, 'w'},
+        {"relabel", no_argument, NULL, 'r'},
+        {"swaps", required_argument, NULL, 's'},
+        {"swap-policy", required_argument, NULL, 'S'},
+        {"boxes", required_argument, NULL, 'b'},
+        {"mapping", required_argument, NULL, 'm'},
+        {"budgets", required_argument, NULL, 'B'},
+        {"budget-range", required_argument, NULL, 'R'},
+        {"threads", required_argument, NULL, 't'},
+        {"format", required_argument, NULL, 'f'},
+        {"output", required_argument, NULL, 'o'},
+        {"seed", required_argument, NULL, OPTION_SEED},
+        {"counters", no_argument, NULL, OPTION_COUNTERS},
+        {"latency", no_argument, NULL, OPTION_LATENCY},
+        {"progress", required_argument, NULL, OPTION_PROGRESS},
+        {"metrics", required_argument, NULL, OPTION_METRICS},
+        {"resources", required_argument, NULL, OPTION_RESOURCES},
+        {"evaluator", required_argument, NULL, 'e'},
+        {"tune", no_argument, NULL, OPTION_TUNE},
+        {"tune-cache", required_argument, NULL, OPTION_TUNE_CACHE},
+        {"trace", required_argument, NULL, OPTION_TRACE},
+        {"trace-payload", required_argument, NULL, OPTION_TRACE_PAYLOAD},
+        {"replay", required_argument, NULL, OPTION_REPLAY},
+        {"corpus", required_argument, NULL, OPTION_CORPUS},
+        {"corpus-results", required_argument, NULL, OPTION_CORPUS_RESULTS},
+        {"write-corpus", required_argument, NULL, OPTION_WRITE_CORPUS},
+        {"corpus-encoding", required_argument, NULL, OPTION_CORPUS_ENCODING},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
 
-    srand(time(NULL));
+    while ((option = getopt_long(argc, argv, "p:c:i:w:rs:S:b:m:B:R:t:e:f:o:h", options, NULL)) != -1) {
+        bool valid = true;
 
-    unsigned int runs = 1 * 1000 * 1000, wins = 0;
+        switch (option) {
+            case 'p':
+                valid = _parse_uint_list(
+                    optarg, prisoners_list, MAX_PRISONERS_LIST, &prisoners_len
+                );
 
-    timespec_get(&start_ts, TIME_UTC);
+                for (unsigned int i = 0; i < prisoners_len; i++) {
+                    valid = valid && prisoners_list[i] > 0;
+                }
 
-    // First, populate the boxes with their corresponding slip.
-    for (unsigned int slip = 0; slip < count; slip++) {
-        boxes[slip] = slip;
+                config.count = prisoners_list[0];
+                break;
+            case 'c':
+                valid = _parse_uint_list(
+                    optarg, chances_list, MAX_CHANCES_LIST, &chances_len
+                );
+                config.chances = chances_list[0];
+                break;
+            case 'i':
+                valid = _parse_uint(optarg, &runs) && runs > 0;
+                break;
+            case 'w':
+                valid = _parse_warden(optarg, &config.warden);
+                break;
+            case 'r':
+                config.relabel = true;
+                break;
+            case 's':
+                valid = _parse_uint(optarg, &max_swaps);
+                swaps = true;
+                break;
+            case 'S':
+                valid = _parse_swap_policy(optarg, &policy);
+                break;
+            case 'b':
+                valid = _parse_uint(optarg, &config.box_count) && config.box_count > 0;
+                break;
+            case 'm':
+                valid = _parse_mapping(optarg, &config.mapping);
+                break;
+            case 'B':
+                budgets_file = optarg;
+                break;
+            case 'R':
+                valid = _parse_range(optarg, &budget_low, &budget_high);
+                budget_range = true;
+                break;
+            case 't':
+                valid = _parse_uint(optarg, &threads);
+                break;
+            case 'f':
+                valid = _parse_output_format(optarg, &format);
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            case OPTION_SEED:
+                valid = _parse_uint64(optarg, &seed);
+                break;
+            case OPTION_COUNTERS:
+                counters = true;
+                break;
+            case OPTION_LATENCY:
+                latency = true;
+                break;
+            case OPTION_PROGRESS:
+                valid = _parse_double(optarg, &progress_interval) && progress_interval > 0;
+                break;
+            case OPTION_METRICS:
+                metrics_path = optarg;
+                break;
+            case OPTION_RESOURCES:
+                valid = _parse_resources_format(optarg, &resources);
+                break;
+            case 'e':
+                valid = _parse_evaluator(optarg, &evaluator, &automatic);
+                evaluator_chosen = true;
+                break;
+            case OPTION_TUNE:
+                tune = true;
+                break;
+            case OPTION_TUNE_CACHE:
+                tune_cache = optarg;
+                break;
+            case OPTION_TRACE:
+                trace_path = optarg;
+                break;
+            case OPTION_TRACE_PAYLOAD:
+                valid = _parse_trace_payload(optarg, &trace_payload);
+                break;
+            case OPTION_REPLAY:
+                replay_path = optarg;
+                break;
+            case OPTION_CORPUS:
+                corpus_path = optarg;
+                break;
+            case OPTION_CORPUS_RESULTS:
+                corpus_results = optarg;
+                break;
+            case OPTION_WRITE_CORPUS:
+                write_corpus = optarg;
+                break;
+            case OPTION_CORPUS_ENCODING:
+                valid = _parse_corpus_encoding(optarg, &corpus_encoding);
+                break;
+            case 'h':
+                _usage(argv[0]);
+                return 0;
+            default:
+                valid = false;
+                optarg = NULL;
+                break;
+        }
+
+        if (!valid) {
+            if (optarg != NULL) {
+                fprintf(stderr, "%s: invalid value '%s'\n", argv[0], optarg);
+            }
+
+            _usage(argv[0]);
+            return 1;
+        }
     }
 
-    for (int i = 0; i < runs; i++) {
-        _generate_boxes(count);
-        wins += (unsigned int) run_optimized(count, chances);
+    if (replay_path != NULL) {
+        if (automatic) {
+            fprintf(stderr, "%s: --replay needs an evaluator by name\n", argv[0]);
+            return 1;
+        }
+
+        return _replay_main(argv[0], replay_path, evaluator_chosen ? (int) evaluator : -1);
+    }
+
+    bool sweeping = prisoners_len > 1 || (chances_len > 1 && !swaps);
+
+    // Structured records take stdout's place unless they have a file of their own.
+    bool quiet = format != OUTPUT_TEXT && output_path == NULL;
+    // When the records have stdout to themselves, the other reports move aside.
+    FILE *reports_out = quiet ? stderr : stdout;
+
+    if (prisoners_len > 1 && swaps) {
+        fprintf(stderr, "%s: --swaps takes a single number of prisoners\n", argv[0]);
+        return 1;
+    }
+
+    if (output_path != NULL && format == OUTPUT_TEXT) {
+        fprintf(stderr, "%s: --output requires --format\n", argv[0]);
+        return 1;
+    }
+
+    bool reporting = progress_interval != 0 || metrics_path != NULL;
+
+    if ((counters || latency || reporting) && swaps) {
+        fprintf(
+            stderr,
+            "%s: --counters, --latency, --progress and --metrics cannot be combined "
+            "with --swaps\n",
+            argv[0]
+        );
+        return 1;
+    }
+
+    bool mapped = (config.box_count != 0 && config.box_count != config.count)
+        || config.mapping != PRISONER_MAPPING_PERMUTATION;
+
+    if (config.box_count != 0 && config.box_count < config.count) {
+        fprintf(stderr, "%s: there must be at least one box per prisoner\n", argv[0]);
+        return 1;
+    }
+
+    if (mapped && (swaps || config.relabel || config.warden != PRISONER_WARDEN_RANDOM)) {
+        fprintf(
+            stderr,
+            "%s: --boxes and --mapping only apply to a random warden without swaps\n",
+            argv[0]
+        );
+        return 1;
+    }
+
+    bool budgeted = budgets_file != NULL || budget_range;
+
+    if (budgets_file != NULL && budget_range) {
+        fprintf(stderr, "%s: --budgets and --budget-range are exclusive\n", argv[0]);
+        return 1;
+    }
+
+    if (budgeted && (mapped || swaps)) {
+        fprintf(
+            stderr,
+            "%s: budgets cannot be combined with --boxes, --mapping or --swaps\n",
+            argv[0]
+        );
+        return 1;
+    }
+
+    bool evaluated = !mapped && !budgeted && !swaps;
+
+    if ((corpus_path != NULL || write_corpus != NULL) && !evaluated) {
+        fprintf(
+            stderr,
+            "%s: corpora only hold permutations, so cannot be combined with budgets, "
+            "--boxes, --mapping or --swaps\n",
+            argv[0]
+        );
+        return 1;
+    }
+
+    if (corpus_path != NULL
+        && (write_corpus != NULL || trace_path != NULL || counters || latency || reporting
+            || resources != RESOURCES_NONE)) {
+        fprintf(
+            stderr,
+            "%s: --corpus cannot be combined with --write-corpus, --trace, --counters, "
+            "--latency, --progress, --metrics or --resources\n",
+            argv[0]
+        );
+        return 1;
+    }
+
+    if (corpus_results != NULL && corpus_path == NULL) {
+        fprintf(stderr, "%s: --corpus-results requires --corpus\n", argv[0]);
+        return 1;
+    }
+
+    if (corpus_path != NULL && format != OUTPUT_TEXT) {
+        fprintf(stderr, "%s: --corpus only reports as text\n", argv[0]);
+        return 1;
+    }
+
+    if (sweeping
+        && (budgeted || counters || latency || reporting || trace_path != NULL
+            || corpus_path != NULL || write_corpus != NULL || automatic || tune
+            || resources != RESOURCES_NONE || (prisoners_len > 1 && config.box_count != 0))) {
+        fprintf(
+            stderr,
+            "%s: a sweep over several prisoners or chances cannot be combined with "
+            "budgets, --counters, --latency, --progress, --metrics, --trace, corpora, "
+            "--evaluator auto, --tune or --resources, nor over prisoners with --boxes\n",
+            argv[0]
+        );
+        return 1;
+    }
+
+    if (write_corpus != NULL) {
+        ctx = prisoner_create(&config);
+
+        if (ctx == NULL) {
+            fprintf(stderr, "%s: could not create simulation: %s\n", argv[0], strerror(errno));
+            return 1;
+        }
+
+        int error = _corpus_write(write_corpus, ctx, corpus_encoding, seed, runs);
+
+        prisoner_destroy(ctx);
+
+        if (error != 0) {
+            fprintf(stderr, "%s: could not write '%s': %s\n", argv[0], write_corpus, strerror(error));
+            return 1;
+        }
+
+        fprintf(
+            reports_out,
+            "wrote %u permutations of %u to '%s'\n",
+            runs,
+            config.count,
+            write_corpus
+        );
+        return 0;
+    }
+
+    if (corpus_path != NULL) {
+        int error = _corpus_open(&corpus, corpus_path);
+
+        if (error == EINVAL) {
+            fprintf(
+                stderr,
+                "%s: '%s' is not a corpus this version can read, or its size does not "
+                "match its header\n",
+                argv[0],
+                corpus_path
+            );
+            return 1;
+        } else if (error != 0) {
+            fprintf(stderr, "%s: could not open '%s': %s\n", argv[0], corpus_path, strerror(error));
+            return 1;
+        }
+
+        // The corpus decides how many prisoners there are, which tuning needs.
+        config.count = corpus.header.count;
+    }
+
+    if ((automatic || tune || evaluator != EVALUATOR_OPTIMIZED) && !evaluated) {
+        fprintf(
+            stderr,
+            "%s: --evaluator and --tune only apply to permutations without budgets "
+            "or swaps\n",
+            argv[0]
+        );
+        return 1;
+    }
+
+    if (automatic || tune) {
+        struct tuning tuning;
+
+        if (tune_cache == NULL) {
+            tune_cache = _tuning_cache_default();
+        }
+
+        int error = _autotune(&config, seed, tune_cache, tune, &tuning);
+
+        if (error != 0) {
+            fprintf(stderr, "%s: could not tune: %s\n", argv[0], strerror(error));
+
+            if (corpus_path != NULL) {
+                _corpus_close(&corpus);
+            }
+
+            return 1;
+        }
+
+        if (!quiet) {
+            _print_tuning(&tuning, tune_cache);
+        }
+
+        if (tune) {
+            if (corpus_path != NULL) {
+                _corpus_close(&corpus);
+            }
+
+            return 0;
+        }
+
+        evaluator = tuning.choice;
+    }
+
+    const char *engine = swaps ? ENGINE_SWAPS
+        : mapped ? ENGINE_MAPPING
+        : budgeted ? ENGINE_BUDGETS
+        : evaluator_names[evaluator];
+    int error = _output_open(&output, output_path, format);
+
+    if (error != 0) {
+        fprintf(stderr, "%s: could not create '%s': %s\n", argv[0], output_path, strerror(error));
+
+        if (corpus_path != NULL) {
+            _corpus_close(&corpus);
+        }
+
+        return 1;
+    }
+
+    if (sweeping) {
+        int status = _sweep_main(
+            argv[0],
+            config,
+            prisoners_list,
+            prisoners_len,
+            chances_list,
+            chances_len,
+            seed,
+            runs,
+            threads,
+            evaluator,
+            engine,
+            &output
+        );
+
+        error = _output_close(&output);
+
+        if (error != 0 && status == 0) {
+            fprintf(stderr, "%s: could not write the results: %s\n", argv[0], strerror(error));
+            status = 1;
+        }
+
+        return status;
+    }
+
+    if (corpus_path != NULL) {
+        int status = _corpus_main(
+            argv[0], &corpus, config.chances, evaluator, threads, corpus_results
+        );
+
+        _corpus_close(&corpus);
+
+        return status;
+    }
+
+    if (trace_path != NULL && !(evaluated && _trace_applies(&config))) {
+        fprintf(
+            stderr,
+            "%s: --trace only applies to permutations without budgets or swaps\n",
+            argv[0]
+        );
+        return 1;
+    }
+
+    if (counters) {
+        // Each worker opens its own, but probing here tells which events this
+        // machine supports, and fails early if it supports none.
+        int error = _counters_open(&probe);
+
+        if (error != 0) {
+            fprintf(stderr, "%s: could not open any counters: %s\n", argv[0], strerror(error));
+            return 1;
+        }
+
+        supported = probe;
+        _counters_close(&probe);
+    }
+
+    if (counters || latency || reporting || trace_path != NULL) {
+        if (threads == 0) {
+            long online = sysconf(_SC_NPROCESSORS_ONLN);
+            threads = online > 0 ? (unsigned int) online : 1;
+        }
+
+        reports = calloc(threads, sizeof(struct thread_report));
+    }
+
+    if (budgeted) {
+        budgets = malloc(config.count * sizeof(unsigned int));
+
+        if (budget_range) {
+            // The span is 2^32 for the full range, so it is worked out in 64 bits,
+            // where reducing a 64-bit draw by it is as good as unbiased.
+            uint64_t span = (uint64_t) budget_high - budget_low + 1;
+            struct rng rng;
+
+            _rng_seed(&rng, seed);
+
+            for (unsigned int prisoner = 0; prisoner < config.count; prisoner++) {
+                budgets[prisoner] = budget_low + (unsigned int) (_next(&rng) % span);
+            }
+        } else if (!_load_budgets(budgets_file, budgets, config.count)) {
+            fprintf(
+                stderr,
+                "%s: could not read %u budgets from '%s'\n",
+                argv[0],
+                config.count,
+                budgets_file
+            );
+            free(budgets);
+            free(reports);
+            return 1;
+        }
+
+        config.budgets = budgets;
+    }
+
+    ctx = prisoner_create(&config);
+
+    if (ctx == NULL) {
+        fprintf(stderr, "%s: could not create simulation: %s\n", argv[0], strerror(errno));
+        free(budgets);
+        free(reports);
+        return 1;
+    }
+
+    prisoner_seed(ctx, seed);
+
+    unsigned int *needed = NULL, *needed_counts = NULL;
+
+    if (swaps) {
+        needed = malloc(chances_len * sizeof(unsigned int));
+        needed_counts = calloc(
+            (size_t) chances_len * (max_swaps + 2), sizeof(unsigned int)
+        );
+    }
+
+    timespec_get(&start_ts, TIME_UTC);
+
+    if (swaps) {
+        // `needed_counts` is a row of `max_swaps + 2` buckets per budget, the last
+        // meaning "more than allowed".
+        for (unsigned int i = 0; i < runs; i++) {
+            prisoner_trial_swaps(
+                ctx, chances_list, chances_len, policy, max_swaps + 1, needed
+            );
+
+            for (unsigned int j = 0; j < chances_len; j++) {
+                needed_counts[j * (max_swaps + 2) + needed[j]]++;
+            }
+        }
+    } else {
+        struct run_options run_options = {
+            .counters = counters,
+            .latency = latency,
+            .reports = reports,
+            .evaluator = evaluator,
+        };
+        int error = 0;
+
+        if (trace_path != NULL) {
+            error = _trace_open(
+                &trace, trace_path, &config, evaluator, trace_payload, seed, runs, threads
+            );
+
+            if (error != 0) {
+                fprintf(
+                    stderr,
+                    "%s: could not create '%s': %s\n",
+                    argv[0],
+                    trace_path,
+                    strerror(error)
+                );
+                prisoner_destroy(ctx);
+                free(budgets);
+                free(reports);
+                return 1;
+            }
+
+            run_options.trace = &trace;
+        }
+
+        if (reporting) {
+            error = _progress_start(
+                &progress,
+                threads,
+                runs,
+                progress_interval != 0 ? progress_interval : DEFAULT_PROGRESS_INTERVAL,
+                progress_interval != 0 ? stderr : NULL,
+                metrics_path
+            );
+            run_options.progress = &progress;
+        }
+
+        if (error == 0) {
+            error = _run_parallel(&config, seed, runs, threads, &run_options, &results);
+
+            if (reporting) {
+                _progress_stop(&progress);
+            }
+        }
+
+        if (trace_path != NULL) {
+            int trace_error = _trace_close(&trace);
+
+            if (trace_error != 0 && error == 0) {
+                fprintf(
+                    stderr,
+                    "%s: could not write '%s': %s\n",
+                    argv[0],
+                    trace_path,
+                    strerror(trace_error)
+                );
+                prisoner_destroy(ctx);
+                free(budgets);
+                free(reports);
+                return 1;
+            }
+        }
+
+        if (error != 0) {
+            fprintf(stderr, "%s: simulation failed: %s\n", argv[0], strerror(error));
+            prisoner_destroy(ctx);
+            free(budgets);
+            free(reports);
+            return 1;
+        }
+
+        wins = (unsigned int) results.wins;
     }
 
     timespec_get(&end_ts, TIME_UTC);
@@ -91,16 +1408,123 @@ int main(int argc, char **argv) {
 
     duration = diff_ts.tv_sec + ((float) diff_ts.tv_nsec / 1000000000);
 
-    printf(
-        "complete in %.3f seconds! of %u runs, %u were successful (%.2f%%)\n",
-        duration,
-        runs,
-        wins,
-        ((double) wins / (double) runs) * 100
-    );
+    if (swaps && !quiet) {
+        printf("complete in %.3f seconds! of %u runs:\n", duration, runs);
+        printf("  swaps");
+
+        for (unsigned int j = 0; j < chances_len; j++) {
+            printf("  chances=%-5u", chances_list[j]);
+        }
+
+        printf("\n");
+
+        // A trial that needed `n` swaps succeeds for every k >= n.
+        for (unsigned int k = 0; k <= max_swaps; k++) {
+            printf("  %5u", k);
+
+            for (unsigned int j = 0; j < chances_len; j++) {
+                unsigned int successes = 0;
+
+                for (unsigned int n = 0; n <= k; n++) {
+                    successes += needed_counts[j * (max_swaps + 2) + n];
+                }
+
+                printf("  %12.2f%%", ((double) successes / (double) runs) * 100);
+            }
 
-    free(boxes);
-    free(slips_seen);
+            printf("\n");
+        }
+    } else if (!quiet) {
+        printf(
+            "complete in %.3f seconds! of %u runs, %u were successful (%.2f%%)\n",
+            duration,
+            runs,
+            wins,
+            ((double) wins / (double) runs) * 100
+        );
+    }
+
+    struct result result = {
+        .config = &config,
+        .engine = engine,
+        .seed = seed,
+        .threads = swaps ? 1 : _resolve_threads(threads),
+        .trials = runs,
+        .wins = wins,
+        .seconds = duration,
+    };
+
+    if (swaps) {
+        // Every cell of the table is a point of its own.
+        prisoner_config point = config;
+
+        result.config = &point;
+        result.swapped = true;
+
+        for (unsigned int j = 0; j < chances_len; j++) {
+            point.chances = chances_list[j];
+            result.wins = 0;
+
+            for (unsigned int k = 0; k <= max_swaps; k++) {
+                result.swaps = k;
+                result.wins += needed_counts[j * (max_swaps + 2) + k];
+                _output_result(&output, &result);
+            }
+        }
+    } else {
+        _output_result(&output, &result);
+    }
+
+    if (mapped && !quiet) {
+        stats = results.mapping;
+
+        printf(
+            "per run: %.2f components, %.2f boxes on loops, longest loop %.2f, "
+            "longest tail %.2f, %.2f prisoners found their slip\n",
+            (double) stats.components / runs,
+            (double) stats.cyclic_boxes / runs,
+            (double) stats.longest_cycle / runs,
+            (double) stats.longest_tail / runs,
+            (double) stats.prisoners_found / runs
+        );
+    }
+
+    if (counters) {
+        _print_counters(reports_out, &supported, reports, threads);
+    }
+
+    if (latency) {
+        _print_latency(reports_out, reports, threads);
+    }
+
+    if (resources != RESOURCES_NONE) {
+        struct resource_usage usage;
+        struct run_summary run = {
+            .config = &config,
+            .engine = engine,
+            .threads = swaps ? 1 : _resolve_threads(threads),
+            .runs = runs,
+            .wins = swaps ? -1 : (long long) wins,
+            .wall_seconds = duration,
+        };
+
+        if (_resource_usage_get(&usage) == 0) {
+            _print_resources(reports_out, &run, &usage, resources);
+        }
+    }
+
+    prisoner_destroy(ctx);
+    free(budgets);
+    free(needed);
+    free(needed_counts);
+    free(reports);
+
+    error = _output_close(&output);
+
+    if (error != 0) {
+        fprintf(stderr, "%s: could not write the results: %s\n", argv[0], strerror(error));
+        return 1;
+    }
 
     return 0;
 }
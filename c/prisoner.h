@@ -0,0 +1,170 @@
+#ifndef PRISONER_H
+#define PRISONER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// libprisoner simulates the hundred prisoners riddle described in the README. A
+// context holds everything a simulation needs -- its configuration, its random
+// number generator and its scratch buffers -- so separate contexts can be used
+// from separate threads without any locking. A single context must not be used
+// from two threads at once.
+//
+// This header is stable: new fields are only ever appended to the structs below,
+// and existing functions keep their signatures. PRISONER_API_VERSION is bumped
+// whenever something is added.
+#define PRISONER_API_VERSION 2
+
+typedef struct prisoner_ctx prisoner_ctx;
+
+typedef enum prisoner_warden {
+    // Slips are distributed uniformly at random, as in the original riddle.
+    PRISONER_WARDEN_RANDOM,
+    // The warden arranges the slips in a single loop through every box.
+    PRISONER_WARDEN_CYCLE,
+    // As above, but the warden has learned the prisoners' relabeling.
+    PRISONER_WARDEN_LEAKED,
+} prisoner_warden;
+
+typedef enum prisoner_mapping {
+    // Every box holds a different slip.
+    PRISONER_MAPPING_PERMUTATION,
+    // Each box holds a slip drawn independently, so slips can repeat and some
+    // never appear at all.
+    PRISONER_MAPPING_FUNCTION,
+} prisoner_mapping;
+
+typedef enum prisoner_swap_policy {
+    // Split every loop that is too long into as few pieces as will fit.
+    PRISONER_SWAP_OPTIMAL,
+    // Keep cutting the longest loop in half, which is what a single prisoner
+    // can work out by eye.
+    PRISONER_SWAP_HALVE,
+} prisoner_swap_policy;
+
+typedef struct prisoner_config {
+    // The number of prisoners, and the number of boxes each may open.
+    unsigned int count;
+    unsigned int chances;
+
+    // The number of boxes, which must be at least `count`. Zero means one box per
+    // prisoner. Anything else, or a `mapping` other than a permutation, cannot be
+    // combined with an adversarial warden, a relabeling or `budgets`.
+    unsigned int box_count;
+    prisoner_mapping mapping;
+
+    // How the warden arranges the slips, and whether the prisoners defend with a
+    // secret relabeling that is redrawn for every trial. A leaked relabeling
+    // implies that there is one.
+    prisoner_warden warden;
+    bool relabel;
+
+    // If not NULL, `count` budgets that replace `chances`, one per prisoner. They
+    // are copied when the context is created.
+    const unsigned int *budgets;
+} prisoner_config;
+
+typedef struct prisoner_mapping_stats {
+    // Totals across every trial run on a context with more boxes than prisoners
+    // or a random function mapping; divide by the number of trials for averages.
+    unsigned long long components;
+    unsigned long long cyclic_boxes;
+    unsigned long long longest_cycle;
+    unsigned long long longest_tail;
+    unsigned long long prisoners_found;
+} prisoner_mapping_stats;
+
+typedef struct prisoner_results {
+    uint64_t trials;
+    uint64_t wins;
+    prisoner_mapping_stats mapping;
+} prisoner_results;
+
+// Returns the configuration of the original riddle: 100 prisoners with 50
+// chances each, and slips distributed uniformly at random.
+prisoner_config prisoner_config_default(void);
+
+// Creates a context for `config`, seeded with zero. Returns NULL and sets errno
+// to EINVAL if the configuration is invalid, or ENOMEM if it cannot be allocated.
+prisoner_ctx *prisoner_create(const prisoner_config *config);
+void prisoner_destroy(prisoner_ctx *ctx);
+
+// Reseeds the context's random number generator and puts the boxes back in their
+// starting arrangement. Two contexts with the same configuration and seed
+// produce the same sequence of trials.
+void prisoner_seed(prisoner_ctx *ctx, uint64_t seed);
+
+// Arranges the boxes and plays a single game, returning whether every prisoner
+// found their slip.
+bool prisoner_trial(prisoner_ctx *ctx);
+
+// Plays `trials` games, storing each outcome in `results`, and returns the number
+// that were won.
+uint64_t prisoner_trial_batch(prisoner_ctx *ctx, bool *results, size_t trials);
+
+// Plays `trials` games and returns the number that were won.
+uint64_t prisoner_run(prisoner_ctx *ctx, uint64_t trials);
+
+// Arranges the boxes and, for each of the `chances_len` budgets in `chances`,
+// stores how many pre-game swaps of two slips `policy` needs before every
+// prisoner can find their slip, up to `limit`. Returns false without playing if
+// the context has more boxes than prisoners or a random function mapping.
+bool prisoner_trial_swaps(
+    prisoner_ctx *ctx,
+    const unsigned int *chances,
+    size_t chances_len,
+    prisoner_swap_policy policy,
+    unsigned int limit,
+    unsigned int *needed
+);
+
+// Arranges the boxes and returns the length of the longest loop, which decides
+// the game for every number of chances at once: it is won exactly when the
+// prisoners have at least that many. Returns 0 without playing if the context
+// has more boxes than prisoners, a random function mapping or budgets.
+unsigned int prisoner_trial_longest_loop(prisoner_ctx *ctx);
+
+// Plays `trials` games of `config` across `threads` threads, or one per online
+// CPU if `threads` is zero, and stores the totals in `results`. Each thread gets
+// its own context, and trials are handed out in seeded chunks, so the totals
+// depend on `seed` but not on the number of threads. Returns 0, or an errno value
+// on failure.
+int prisoner_run_parallel(
+    const prisoner_config *config,
+    uint64_t seed,
+    uint64_t trials,
+    unsigned int threads,
+    prisoner_results *results
+);
+
+// Like prisoner_run_parallel, but ignores `config->chances` and instead stores in
+// `wins[c]` the number of games that would have been won with `c` chances, for
+// every `c` from 0 to `config->count`. Returns EINVAL for configurations that
+// prisoner_trial_longest_loop does not support.
+int prisoner_sweep(
+    const prisoner_config *config,
+    uint64_t seed,
+    uint64_t trials,
+    unsigned int threads,
+    uint64_t *wins
+);
+
+// Copies out the component statistics gathered so far.
+void prisoner_mapping_stats_get(
+    const prisoner_ctx *ctx,
+    prisoner_mapping_stats *stats
+);
+
+// The arrangement used by the most recent trial: box `i` holds slip `boxes[i]`.
+const unsigned int *prisoner_boxes(const prisoner_ctx *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,333 @@
+#include <math.h>
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "progress.h"
+
+
+// 95% two-sided.
+#define Z_CONFIDENCE 1.959964
+
+struct snapshot {
+    uint64_t trials;
+    uint64_t wins;
+    double elapsed;
+    double trials_per_second;
+    double eta;
+    double rate;
+    double half_width;
+};
+
+
+static double _now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void _snapshot(struct progress *progress, struct snapshot *snapshot) {
+    double now = _now();
+
+    memset(snapshot, 0, sizeof(struct snapshot));
+
+    for (unsigned int i = 0; i < progress->slots_len; i++) {
+        snapshot->trials += atomic_load_explicit(
+            &progress->slots[i].trials, memory_order_relaxed
+        );
+        snapshot->wins += atomic_load_explicit(
+            &progress->slots[i].wins, memory_order_relaxed
+        );
+    }
+
+    snapshot->elapsed = now - progress->started;
+
+    // The throughput since the last report, so that the ETA follows any change
+    // in speed rather than averaging it away.
+    if (now > progress->last_time) {
+        snapshot->trials_per_second = (snapshot->trials - progress->last_trials)
+            / (now - progress->last_time);
+    }
+
+    progress->last_trials = snapshot->trials;
+    progress->last_time = now;
+
+    snapshot->eta = snapshot->trials_per_second > 0
+        ? (progress->target - snapshot->trials) / snapshot->trials_per_second
+        : INFINITY;
+
+    // The normal approximation is plenty for the width of a progress bar.
+    if (snapshot->trials > 0) {
+        double p = (double) snapshot->wins / snapshot->trials;
+
+        snapshot->rate = p;
+        snapshot->half_width = Z_CONFIDENCE * sqrt(p * (1 - p) / snapshot->trials);
+    }
+}
+
+
+static void _write_log(struct progress *progress, const struct snapshot *snapshot, bool done) {
+    // On a terminal each report replaces the last; anywhere else it is a line of
+    // its own.
+    bool terminal = isatty(fileno(progress->log));
+
+    fprintf(
+        progress->log,
+        "%s%5.1f%%  %llu of %llu trials  %.4f%% +/- %.4f%% won  %.0f trials/s  ",
+        terminal ? "\r\033[K" : "",
+        100.0 * snapshot->trials / progress->target,
+        (unsigned long long) snapshot->trials,
+        (unsigned long long) progress->target,
+        100 * snapshot->rate,
+        100 * snapshot->half_width,
+        snapshot->trials_per_second
+    );
+
+    if (done) {
+        fprintf(progress->log, "done in %.1fs", snapshot->elapsed);
+    } else if (isfinite(snapshot->eta)) {
+        fprintf(progress->log, "eta %.0fs", snapshot->eta);
+    } else {
+        fprintf(progress->log, "eta unknown");
+    }
+
+    if (done || !terminal) {
+        fputc('\n', progress->log);
+    }
+
+    fflush(progress->log);
+}
+
+
+static void _write_metric(
+    FILE *file,
+    const char *name,
+    const char *type,
+    const char *help,
+    double value
+) {
+    fprintf(file, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+
+    // Prometheus spells infinity its own way.
+    if (isinf(value)) {
+        fprintf(file, "%s %sInf\n", name, value > 0 ? "+" : "-");
+    } else {
+        fprintf(file, "%s %.17g\n", name, value);
+    }
+}
+
+
+// Writes the metrics beside the file and renames them over it, so that readers
+// only ever see a complete report.
+static int _write_metrics(
+    struct progress *progress,
+    const struct snapshot *snapshot,
+    bool done
+) {
+    size_t length = strlen(progress->metrics_path);
+    char *temporary = malloc(length + sizeof(".tmp"));
+    FILE *file;
+
+    if (temporary == NULL) {
+        return ENOMEM;
+    }
+
+    memcpy(temporary, progress->metrics_path, length);
+    memcpy(temporary + length, ".tmp", sizeof(".tmp"));
+    file = fopen(temporary, "w");
+
+    if (file == NULL) {
+        int error = errno;
+
+        free(temporary);
+        return error;
+    }
+
+    _write_metric(file, "prisoner_trials_total", "counter",
+        "Trials finished so far.", (double) snapshot->trials);
+    _write_metric(file, "prisoner_trials_target", "gauge",
+        "Trials in the whole run.", (double) progress->target);
+    _write_metric(file, "prisoner_wins_total", "counter",
+        "Trials won so far.", (double) snapshot->wins);
+    _write_metric(file, "prisoner_success_rate", "gauge",
+        "Fraction of the trials so far that were won.", snapshot->rate);
+    _write_metric(file, "prisoner_success_rate_ci_half_width", "gauge",
+        "Half the width of the 95% confidence interval on the success rate.",
+        snapshot->half_width);
+    _write_metric(file, "prisoner_trials_per_second", "gauge",
+        "Throughput since the previous report.", snapshot->trials_per_second);
+    _write_metric(file, "prisoner_eta_seconds", "gauge",
+        "Estimated time left at the current throughput.", done ? 0 : snapshot->eta);
+    _write_metric(file, "prisoner_elapsed_seconds", "gauge",
+        "Time since the run started.", snapshot->elapsed);
+    _write_metric(file, "prisoner_done", "gauge",
+        "1 once the run has finished.", done);
+
+    fprintf(
+        file,
+        "# HELP prisoner_thread_trials_total Trials finished so far by each thread.\n"
+        "# TYPE prisoner_thread_trials_total counter\n"
+    );
+
+    for (unsigned int i = 0; i < progress->slots_len; i++) {
+        fprintf(
+            file,
+            "prisoner_thread_trials_total{thread=\"%u\"} %llu\n",
+            i,
+            (unsigned long long) atomic_load_explicit(
+                &progress->slots[i].trials, memory_order_relaxed
+            )
+        );
+    }
+
+    int error = ferror(file) ? EIO : 0;
+
+    if (fclose(file) != 0 && error == 0) {
+        error = errno;
+    }
+
+    if (error == 0 && rename(temporary, progress->metrics_path) != 0) {
+        error = errno;
+    }
+
+    if (error != 0) {
+        unlink(temporary);
+    }
+
+    free(temporary);
+
+    return error;
+}
+
+
+static void _report(struct progress *progress, bool done) {
+    struct snapshot snapshot;
+
+    _snapshot(progress, &snapshot);
+
+    // Once it is over, the throughput of the whole run is the one that matters.
+    if (done && snapshot.elapsed > 0) {
+        snapshot.trials_per_second = snapshot.trials / snapshot.elapsed;
+    }
+
+    if (progress->log != NULL) {
+        _write_log(progress, &snapshot, done);
+    }
+
+    if (progress->metrics_path != NULL) {
+        int error = _write_metrics(progress, &snapshot, done);
+
+        if (error != 0) {
+            fprintf(
+                stderr,
+                "could not write metrics to '%s': %s\n",
+                progress->metrics_path,
+                strerror(error)
+            );
+        }
+    }
+}
+
+
+static void *_reporter_main(void *arg) {
+    struct progress *progress = arg;
+    double next = progress->started + progress->interval;
+
+    pthread_mutex_lock(&progress->lock);
+
+    while (!progress->stopping) {
+        struct timespec deadline = {
+            .tv_sec = (time_t) next,
+            .tv_nsec = (long) ((next - (time_t) next) * 1e9),
+        };
+
+        if (pthread_cond_timedwait(&progress->wake, &progress->lock, &deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&progress->lock);
+            _report(progress, false);
+            pthread_mutex_lock(&progress->lock);
+            next += progress->interval;
+        }
+    }
+
+    pthread_mutex_unlock(&progress->lock);
+
+    return NULL;
+}
+
+
+int _progress_start(
+    struct progress *progress,
+    unsigned int threads,
+    uint64_t target,
+    double interval,
+    FILE *log,
+    const char *metrics_path
+) {
+    pthread_condattr_t attributes;
+    int error;
+
+    memset(progress, 0, sizeof(struct progress));
+
+    // Aligned so that no two workers' slots share a cache line.
+    progress->slots = aligned_alloc(
+        _Alignof(struct progress_slot), threads * sizeof(struct progress_slot)
+    );
+
+    if (progress->slots == NULL) {
+        return ENOMEM;
+    }
+
+    for (unsigned int i = 0; i < threads; i++) {
+        atomic_init(&progress->slots[i].trials, 0);
+        atomic_init(&progress->slots[i].wins, 0);
+    }
+
+    progress->slots_len = threads;
+    progress->target = target;
+    progress->interval = interval;
+    progress->log = log;
+    progress->metrics_path = metrics_path;
+    progress->started = progress->last_time = _now();
+
+    // The deadlines are on the monotonic clock, like everything else here.
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&progress->wake, &attributes);
+    pthread_condattr_destroy(&attributes);
+    pthread_mutex_init(&progress->lock, NULL);
+
+    error = pthread_create(&progress->thread, NULL, _reporter_main, progress);
+
+    if (error != 0) {
+        pthread_cond_destroy(&progress->wake);
+        pthread_mutex_destroy(&progress->lock);
+        free(progress->slots);
+    }
+
+    return error;
+}
+
+
+void _progress_stop(struct progress *progress) {
+    pthread_mutex_lock(&progress->lock);
+    progress->stopping = true;
+    pthread_cond_signal(&progress->wake);
+    pthread_mutex_unlock(&progress->lock);
+    pthread_join(progress->thread, NULL);
+
+    _report(progress, true);
+
+    pthread_cond_destroy(&progress->wake);
+    pthread_mutex_destroy(&progress->lock);
+    free(progress->slots);
+}
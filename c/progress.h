@@ -0,0 +1,55 @@
+#ifndef PRISONER_PROGRESS_H
+#define PRISONER_PROGRESS_H
+
+// Live progress of a parallel run. Every worker publishes its running totals in
+// a slot of its own, on its own cache line, with relaxed stores after each chunk,
+// and a reporter thread adds them up every so often and writes them to stderr,
+// to a Prometheus text-format file, or both. The workers never wait on it.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+struct progress_slot {
+    _Alignas(64) atomic_uint_fast64_t trials;
+    atomic_uint_fast64_t wins;
+};
+
+struct progress {
+    // One per worker, indexed by the worker's number.
+    struct progress_slot *slots;
+    unsigned int slots_len;
+
+    uint64_t target;
+    double interval;
+    FILE *log;
+    const char *metrics_path;
+
+    double started;
+    uint64_t last_trials;
+    double last_time;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool stopping;
+};
+
+// Starts reporting on a run of `target` trials over `threads` workers every
+// `interval` seconds, to `log` and `metrics_path` where they are not NULL.
+// Returns 0 or an errno value.
+int _progress_start(
+    struct progress *progress,
+    unsigned int threads,
+    uint64_t target,
+    double interval,
+    FILE *log,
+    const char *metrics_path
+);
+
+// Stops the reporter after one final report, which marks the run as done.
+void _progress_stop(struct progress *progress);
+
+#endif
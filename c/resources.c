@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "resources.h"
+
+
+// Reads a "Name:   123 kB" line from /proc/self/status, in bytes.
+static uint64_t _status_bytes(const char *name) {
+    FILE *file = fopen("/proc/self/status", "r");
+    size_t length = strlen(name);
+    unsigned long long kilobytes = 0;
+    char line[256];
+
+    if (file == NULL) {
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, name, length) == 0 && line[length] == ':') {
+            sscanf(line + length + 1, "%llu", &kilobytes);
+            break;
+        }
+    }
+
+    fclose(file);
+
+    return (uint64_t) kilobytes * 1024;
+}
+
+
+int _resource_usage_get(struct resource_usage *usage) {
+    struct rusage rusage;
+
+    memset(usage, 0, sizeof(struct resource_usage));
+
+    if (getrusage(RUSAGE_SELF, &rusage) != 0) {
+        return errno;
+    }
+
+    usage->user_seconds = rusage.ru_utime.tv_sec + rusage.ru_utime.tv_usec / 1e6;
+    usage->system_seconds = rusage.ru_stime.tv_sec + rusage.ru_stime.tv_usec / 1e6;
+    usage->minor_faults = (uint64_t) rusage.ru_minflt;
+    usage->major_faults = (uint64_t) rusage.ru_majflt;
+    usage->voluntary_switches = (uint64_t) rusage.ru_nvcsw;
+    usage->involuntary_switches = (uint64_t) rusage.ru_nivcsw;
+
+    // /proc is exact where getrusage rounds, and also knows the virtual peak.
+    usage->peak_rss = _status_bytes("VmHWM");
+    usage->peak_virtual = _status_bytes("VmPeak");
+
+    if (usage->peak_rss == 0) {
+#ifdef __APPLE__
+        // Already in bytes there.
+        usage->peak_rss = (uint64_t) rusage.ru_maxrss;
+#else
+        usage->peak_rss = (uint64_t) rusage.ru_maxrss * 1024;
+#endif
+    }
+
+    return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef PRISONER_RESOURCES_H
+#define PRISONER_RESOURCES_H
+
+// What the whole process has used so far, from getrusage and, where there is
+// one, /proc. Fields the system cannot tell are left at zero.
+
+#include <stdint.h>
+
+struct resource_usage {
+    double user_seconds;
+    double system_seconds;
+
+    // The most memory the process ever had resident, and mapped, in bytes.
+    uint64_t peak_rss;
+    uint64_t peak_virtual;
+
+    uint64_t minor_faults;
+    uint64_t major_faults;
+    uint64_t voluntary_switches;
+    uint64_t involuntary_switches;
+};
+
+// Returns 0 or an errno value.
+int _resource_usage_get(struct resource_usage *usage);
+
+#endif
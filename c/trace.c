@@ -0,0 +1,630 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "trace.h"
+#include "lehmer.h"
+
+
+// Blocks hold this much, or one record if that is larger.
+#define BLOCK_BYTES (1 << 20)
+
+const char *const trace_payload_names[TRACE_PAYLOAD_COUNT] = {
+    "none",
+    "permutation",
+    "cycles",
+    "lehmer",
+};
+
+
+bool _trace_applies(const prisoner_config *config) {
+    return (config->box_count == 0 || config->box_count == config->count)
+        && config->mapping == PRISONER_MAPPING_PERMUTATION
+        && config->budgets == NULL;
+}
+
+
+static uint32_t _payload_width(uint32_t count) {
+    return count <= UINT8_MAX ? 1 : count <= UINT16_MAX ? 2 : 4;
+}
+
+
+// The most a record can take: its index, and at worst a length per loop plus
+// the number of loops.
+static size_t _max_record_bytes(const struct trace_header *header) {
+    switch (header->payload) {
+        case TRACE_PAYLOAD_PERMUTATION:
+            return sizeof(uint32_t) + (size_t) header->count * header->width;
+        case TRACE_PAYLOAD_CYCLES:
+            return sizeof(uint32_t) + ((size_t) header->count + 1) * header->width;
+        case TRACE_PAYLOAD_LEHMER:
+            return sizeof(uint32_t) + _lehmer_bytes(header->count);
+        default:
+            return sizeof(uint32_t);
+    }
+}
+
+
+static inline void _put(uint8_t *dest, uint32_t value, uint32_t width) {
+    if (width == 1) {
+        *dest = (uint8_t) value;
+    } else if (width == 2) {
+        uint16_t narrow = (uint16_t) value;
+        memcpy(dest, &narrow, sizeof(narrow));
+    } else {
+        memcpy(dest, &value, sizeof(value));
+    }
+}
+
+
+static inline uint32_t _get(const uint8_t *src, uint32_t width) {
+    if (width == 1) {
+        return *src;
+    } else if (width == 2) {
+        uint16_t narrow;
+        memcpy(&narrow, src, sizeof(narrow));
+        return narrow;
+    }
+
+    uint32_t value;
+    memcpy(&value, src, sizeof(value));
+
+    return value;
+}
+
+
+static int _compare_lengths(const void *a, const void *b) {
+    unsigned int x = *(const unsigned int *) a, y = *(const unsigned int *) b;
+
+    // Longest first.
+    return (x < y) - (x > y);
+}
+
+
+// Writes the payload for the arrangement in `ctx->boxes` to `dest`, and returns
+// how many bytes it took. Lehmer payloads take `packed_len` and need `2 * count`
+// values of `scratch`.
+static size_t _encode_payload(
+    const struct trace_header *header,
+    size_t packed_len,
+    unsigned int *scratch,
+    prisoner_ctx *ctx,
+    uint8_t *dest
+) {
+    uint32_t width = header->width;
+    unsigned int cycles;
+
+    switch (header->payload) {
+        case TRACE_PAYLOAD_PERMUTATION:
+            for (uint32_t box = 0; box < header->count; box++) {
+                _put(dest + box * width, ctx->boxes[box], width);
+            }
+
+            return (size_t) header->count * width;
+        case TRACE_PAYLOAD_CYCLES:
+            cycles = _cycle_lengths(ctx);
+            qsort(ctx->lengths, cycles, sizeof(unsigned int), _compare_lengths);
+            _put(dest, cycles, width);
+
+            for (unsigned int i = 0; i < cycles; i++) {
+                _put(dest + (i + 1) * width, ctx->lengths[i], width);
+            }
+
+            return ((size_t) cycles + 1) * width;
+        case TRACE_PAYLOAD_LEHMER:
+            _lehmer_encode(ctx->boxes, header->count, scratch, dest);
+
+            return packed_len;
+        default:
+            return 0;
+    }
+}
+
+
+static void *_writer_main(void *arg) {
+    struct trace_writer *writer = arg;
+
+    pthread_mutex_lock(&writer->lock);
+
+    for (;;) {
+        while (writer->full == NULL && !writer->closing) {
+            pthread_cond_wait(&writer->filled, &writer->lock);
+        }
+
+        struct trace_block *block = writer->full;
+
+        if (block == NULL) {
+            break;
+        }
+
+        writer->full = block->next;
+
+        if (writer->full == NULL) {
+            writer->full_tail = NULL;
+        }
+
+        pthread_mutex_unlock(&writer->lock);
+
+        // Only this thread writes, so the file needs no lock of its own.
+        if (writer->error == 0) {
+            uint32_t sizes[2] = {block->records, (uint32_t) block->len};
+
+            if (fwrite(&block->chunk, sizeof(block->chunk), 1, writer->file) != 1
+                || fwrite(sizes, sizeof(sizes), 1, writer->file) != 1
+                || fwrite(block->data, 1, block->len, writer->file) != block->len) {
+                writer->error = errno != 0 ? errno : EIO;
+            }
+        }
+
+        pthread_mutex_lock(&writer->lock);
+        block->next = writer->free;
+        writer->free = block;
+        pthread_cond_signal(&writer->emptied);
+    }
+
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
+
+
+int _trace_open(
+    struct trace_writer *writer,
+    const char *path,
+    const prisoner_config *config,
+    enum evaluator evaluator,
+    enum trace_payload payload,
+    uint64_t seed,
+    uint64_t trials,
+    unsigned int threads
+) {
+    struct trace_header *header = &writer->header;
+    int error;
+
+    memset(writer, 0, sizeof(struct trace_writer));
+
+    if (!_trace_applies(config) || threads == 0) {
+        return EINVAL;
+    }
+
+    memcpy(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header->version = TRACE_VERSION;
+    header->payload = payload;
+    header->width = _payload_width(config->count);
+    header->count = config->count;
+    header->chances = config->chances;
+    header->warden = config->warden;
+    header->relabel = config->relabel;
+    header->evaluator = evaluator;
+    header->seed = seed;
+    header->trials = trials;
+
+    size_t capacity = _max_record_bytes(header);
+    bool packed = payload == TRACE_PAYLOAD_LEHMER;
+
+    writer->packed_len = packed ? _lehmer_bytes(config->count) : 0;
+
+    capacity = capacity > BLOCK_BYTES ? capacity : BLOCK_BYTES;
+
+    // Two per worker: one being filled while the other is written.
+    writer->blocks_len = 2 * threads;
+    writer->blocks = calloc(writer->blocks_len, sizeof(struct trace_block));
+
+    if (writer->blocks == NULL) {
+        return ENOMEM;
+    }
+
+    for (unsigned int i = 0; i < writer->blocks_len; i++) {
+        struct trace_block *block = &writer->blocks[i];
+
+        block->data = malloc(capacity);
+        block->capacity = capacity;
+        block->scratch = packed
+            ? malloc(2 * (size_t) config->count * sizeof(unsigned int))
+            : NULL;
+        block->next = writer->free;
+        writer->free = block;
+
+        if (block->data == NULL || (packed && block->scratch == NULL)) {
+            error = ENOMEM;
+            goto fail;
+        }
+    }
+
+    writer->file = fopen(path, "wb");
+
+    if (writer->file == NULL) {
+        error = errno;
+        goto fail;
+    }
+
+    if (fwrite(header, sizeof(struct trace_header), 1, writer->file) != 1) {
+        error = errno != 0 ? errno : EIO;
+        goto fail;
+    }
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->filled, NULL);
+    pthread_cond_init(&writer->emptied, NULL);
+    error = pthread_create(&writer->thread, NULL, _writer_main, writer);
+
+    if (error != 0) {
+        pthread_cond_destroy(&writer->emptied);
+        pthread_cond_destroy(&writer->filled);
+        pthread_mutex_destroy(&writer->lock);
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    if (writer->file != NULL) {
+        fclose(writer->file);
+        remove(path);
+    }
+
+    for (unsigned int i = 0; i < writer->blocks_len; i++) {
+        free(writer->blocks[i].data);
+        free(writer->blocks[i].scratch);
+    }
+
+    free(writer->blocks);
+
+    return error;
+}
+
+
+static struct trace_block *_take_free(struct trace_writer *writer, uint64_t chunk) {
+    pthread_mutex_lock(&writer->lock);
+
+    while (writer->free == NULL) {
+        pthread_cond_wait(&writer->emptied, &writer->lock);
+    }
+
+    struct trace_block *block = writer->free;
+
+    writer->free = block->next;
+    pthread_mutex_unlock(&writer->lock);
+
+    block->chunk = chunk;
+    block->records = 0;
+    block->len = 0;
+    block->next = NULL;
+
+    return block;
+}
+
+
+static void _submit(struct trace_writer *writer, struct trace_block *block) {
+    pthread_mutex_lock(&writer->lock);
+
+    if (writer->full_tail != NULL) {
+        writer->full_tail->next = block;
+    } else {
+        writer->full = block;
+    }
+
+    writer->full_tail = block;
+    pthread_cond_signal(&writer->filled);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+
+uint64_t _trace_chunk(
+    struct trace_writer *writer,
+    prisoner_ctx *ctx,
+    uint64_t chunk,
+    uint64_t trials
+) {
+    size_t max_record = _max_record_bytes(&writer->header);
+    struct trace_block *block = _take_free(writer, chunk);
+    uint64_t wins = 0;
+
+    for (uint32_t index = 0; index < trials; index++) {
+        bool won = prisoner_trial(ctx);
+        uint32_t tagged = index | (won ? TRACE_WON : 0);
+
+        if (block->len + max_record > block->capacity) {
+            _submit(writer, block);
+            block = _take_free(writer, chunk);
+        }
+
+        memcpy(block->data + block->len, &tagged, sizeof(tagged));
+        block->len += sizeof(tagged);
+        block->len += _encode_payload(
+            &writer->header,
+            writer->packed_len,
+            block->scratch,
+            ctx,
+            block->data + block->len
+        );
+        block->records++;
+        wins += won;
+    }
+
+    _submit(writer, block);
+
+    return wins;
+}
+
+
+int _trace_close(struct trace_writer *writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->closing = true;
+    pthread_cond_signal(&writer->filled);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    if (fclose(writer->file) != 0 && writer->error == 0) {
+        writer->error = errno;
+    }
+
+    for (unsigned int i = 0; i < writer->blocks_len; i++) {
+        free(writer->blocks[i].data);
+        free(writer->blocks[i].scratch);
+    }
+
+    free(writer->blocks);
+    pthread_cond_destroy(&writer->emptied);
+    pthread_cond_destroy(&writer->filled);
+    pthread_mutex_destroy(&writer->lock);
+
+    return writer->error;
+}
+
+
+// Where a block is in the file, so that a chunk's blocks can be replayed in
+// order however they were interleaved.
+struct block_entry {
+    uint64_t chunk;
+    long offset;
+};
+
+
+static int _compare_entries(const void *a, const void *b) {
+    const struct block_entry *x = a, *y = b;
+
+    if (x->chunk != y->chunk) {
+        return (x->chunk > y->chunk) - (x->chunk < y->chunk);
+    }
+
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+
+// Lists every block after the header. Returns 0, or EINVAL if the file ends
+// partway through one.
+static int _index_blocks(FILE *file, struct block_entry **entries, size_t *entries_len) {
+    size_t capacity = 0;
+
+    *entries = NULL;
+    *entries_len = 0;
+
+    for (;;) {
+        uint64_t chunk;
+        uint32_t sizes[2];
+        long offset = ftell(file);
+
+        if (fread(&chunk, sizeof(chunk), 1, file) != 1) {
+            return feof(file) ? 0 : EIO;
+        }
+
+        if (fread(sizes, sizeof(sizes), 1, file) != 1 || fseek(file, sizes[1], SEEK_CUR) != 0) {
+            return EINVAL;
+        }
+
+        if (*entries_len == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+
+            struct block_entry *grown = realloc(*entries, capacity * sizeof(struct block_entry));
+
+            if (grown == NULL) {
+                return ENOMEM;
+            }
+
+            *entries = grown;
+        }
+
+        (*entries)[(*entries_len)++] = (struct block_entry) {chunk, offset};
+    }
+}
+
+
+// Describes an outcome that differs, given the recorded one, or otherwise an
+// arrangement that does.
+static void _describe_difference(FILE *log, uint64_t chunk, uint32_t index, const bool *recorded) {
+    if (log == NULL) {
+        return;
+    }
+
+    fprintf(
+        log,
+        "trial %llu (chunk %llu, trial %u): ",
+        (unsigned long long) (chunk * CHUNK_TRIALS + index),
+        (unsigned long long) chunk,
+        index
+    );
+
+    if (recorded != NULL) {
+        fprintf(
+            log,
+            "recorded %s, replayed %s\n",
+            *recorded ? "won" : "lost",
+            *recorded ? "lost" : "won"
+        );
+    } else {
+        fprintf(log, "arrangement differs\n");
+    }
+}
+
+
+int _trace_replay(
+    const char *path,
+    enum evaluator evaluator,
+    FILE *log,
+    unsigned int max_shown,
+    struct trace_header *header,
+    struct replay_summary *summary
+) {
+    FILE *file = fopen(path, "rb");
+    struct block_entry *entries = NULL;
+    size_t entries_len = 0;
+    uint8_t *data = NULL, *expected = NULL;
+    unsigned int *scratch = NULL;
+    prisoner_ctx *ctx = NULL;
+    int error = 0;
+
+    memset(summary, 0, sizeof(struct replay_summary));
+
+    if (file == NULL) {
+        return errno;
+    }
+
+    if (fread(header, sizeof(struct trace_header), 1, file) != 1
+        || memcmp(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0
+        || header->version != TRACE_VERSION
+        || header->payload >= TRACE_PAYLOAD_COUNT
+        || header->width != _payload_width(header->count)
+        || header->count == 0) {
+        fclose(file);
+        return EINVAL;
+    }
+
+    prisoner_config config = prisoner_config_default();
+
+    config.count = header->count;
+    config.chances = header->chances;
+    config.warden = header->warden;
+    config.relabel = header->relabel;
+    ctx = prisoner_create(&config);
+    expected = malloc(_max_record_bytes(header));
+    scratch = malloc(2 * (size_t) header->count * sizeof(unsigned int));
+    error = ctx == NULL ? EINVAL
+        : expected == NULL || scratch == NULL ? ENOMEM
+        : _index_blocks(file, &entries, &entries_len);
+
+    size_t packed_len = header->payload == TRACE_PAYLOAD_LEHMER ? _lehmer_bytes(header->count) : 0;
+
+    if (error == 0) {
+        ctx->evaluator = evaluator;
+        qsort(entries, entries_len, sizeof(struct block_entry), _compare_entries);
+    }
+
+    uint64_t current_chunk = UINT64_MAX;
+    uint32_t next_index = 0;
+    unsigned int shown = 0;
+
+    for (size_t i = 0; i < entries_len && error == 0; i++) {
+        uint64_t chunk;
+        uint32_t sizes[2];
+
+        if (fseek(file, entries[i].offset, SEEK_SET) != 0
+            || fread(&chunk, sizeof(chunk), 1, file) != 1
+            || fread(sizes, sizeof(sizes), 1, file) != 1) {
+            error = EIO;
+            break;
+        }
+
+        uint8_t *grown = realloc(data, sizes[1] > 0 ? sizes[1] : 1);
+
+        if (grown == NULL) {
+            error = ENOMEM;
+            break;
+        }
+
+        data = grown;
+
+        if (fread(data, 1, sizes[1], file) != sizes[1]) {
+            error = EINVAL;
+            break;
+        }
+
+        // A chunk's blocks are replayed back to back, so its trials run in order
+        // from its seed, as they did when recorded.
+        if (chunk != current_chunk) {
+            prisoner_seed(ctx, _chunk_seed(header->seed, chunk));
+            current_chunk = chunk;
+            next_index = 0;
+        }
+
+        size_t position = 0;
+
+        for (uint32_t record = 0; record < sizes[0]; record++) {
+            uint32_t tagged;
+
+            if (position + sizeof(tagged) > sizes[1]) {
+                error = EINVAL;
+                break;
+            }
+
+            memcpy(&tagged, data + position, sizeof(tagged));
+            position += sizeof(tagged);
+
+            uint32_t index = tagged & ~TRACE_WON;
+            bool recorded = (tagged & TRACE_WON) != 0;
+
+            if (index < next_index || index >= CHUNK_TRIALS) {
+                error = EINVAL;
+                break;
+            }
+
+            // Trials the trace skipped still move the generator on.
+            for (; next_index < index; next_index++) {
+                _arrange_boxes(ctx);
+            }
+
+            _arrange_boxes(ctx);
+            next_index++;
+
+            bool replayed = _evaluate(ctx);
+            size_t payload_len = _encode_payload(header, packed_len, scratch, ctx, expected);
+
+            summary->trials++;
+
+            if (header->payload != TRACE_PAYLOAD_NONE) {
+                // A recorded list of loops is as long as its own count says.
+                size_t recorded_len = payload_len;
+
+                if (header->payload == TRACE_PAYLOAD_CYCLES && position + header->width <= sizes[1]) {
+                    recorded_len = ((size_t) _get(data + position, header->width) + 1) * header->width;
+                }
+
+                if (position + recorded_len > sizes[1]) {
+                    error = EINVAL;
+                    break;
+                }
+
+                if (recorded_len != payload_len || memcmp(data + position, expected, payload_len) != 0) {
+                    summary->arrangement_differences++;
+
+                    if (shown++ < max_shown) {
+                        _describe_difference(log, chunk, index, NULL);
+                    }
+                }
+
+                position += recorded_len;
+            }
+
+            if (recorded != replayed) {
+                summary->outcome_differences++;
+
+                if (shown++ < max_shown) {
+                    _describe_difference(log, chunk, index, &recorded);
+                }
+            }
+        }
+    }
+
+    free(entries);
+    free(data);
+    free(expected);
+    free(scratch);
+    prisoner_destroy(ctx);
+    fclose(file);
+
+    return error;
+}
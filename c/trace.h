@@ -0,0 +1,147 @@
+#ifndef PRISONER_TRACE_H
+#define PRISONER_TRACE_H
+
+// Traces of parallel runs, recording every trial compactly enough to replay and
+// audit later. A trace is a header followed by blocks of one chunk's records
+// each, in whatever order they filled:
+//
+//   header  struct trace_header
+//   block   uint64 chunk, uint32 records, uint32 bytes, then `bytes` of records
+//   record  uint32 index within the chunk, with the outcome in the top bit,
+//           then the payload, if any, in `width`-byte unsigned integers:
+//           the permutation's `count` boxes, or the number of loops followed by
+//           their lengths, longest first; or the permutation packed as in
+//           lehmer.h, in `_lehmer_bytes(count)` bytes
+//
+// Everything is in the byte order of the machine that wrote it. Workers fill
+// blocks from a pool of two per worker and hand them to a writer thread, so they
+// only ever wait for I/O when the disk falls a whole buffer per worker behind.
+// Trials can be found again from the seed and chunk alone, because a parallel
+// run seeds each chunk independently.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "engine.h"
+
+#define TRACE_MAGIC "PRTRACE"
+#define TRACE_VERSION 1
+
+// The top bit of a record's index.
+#define TRACE_WON 0x80000000u
+
+enum trace_payload {
+    TRACE_PAYLOAD_NONE,
+    TRACE_PAYLOAD_PERMUTATION,
+    TRACE_PAYLOAD_CYCLES,
+    TRACE_PAYLOAD_LEHMER,
+    TRACE_PAYLOAD_COUNT,
+};
+
+PRISONER_INTERNAL extern const char *const trace_payload_names[TRACE_PAYLOAD_COUNT];
+
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t payload;
+    uint32_t width;
+    uint32_t count;
+    uint32_t chances;
+    uint32_t warden;
+    uint32_t relabel;
+    uint32_t evaluator;
+    uint64_t seed;
+    uint64_t trials;
+};
+
+struct trace_block {
+    uint64_t chunk;
+    uint32_t records;
+    uint8_t *data;
+    size_t len;
+    size_t capacity;
+
+    // Room for whichever worker is filling the block to encode with, for Lehmer
+    // payloads.
+    unsigned int *scratch;
+
+    // The next block in whichever list this one is on.
+    struct trace_block *next;
+};
+
+struct trace_writer {
+    FILE *file;
+    struct trace_header header;
+    int error;
+
+    // The size of a Lehmer payload, if that is what is recorded.
+    size_t packed_len;
+
+    struct trace_block *blocks;
+    unsigned int blocks_len;
+
+    // Blocks waiting to be filled, and filled ones waiting to be written, oldest
+    // first.
+    struct trace_block *free;
+    struct trace_block *full;
+    struct trace_block *full_tail;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+    pthread_cond_t emptied;
+    bool closing;
+};
+
+// Whether runs of `config` can be traced: plain permutations without budgets,
+// which are the ones replay can re-evaluate with any evaluator.
+PRISONER_INTERNAL bool _trace_applies(const prisoner_config *config);
+
+// Creates `path`, writes the header and starts the writer thread, with buffers
+// for `threads` workers. Returns 0 or an errno value.
+PRISONER_INTERNAL int _trace_open(
+    struct trace_writer *writer,
+    const char *path,
+    const prisoner_config *config,
+    enum evaluator evaluator,
+    enum trace_payload payload,
+    uint64_t seed,
+    uint64_t trials,
+    unsigned int threads
+);
+
+// Runs and records one chunk's trials on `ctx`, which must already be seeded
+// for it, and returns how many were won.
+PRISONER_INTERNAL uint64_t _trace_chunk(
+    struct trace_writer *writer,
+    prisoner_ctx *ctx,
+    uint64_t chunk,
+    uint64_t trials
+);
+
+// Writes out everything still buffered and closes the file. Returns 0 or the
+// first error any write hit.
+PRISONER_INTERNAL int _trace_close(struct trace_writer *writer);
+
+struct replay_summary {
+    uint64_t trials;
+    uint64_t outcome_differences;
+    uint64_t arrangement_differences;
+};
+
+// Replays every trial in the trace at `path` with `evaluator`, comparing each
+// outcome, and the arrangement where the trace has one, with what was recorded.
+// Describes up to `max_shown` differences on `log`. Returns 0 or an errno
+// value, EINVAL for a file that is not a trace this build can read.
+PRISONER_INTERNAL int _trace_replay(
+    const char *path,
+    enum evaluator evaluator,
+    FILE *log,
+    unsigned int max_shown,
+    struct trace_header *header,
+    struct replay_summary *summary
+);
+
+#endif
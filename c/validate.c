@@ -0,0 +1,846 @@
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <float.h>
+#include <stdio.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "prisoner.h"
+#include "engine.h"
+#include "options.h"
+
+
+// Statistical checks that the library's permutation generators are uniform, so
+// that faster kernels can replace them without quietly skewing every result.
+// Each test draws many samples from a generator, bins some statistic of them,
+// and compares the counts with the exact distribution that statistic has over
+// uniformly random permutations, using Pearson's chi-square test:
+//  - permutation: which of the n! permutations came up, for a tiny n.
+//  - position: which slip landed in which box, for a small n.
+//  - cycles: how many loops there are, against the unsigned Stirling numbers of
+//    the first kind.
+//  - longest: how long the longest loop is, which decides every trial.
+//  - range: where _generate_range's values fall, for small bounds and for one
+//    just large enough that reducing by a modulo plainly favours low values.
+//    That one is expected to fail, showing the test can, and does not count
+//    towards the exit status.
+// Samples are drawn in seeded chunks across threads, so the counts depend only
+// on the seed and not on the number of threads.
+
+#define CHUNK_SAMPLES 65536
+#define MAX_THREADS 1024
+
+#define PERMUTATION_SIZE 6
+#define POSITION_SIZE 16
+
+// Bins expected to hold fewer samples than this are merged with their
+// neighbours, where the chi-square approximation would otherwise break down.
+#define MIN_EXPECTED 5.0
+
+struct range_bound {
+    uint64_t bound;
+    bool biased;
+};
+
+// The range test's bounds. The last is 3 * 2^30, so a 32-bit value reduced
+// modulo it lands in the lowest third twice as often as anywhere else.
+static const struct range_bound range_bounds[] = {
+    {6, false},
+    {1000, false},
+    {3221225472u, true},
+};
+
+#define RANGE_BINS 64
+
+struct generator {
+    const char *name;
+    prisoner_warden warden;
+    bool relabel;
+    bool by_default;
+};
+
+static const struct generator generators[] = {
+    // A Fisher-Yates shuffle of the previous arrangement.
+    {"shuffle", PRISONER_WARDEN_RANDOM, false, true},
+    // The warden's single loop, composed with a secret random relabeling.
+    {"relabel", PRISONER_WARDEN_CYCLE, true, true},
+    // The same loop, relabeled by a warden who knows the relabeling: never
+    // uniform, so it shows the tests can fail.
+    {"leaked", PRISONER_WARDEN_LEAKED, true, false},
+};
+
+#define GENERATOR_COUNT (sizeof(generators) / sizeof(generators[0]))
+
+struct test_case;
+
+struct test {
+    const char *name;
+    bool uses_generator;
+
+    // How many bins a sample of `size` falls into, and how many degrees of
+    // freedom the fixed totals take away.
+    unsigned int (*bins)(uint64_t size);
+    unsigned int (*constraints)(uint64_t size);
+
+    // What Pearson's statistic is multiplied by to follow the chi-square
+    // distribution, or NULL where it already does.
+    double (*scale)(uint64_t size);
+
+    // Draws one sample and counts it.
+    void (*observe)(prisoner_ctx *ctx, const struct test_case *test_case, uint64_t *counts);
+
+    // Fills in the probability of each bin for one sample.
+    void (*expect)(const struct test_case *test_case, double *probabilities);
+};
+
+struct test_case {
+    const struct test *test;
+    const struct generator *generator;
+    uint64_t size;
+    unsigned int bins;
+
+    // Mixed into the seed with _chunk_seed, so that each case draws its own
+    // samples whichever others run with it, and nearby seeds share none.
+    uint64_t stream;
+
+    // Whether the case is meant to fail, so its result is only reported.
+    bool expect_failure;
+
+    uint64_t *counts;
+    double statistic;
+    unsigned int df;
+    double p_value;
+};
+
+struct job {
+    const struct test_case *test_case;
+    uint64_t seed;
+    uint64_t samples;
+    uint64_t chunks;
+    atomic_uint_fast64_t next_chunk;
+
+    pthread_mutex_t lock;
+    uint64_t *counts;
+    int error;
+};
+
+
+static uint64_t _factorial(uint64_t n) {
+    return n <= 1 ? 1 : n * _factorial(n - 1);
+}
+
+
+static unsigned int _one_constraint(uint64_t size) {
+    return 1;
+}
+
+
+static unsigned int _permutation_bins(uint64_t size) {
+    return (unsigned int) _factorial(size);
+}
+
+
+// The permutation's index in lexicographic order, from its Lehmer code.
+static void _observe_permutation(
+    prisoner_ctx *ctx,
+    const struct test_case *test_case,
+    uint64_t *counts
+) {
+    unsigned int n = (unsigned int) test_case->size, rank = 0;
+
+    _arrange_boxes(ctx);
+
+    for (unsigned int i = 0; i < n; i++) {
+        unsigned int smaller = 0;
+
+        for (unsigned int j = i + 1; j < n; j++) {
+            smaller += ctx->boxes[j] < ctx->boxes[i];
+        }
+
+        rank = rank * (n - i) + smaller;
+    }
+
+    counts[rank]++;
+}
+
+
+static void _expect_uniform(const struct test_case *test_case, double *probabilities) {
+    for (unsigned int i = 0; i < test_case->bins; i++) {
+        probabilities[i] = 1.0 / test_case->bins;
+    }
+}
+
+
+static unsigned int _position_bins(uint64_t size) {
+    return (unsigned int) (size * size);
+}
+
+
+// Every row and every column of the table of slips by box has a fixed total.
+static unsigned int _position_constraints(uint64_t size) {
+    return (unsigned int) (2 * size - 1);
+}
+
+
+// A sample adds a whole permutation to the table rather than a single count, so
+// the cells are not multinomial: Pearson's statistic comes out n / (n - 1) times
+// a chi-square variable with (n - 1)^2 degrees of freedom.
+static double _position_scale(uint64_t size) {
+    return (double) (size - 1) / size;
+}
+
+
+// Each sample puts one slip in every box, so every cell of the table is hit with
+// probability 1/n per sample, and the probabilities sum to n rather than 1.
+static void _expect_position(const struct test_case *test_case, double *probabilities) {
+    for (unsigned int i = 0; i < test_case->bins; i++) {
+        probabilities[i] = 1.0 / test_case->size;
+    }
+}
+
+
+static void _observe_position(
+    prisoner_ctx *ctx,
+    const struct test_case *test_case,
+    uint64_t *counts
+) {
+    unsigned int n = (unsigned int) test_case->size;
+
+    _arrange_boxes(ctx);
+
+    for (unsigned int box = 0; box < n; box++) {
+        counts[box * n + ctx->boxes[box]]++;
+    }
+}
+
+
+static unsigned int _size_bins(uint64_t size) {
+    return (unsigned int) size;
+}
+
+
+static void _observe_cycles(
+    prisoner_ctx *ctx,
+    const struct test_case *test_case,
+    uint64_t *counts
+) {
+    _arrange_boxes(ctx);
+    counts[_cycle_lengths(ctx) - 1]++;
+}
+
+
+// P(k loops) = |s(n, k)| / n!, built up one element at a time: the new element
+// either closes a loop of its own or joins one of the n - 1 others' loops.
+static void _expect_cycles(const struct test_case *test_case, double *probabilities) {
+    unsigned int n = (unsigned int) test_case->size;
+
+    memset(probabilities, 0, n * sizeof(double));
+    probabilities[0] = 1;
+
+    for (unsigned int m = 2; m <= n; m++) {
+        for (unsigned int k = m - 1; k > 0; k--) {
+            probabilities[k] = (probabilities[k] * (m - 1) + probabilities[k - 1]) / m;
+        }
+
+        probabilities[0] = probabilities[0] * (m - 1) / m;
+    }
+}
+
+
+static void _observe_longest(
+    prisoner_ctx *ctx,
+    const struct test_case *test_case,
+    uint64_t *counts
+) {
+    _arrange_boxes(ctx);
+    counts[_longest_loop(ctx) - 1]++;
+}
+
+
+// The probability that no loop is longer than `chances`. Summing over the length
+// of the loop through the first box gives
+// a(n) = (1/n) * sum(a(n - k) for k in 1..min(chances, n)), with a(0) = 1.
+static double _no_loop_longer(unsigned int n, unsigned int chances, double *a) {
+    double window = 1;
+
+    a[0] = 1;
+
+    // `window` is the sum of the last `chances` values of a.
+    for (unsigned int m = 1; m <= n; m++) {
+        a[m] = window / m;
+        window += a[m];
+
+        if (m >= chances) {
+            window -= a[m - chances];
+        }
+    }
+
+    return a[n];
+}
+
+
+static void _expect_longest(const struct test_case *test_case, double *probabilities) {
+    unsigned int n = (unsigned int) test_case->size;
+    double *scratch = malloc((n + 1) * sizeof(double)), below = 0;
+
+    if (scratch == NULL) {
+        memset(probabilities, 0, n * sizeof(double));
+        return;
+    }
+
+    for (unsigned int longest = 1; longest <= n; longest++) {
+        double at_most = _no_loop_longer(n, longest, scratch);
+
+        probabilities[longest - 1] = at_most - below;
+        below = at_most;
+    }
+
+    free(scratch);
+}
+
+
+static unsigned int _range_bins(uint64_t size) {
+    return size < RANGE_BINS ? (unsigned int) size : RANGE_BINS;
+}
+
+
+static void _observe_range(
+    prisoner_ctx *ctx,
+    const struct test_case *test_case,
+    uint64_t *counts
+) {
+    uint64_t value = _generate_range(&ctx->rng, (unsigned int) test_case->size);
+
+    counts[value * test_case->bins / test_case->size]++;
+}
+
+
+// Bin `b` holds the values v with floor(v * bins / size) == b.
+static void _expect_range(const struct test_case *test_case, double *probabilities) {
+    uint64_t size = test_case->size, bins = test_case->bins;
+
+    for (uint64_t bin = 0; bin < bins; bin++) {
+        uint64_t low = (bin * size + bins - 1) / bins;
+        uint64_t high = ((bin + 1) * size + bins - 1) / bins;
+
+        probabilities[bin] = (double) (high - low) / size;
+    }
+}
+
+
+static const struct test tests[] = {
+    {
+        "permutation", true, _permutation_bins, _one_constraint, NULL,
+        _observe_permutation, _expect_uniform,
+    },
+    {
+        "position", true, _position_bins, _position_constraints, _position_scale,
+        _observe_position, _expect_position,
+    },
+    {"cycles", true, _size_bins, _one_constraint, NULL, _observe_cycles, _expect_cycles},
+    {"longest", true, _size_bins, _one_constraint, NULL, _observe_longest, _expect_longest},
+    {"range", false, _range_bins, _one_constraint, NULL, _observe_range, _expect_range},
+};
+
+#define TEST_COUNT (sizeof(tests) / sizeof(tests[0]))
+
+
+// The regularized upper incomplete gamma function Q(a, x), by its series below
+// a + 1 and its continued fraction above, as in Numerical Recipes.
+static double _gamma_q(double a, double x) {
+    double prefix;
+
+    if (x <= 0) {
+        return 1;
+    }
+
+    prefix = exp(-x + a * log(x) - lgamma(a));
+
+    if (x < a + 1) {
+        double term = 1 / a, sum = term;
+
+        for (int n = 1; n < 100000 && fabs(term) > fabs(sum) * 1e-15; n++) {
+            term *= x / (a + n);
+            sum += term;
+        }
+
+        return 1 - prefix * sum;
+    }
+
+    double b = x + 1 - a, c = 1 / DBL_MIN, d = 1 / b, fraction = d;
+
+    for (int n = 1; n < 100000; n++) {
+        double an = -n * (n - a), delta;
+
+        b += 2;
+        d = an * d + b;
+        c = b + an / c;
+        d = fabs(d) < DBL_MIN ? 1 / DBL_MIN : 1 / d;
+        c = fabs(c) < DBL_MIN ? DBL_MIN : c;
+        delta = d * c;
+        fraction *= delta;
+
+        if (fabs(delta - 1) < 1e-15) {
+            break;
+        }
+    }
+
+    return prefix * fraction;
+}
+
+
+// Pearson's statistic over the bins, after merging each run of adjacent bins
+// until it is expected to hold enough samples. Returns false if out of memory.
+static bool _chi_square(struct test_case *test_case, const double *probabilities, uint64_t samples) {
+    double *expected = calloc(test_case->bins, sizeof(double));
+    double *observed = calloc(test_case->bins, sizeof(double));
+    unsigned int groups = 0;
+    double statistic = 0;
+
+    if (expected == NULL || observed == NULL) {
+        free(expected);
+        free(observed);
+        return false;
+    }
+
+    for (unsigned int bin = 0; bin < test_case->bins; bin++) {
+        expected[groups] += probabilities[bin] * samples;
+        observed[groups] += test_case->counts[bin];
+
+        if (expected[groups] >= MIN_EXPECTED) {
+            groups++;
+        }
+    }
+
+    // A thin tail left over joins the last group that was full enough.
+    if (groups < test_case->bins && (expected[groups] > 0 || observed[groups] > 0)) {
+        if (groups > 0) {
+            expected[groups - 1] += expected[groups];
+            observed[groups - 1] += observed[groups];
+        } else {
+            groups = 1;
+        }
+    }
+
+    for (unsigned int group = 0; group < groups; group++) {
+        double difference = observed[group] - expected[group];
+
+        if (expected[group] > 0) {
+            statistic += difference * difference / expected[group];
+        } else if (observed[group] > 0) {
+            // Something that cannot happen did.
+            statistic = INFINITY;
+        }
+    }
+
+    unsigned int constraints = test_case->test->constraints(test_case->size);
+
+    if (test_case->test->scale != NULL) {
+        statistic *= test_case->test->scale(test_case->size);
+    }
+
+    test_case->statistic = statistic;
+    test_case->df = groups > constraints ? groups - constraints : 1;
+    test_case->p_value = isinf(statistic) ? 0 : _gamma_q(test_case->df / 2.0, statistic / 2);
+
+    free(expected);
+    free(observed);
+
+    return true;
+}
+
+
+static void *_worker_main(void *arg) {
+    struct job *job = arg;
+    const struct test_case *test_case = job->test_case;
+    prisoner_config config = prisoner_config_default();
+    uint64_t *counts = calloc(test_case->bins, sizeof(uint64_t));
+    prisoner_ctx *ctx;
+
+    // The range test only needs a generator state, which any context has.
+    config.count = test_case->test->uses_generator ? (unsigned int) test_case->size : 1;
+    config.chances = config.count;
+
+    if (test_case->generator != NULL) {
+        config.warden = test_case->generator->warden;
+        config.relabel = test_case->generator->relabel;
+    }
+
+    ctx = prisoner_create(&config);
+
+    if (ctx == NULL || counts == NULL) {
+        pthread_mutex_lock(&job->lock);
+        job->error = ctx == NULL ? errno : ENOMEM;
+        pthread_mutex_unlock(&job->lock);
+        prisoner_destroy(ctx);
+        free(counts);
+        return NULL;
+    }
+
+    for (;;) {
+        uint64_t chunk = atomic_fetch_add_explicit(&job->next_chunk, 1, memory_order_relaxed);
+
+        if (chunk >= job->chunks) {
+            break;
+        }
+
+        uint64_t first = chunk * CHUNK_SAMPLES;
+        uint64_t samples = job->samples - first < CHUNK_SAMPLES
+            ? job->samples - first
+            : CHUNK_SAMPLES;
+
+        prisoner_seed(ctx, _chunk_seed(job->seed, chunk));
+
+        for (uint64_t i = 0; i < samples; i++) {
+            test_case->test->observe(ctx, test_case, counts);
+        }
+    }
+
+    pthread_mutex_lock(&job->lock);
+
+    for (unsigned int bin = 0; bin < test_case->bins; bin++) {
+        job->counts[bin] += counts[bin];
+    }
+
+    pthread_mutex_unlock(&job->lock);
+
+    prisoner_destroy(ctx);
+    free(counts);
+
+    return NULL;
+}
+
+
+// Draws the samples for one test case on `threads` threads and tests them.
+// Returns 0 or an errno value.
+static int _run_case(
+    struct test_case *test_case,
+    uint64_t samples,
+    uint64_t seed,
+    unsigned int threads
+) {
+    struct job job = {
+        .test_case = test_case,
+        .seed = seed,
+        .samples = samples,
+        .chunks = (samples + CHUNK_SAMPLES - 1) / CHUNK_SAMPLES,
+        .counts = test_case->counts,
+    };
+    pthread_t workers[MAX_THREADS];
+    unsigned int started = 0;
+    double *probabilities = malloc(test_case->bins * sizeof(double));
+
+    if (probabilities == NULL) {
+        return ENOMEM;
+    }
+
+    atomic_init(&job.next_chunk, 0);
+    pthread_mutex_init(&job.lock, NULL);
+
+    if (threads > job.chunks) {
+        threads = (unsigned int) job.chunks;
+    }
+
+    for (; started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, _worker_main, &job) != 0) {
+            break;
+        }
+    }
+
+    for (unsigned int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    pthread_mutex_destroy(&job.lock);
+
+    if (started == 0) {
+        job.error = EAGAIN;
+    }
+
+    if (job.error == 0) {
+        test_case->test->expect(test_case, probabilities);
+
+        if (!_chi_square(test_case, probabilities, samples)) {
+            job.error = ENOMEM;
+        }
+    }
+
+    free(probabilities);
+
+    return job.error;
+}
+
+
+static bool _parse_names(
+    const char *arg,
+    const char *const *names,
+    size_t names_len,
+    bool *selected
+) {
+    const char *token = arg;
+
+    memset(selected, false, names_len * sizeof(bool));
+
+    for (;;) {
+        size_t len = strcspn(token, ",");
+        bool found = false;
+
+        for (size_t i = 0; i < names_len; i++) {
+            if (strlen(names[i]) == len && strncmp(names[i], token, len) == 0) {
+                selected[i] = found = true;
+            }
+        }
+
+        if (!found) {
+            return false;
+        }
+
+        if (token[len] == '\0') {
+            return true;
+        }
+
+        token += len + 1;
+    }
+}
+
+
+static void _usage(const char *name) {
+    fprintf(
+        stderr,
+        "usage: %s [options]\n"
+        "Tests that the permutation generators are uniform with chi-square tests\n"
+        "against exact distributions, and exits with status 1 if any fails.\n"
+        "\n"
+        "  -T, --tests LIST     comma-separated tests to run: permutation,\n"
+        "                       position, cycles, longest, range (default: all)\n"
+        "  -g, --generators LIST\n"
+        "                       comma-separated generators: shuffle, relabel, or\n"
+        "                       leaked, which is never uniform (default:\n"
+        "                       shuffle,relabel)\n"
+        "  -n, --prisoners N    permutation size for the cycles and longest tests\n"
+        "                       (default: 100)\n"
+        "  -s, --samples N      samples per test and generator (default: 10000000)\n"
+        "  -a, --alpha P        family-wise significance level, split evenly\n"
+        "                       across the tests (default: 0.001)\n"
+        "  -t, --threads N      worker threads, or 0 for one per CPU (default: 0)\n"
+        "      --seed N         seed for the random number generator (default: 0)\n",
+        name
+    );
+}
+
+
+int main(int argc, char **argv) {
+    const char *test_names[TEST_COUNT], *generator_names[GENERATOR_COUNT];
+    bool selected_tests[TEST_COUNT], selected_generators[GENERATOR_COUNT];
+    unsigned int prisoners = 100, threads = 0;
+    uint64_t samples = 10 * 1000 * 1000, seed = 0;
+    double alpha = 0.001;
+    int option;
+
+    enum {
+        OPTION_SEED = 256,
+    };
+
+    static const struct option options[] = {
+        {"tests", required_argument, NULL, 'T'},
+        {"generators", required_argument, NULL, 'g'},
+        {"prisoners", required_argument, NULL, 'n'},
+        {"samples", required_argument, NULL, 's'},
+        {"alpha", required_argument, NULL, 'a'},
+        {"threads", required_argument, NULL, 't'},
+        {"seed", required_argument, NULL, OPTION_SEED},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    for (size_t i = 0; i < TEST_COUNT; i++) {
+        test_names[i] = tests[i].name;
+        selected_tests[i] = true;
+    }
+
+    for (size_t i = 0; i < GENERATOR_COUNT; i++) {
+        generator_names[i] = generators[i].name;
+        selected_generators[i] = generators[i].by_default;
+    }
+
+    while ((option = getopt_long(argc, argv, "T:g:n:s:a:t:h", options, NULL)) != -1) {
+        bool valid = true;
+
+        switch (option) {
+            case 'T':
+                valid = _parse_names(optarg, test_names, TEST_COUNT, selected_tests);
+                break;
+            case 'g':
+                valid = _parse_names(
+                    optarg, generator_names, GENERATOR_COUNT, selected_generators
+                );
+                break;
+            case 'n':
+                // The expected distributions take quadratic time to work out.
+                valid = _parse_uint(optarg, &prisoners) && prisoners > 1 && prisoners <= 10000;
+                break;
+            case 's':
+                valid = _parse_uint64(optarg, &samples) && samples > 0;
+                break;
+            case 'a':
+                valid = _parse_double(optarg, &alpha) && alpha > 0 && alpha < 1;
+                break;
+            case 't':
+                valid = _parse_uint(optarg, &threads) && threads <= MAX_THREADS;
+                break;
+            case OPTION_SEED:
+                valid = _parse_uint64(optarg, &seed);
+                break;
+            case 'h':
+                _usage(argv[0]);
+                return 0;
+            default:
+                valid = false;
+                optarg = NULL;
+                break;
+        }
+
+        if (!valid) {
+            if (optarg != NULL) {
+                fprintf(stderr, "%s: invalid value '%s'\n", argv[0], optarg);
+            }
+
+            _usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online <= 0 ? 1 : online > MAX_THREADS ? MAX_THREADS : (unsigned int) online;
+    }
+
+    // One case per test and generator, or per bound for the range test.
+    struct test_case cases[TEST_COUNT * (GENERATOR_COUNT + 3)];
+    size_t cases_len = 0;
+
+    for (size_t i = 0; i < TEST_COUNT; i++) {
+        const struct test *test = &tests[i];
+
+        if (!selected_tests[i]) {
+            continue;
+        }
+
+        if (!test->uses_generator) {
+            for (size_t j = 0; j < sizeof(range_bounds) / sizeof(range_bounds[0]); j++) {
+                cases[cases_len++] = (struct test_case) {
+                    .test = test,
+                    .size = range_bounds[j].bound,
+                    .stream = i * 16 + j,
+                    .expect_failure = range_bounds[j].biased,
+                };
+            }
+
+            continue;
+        }
+
+        for (size_t j = 0; j < GENERATOR_COUNT; j++) {
+            if (selected_generators[j]) {
+                cases[cases_len++] = (struct test_case) {
+                    .test = test,
+                    .generator = &generators[j],
+                    .size = strcmp(test->name, "permutation") == 0 ? PERMUTATION_SIZE
+                        : strcmp(test->name, "position") == 0 ? POSITION_SIZE
+                        : prisoners,
+                    .stream = i * 16 + j,
+                };
+            }
+        }
+    }
+
+    size_t counted = 0;
+
+    for (size_t i = 0; i < cases_len; i++) {
+        counted += !cases[i].expect_failure;
+    }
+
+    // Bonferroni, so that all of them pass together with probability 1 - alpha
+    // when every generator is uniform.
+    double threshold = alpha / (counted > 0 ? counted : 1);
+    unsigned int passed = 0, expected_failures = 0;
+
+    printf(
+        "%-12s  %-9s  %10s  %12s  %6s  %14s  %10s  %s\n",
+        "test", "generator", "size", "samples", "df", "chi-square", "p-value", "result"
+    );
+
+    for (size_t i = 0; i < cases_len; i++) {
+        struct test_case *test_case = &cases[i];
+
+        test_case->bins = test_case->test->bins(test_case->size);
+        test_case->counts = calloc(test_case->bins, sizeof(uint64_t));
+
+        int error = test_case->counts == NULL
+            ? ENOMEM
+            : _run_case(test_case, samples, _chunk_seed(seed, test_case->stream), threads);
+
+        if (error != 0) {
+            fprintf(
+                stderr,
+                "%s: %s failed: %s\n",
+                argv[0],
+                test_case->test->name,
+                strerror(error)
+            );
+            free(test_case->counts);
+            return 1;
+        }
+
+        bool pass = test_case->p_value >= threshold;
+        const char *result = pass ? "pass" : "FAIL";
+
+        if (test_case->expect_failure) {
+            result = pass ? "pass (expected to fail)" : "fail (expected)";
+            expected_failures += !pass;
+        } else {
+            passed += pass;
+        }
+
+        printf(
+            "%-12s  %-9s  %10llu  %12llu  %6u  %14.2f  %10.4g  %s\n",
+            test_case->test->name,
+            test_case->generator != NULL ? test_case->generator->name : "-",
+            (unsigned long long) test_case->size,
+            (unsigned long long) samples,
+            test_case->df,
+            test_case->statistic,
+            test_case->p_value,
+            result
+        );
+        fflush(stdout);
+        free(test_case->counts);
+    }
+
+    printf(
+        "%u of %zu passed at a family-wise alpha of %g (%.3g each)",
+        passed,
+        counted,
+        alpha,
+        threshold
+    );
+
+    if (counted < cases_len) {
+        printf(
+            ", and %u of %zu meant to fail did",
+            expected_failures,
+            cases_len - counted
+        );
+    }
+
+    printf("\n");
+
+    return passed == counted ? 0 : 1;
+}
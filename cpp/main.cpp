@@ -0,0 +1,160 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include "prisoner.hpp"
+
+namespace {
+
+struct options {
+    std::size_t prisoners = 100;
+    std::size_t chances = 50;
+    std::uint64_t iterations = 1'000'000;
+    std::uint64_t seed = static_cast<std::uint64_t>(std::time(nullptr));
+    std::string version = "solved";
+    std::string visited = "bytes";
+};
+
+void usage(const char *name) {
+    std::fprintf(
+        stderr,
+        "usage: %s [options]\n"
+        "  -p, --prisoners N    number of prisoners and boxes (default: 100)\n"
+        "  -c, --chances N      boxes each prisoner may open (default: 50)\n"
+        "  -i, --iterations N   number of trials to run (default: 1000000)\n"
+        "  -v, --version NAME   strategy: solved or naive (default: solved)\n"
+        "      --visited NAME   how seen slips are tracked: bytes, bits or\n"
+        "                       epoch (default: bytes)\n"
+        "      --seed N         seed for the random number generator (default:\n"
+        "                       the current time)\n",
+        name
+    );
+}
+
+template <class Index, class Visited, class Strategy>
+std::uint64_t simulate(const options &opts) {
+    prisoner::simulation<Index, prisoner::xoshiro256, Visited, Strategy> sim(
+        opts.prisoners, opts.chances, opts.seed
+    );
+
+    return sim.run(opts.iterations);
+}
+
+// Each combination of policies is its own instantiation, chosen once here rather
+// than on every trial.
+template <class Index, class Visited>
+std::uint64_t simulate_strategy(const options &opts) {
+    if (opts.version == "naive") {
+        return simulate<Index, Visited, prisoner::random_strategy>(opts);
+    }
+
+    return simulate<Index, Visited, prisoner::loop_strategy>(opts);
+}
+
+template <class Index>
+std::uint64_t simulate_visited(const options &opts) {
+    if (opts.visited == "bits") {
+        return simulate_strategy<Index, prisoner::bit_visited>(opts);
+    } else if (opts.visited == "epoch") {
+        return simulate_strategy<Index, prisoner::epoch_visited>(opts);
+    }
+
+    return simulate_strategy<Index, prisoner::byte_visited>(opts);
+}
+
+std::uint64_t simulate_index(const options &opts) {
+    if (opts.prisoners <= 1u << 8) {
+        return simulate_visited<std::uint8_t>(opts);
+    } else if (opts.prisoners <= 1u << 16) {
+        return simulate_visited<std::uint16_t>(opts);
+    }
+
+    return simulate_visited<std::uint32_t>(opts);
+}
+
+bool parse(int argc, char **argv, options &opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            return false;
+        }
+
+        if (i + 1 == argc) {
+            std::fprintf(stderr, "%s: missing value for '%s'\n", argv[0], argv[i]);
+            return false;
+        }
+
+        const char *value = argv[++i];
+
+        try {
+            if (arg == "-p" || arg == "--prisoners") {
+                opts.prisoners = std::stoull(value);
+            } else if (arg == "-c" || arg == "--chances") {
+                opts.chances = std::stoull(value);
+            } else if (arg == "-i" || arg == "--iterations") {
+                opts.iterations = std::stoull(value);
+            } else if (arg == "--seed") {
+                opts.seed = std::stoull(value);
+            } else if (arg == "-v" || arg == "--version") {
+                opts.version = value;
+
+                if (opts.version != "solved" && opts.version != "naive") {
+                    std::fprintf(stderr, "%s: unknown strategy '%s'\n", argv[0], value);
+                    return false;
+                }
+            } else if (arg == "--visited") {
+                opts.visited = value;
+
+                if (opts.visited != "bytes" && opts.visited != "bits" && opts.visited != "epoch") {
+                    std::fprintf(stderr, "%s: unknown tracking '%s'\n", argv[0], value);
+                    return false;
+                }
+            } else {
+                std::fprintf(stderr, "%s: unknown option '%s'\n", argv[0], argv[i - 1]);
+                return false;
+            }
+        } catch (const std::exception &) {
+            std::fprintf(stderr, "%s: invalid value '%s'\n", argv[0], value);
+            return false;
+        }
+    }
+
+    return opts.prisoners > 0 && opts.iterations > 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    options opts;
+
+    if (!parse(argc, argv, opts)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::uint64_t wins;
+
+    try {
+        wins = simulate_index(opts);
+    } catch (const std::invalid_argument &error) {
+        std::fprintf(stderr, "%s: %s\n", argv[0], error.what());
+        return 1;
+    }
+
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+    std::printf(
+        "complete in %.3f seconds! of %llu runs, %llu were successful (%.2f%%)\n",
+        duration.count(),
+        static_cast<unsigned long long>(opts.iterations),
+        static_cast<unsigned long long>(wins),
+        (static_cast<double>(wins) / static_cast<double>(opts.iterations)) * 100
+    );
+
+    return 0;
+}
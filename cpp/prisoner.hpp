@@ -0,0 +1,389 @@
+#ifndef PRISONER_HPP
+#define PRISONER_HPP
+
+// A header-only C++ port of the C simulator's `_generate_boxes` and
+// `run_optimized`. Everything is a template over small policy types, so a
+// caller's loop over `simulation::trial` compiles down to one specialised
+// shuffle and walk, with no virtual calls or function pointers in between.
+// With `xoshiro256`, a simulation seeded with `s` shuffles the same arrangements
+// as a libprisoner context after `prisoner_seed(ctx, s)`.
+//
+// The policies are:
+//  - Index: the unsigned integer type stored in each box. Narrower types mean
+//    less memory traffic, as long as the count fits.
+//  - Rng: anything satisfying std::uniform_random_bit_generator with 64-bit
+//    output, such as `xoshiro256` below or std::mt19937_64.
+//  - Visited: how the prisoners remember which slips they have already seen;
+//    see `byte_visited`, `bit_visited` and `epoch_visited`.
+//  - Strategy: how each prisoner chooses the boxes to open; see
+//    `loop_strategy` and `random_strategy`.
+
+#include <algorithm>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace prisoner {
+
+// xoshiro256**, seeded through splitmix64, matching libprisoner's generator and
+// its seeding by prisoner_seed.
+class xoshiro256 {
+public:
+    using result_type = std::uint64_t;
+
+    explicit xoshiro256(std::uint64_t seed = 0) { this->seed(seed); }
+
+    void seed(std::uint64_t seed) {
+        for (auto &word : state_) {
+            seed += 0x9e3779b97f4a7c15;
+
+            std::uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    result_type operator()() {
+        std::uint64_t result = std::rotl(state_[1] * 5, 7) * 9;
+        std::uint64_t t = state_[1] << 17;
+
+        state_[2] ^= state_[0];
+        state_[3] ^= state_[1];
+        state_[1] ^= state_[2];
+        state_[0] ^= state_[3];
+        state_[2] ^= t;
+        state_[3] = std::rotl(state_[3], 45);
+
+        return result;
+    }
+
+private:
+    std::uint64_t state_[4];
+};
+
+template <class Rng>
+concept random_source = std::uniform_random_bit_generator<Rng>
+    && std::same_as<typename Rng::result_type, std::uint64_t>;
+
+// A value in [0, max), reduced exactly as libprisoner's `_generate_range` does,
+// so that the same seed shuffles the same arrangements in both.
+template <random_source Rng>
+inline std::uint32_t generate_range(Rng &rng, std::uint32_t max) {
+    return static_cast<std::uint32_t>((rng() >> 32) % max);
+}
+
+// Remembers seen slips in one byte each, cleared before every trial.
+class byte_visited {
+public:
+    void resize(std::size_t count) { seen_.assign(count, 0); }
+    void clear() { std::fill(seen_.begin(), seen_.end(), std::uint8_t{0}); }
+    bool test(std::size_t index) const { return seen_[index] != 0; }
+    void set(std::size_t index) { seen_[index] = 1; }
+
+private:
+    std::vector<std::uint8_t> seen_;
+};
+
+// Remembers seen slips in one bit each: an eighth of the memory to clear, for a
+// shift and mask on every access.
+class bit_visited {
+public:
+    void resize(std::size_t count) { words_.assign((count + 63) / 64, 0); }
+    void clear() { std::fill(words_.begin(), words_.end(), std::uint64_t{0}); }
+
+    bool test(std::size_t index) const {
+        return (words_[index / 64] >> (index % 64)) & 1;
+    }
+
+    void set(std::size_t index) {
+        words_[index / 64] |= std::uint64_t{1} << (index % 64);
+    }
+
+private:
+    std::vector<std::uint64_t> words_;
+};
+
+// Remembers seen slips by stamping them with the current trial's number, so
+// clearing is a single increment. The stamps are only wiped when the counter
+// wraps around.
+class epoch_visited {
+public:
+    void resize(std::size_t count) {
+        stamps_.assign(count, 0);
+        epoch_ = 0;
+    }
+
+    void clear() {
+        if (++epoch_ == 0) {
+            std::fill(stamps_.begin(), stamps_.end(), std::uint32_t{0});
+            epoch_ = 1;
+        }
+    }
+
+    bool test(std::size_t index) const { return stamps_[index] == epoch_; }
+    void set(std::size_t index) { stamps_[index] = epoch_; }
+
+private:
+    std::vector<std::uint32_t> stamps_;
+    std::uint32_t epoch_ = 0;
+};
+
+template <class Visited>
+concept visited_tracker = requires(Visited visited, const Visited cvisited, std::size_t i) {
+    visited.resize(i);
+    visited.clear();
+    visited.set(i);
+    { cvisited.test(i) } -> std::convertible_to<bool>;
+};
+
+// The Fisher-Yates shuffle from `_generate_boxes`.
+template <std::unsigned_integral Index, random_source Rng>
+inline void generate_boxes(std::span<Index> boxes, Rng &rng) {
+    // There is nothing to shuffle, and size() - 1 would wrap around.
+    if (boxes.size() < 2) {
+        return;
+    }
+
+    for (std::size_t i = boxes.size() - 1; i > 0; i--) {
+        std::size_t to_swap = generate_range(rng, static_cast<std::uint32_t>(i + 1));
+        Index left = boxes[i], right = boxes[to_swap];
+
+        boxes[to_swap] = left;
+        boxes[i] = right;
+    }
+}
+
+// The walk from `run_optimized`: each prisoner follows their loop, and any slip
+// already seen belongs to a loop that is known to be short enough.
+template <std::unsigned_integral Index, visited_tracker Visited>
+inline bool run_optimized(
+    std::span<const Index> boxes,
+    std::size_t chances,
+    Visited &slips_seen
+) {
+    std::size_t count = boxes.size();
+
+    slips_seen.clear();
+
+    for (std::size_t prisoner = 0; prisoner < count; prisoner++) {
+        std::size_t next_box = prisoner;
+
+        if (slips_seen.test(prisoner)) {
+            continue;
+        }
+
+        for (std::size_t i = 0; i <= chances; i++) {
+            if (i == chances) {
+                return false;
+            }
+
+            std::size_t slip = boxes[next_box];
+            slips_seen.set(slip);
+
+            if (slip == prisoner) {
+                break;
+            }
+
+            next_box = slip;
+        }
+    }
+
+    return true;
+}
+
+// The loop strategy from the README.
+struct loop_strategy {
+    void resize(std::size_t) {}
+
+    template <std::unsigned_integral Index, visited_tracker Visited, random_source Rng>
+    bool operator()(
+        std::span<const Index> boxes,
+        std::size_t chances,
+        Visited &slips_seen,
+        Rng &
+    ) {
+        return run_optimized(boxes, chances, slips_seen);
+    }
+};
+
+// Every prisoner opens `chances` distinct boxes at random. Only the first
+// `chances` steps of a Fisher-Yates shuffle are ever needed, and the game ends at
+// the first prisoner who misses.
+class random_strategy {
+public:
+    void resize(std::size_t count) {
+        order_.resize(count);
+
+        for (std::size_t i = 0; i < count; i++) {
+            order_[i] = static_cast<std::uint32_t>(i);
+        }
+    }
+
+    template <std::unsigned_integral Index, visited_tracker Visited, random_source Rng>
+    bool operator()(
+        std::span<const Index> boxes,
+        std::size_t chances,
+        Visited &,
+        Rng &rng
+    ) {
+        std::size_t count = boxes.size();
+
+        for (std::size_t prisoner = 0; prisoner < count; prisoner++) {
+            bool found = false;
+
+            for (std::size_t i = 0; i < chances && i < count && !found; i++) {
+                std::size_t pick = i + generate_range(
+                    rng, static_cast<std::uint32_t>(count - i)
+                );
+
+                std::swap(order_[i], order_[pick]);
+                found = boxes[order_[i]] == prisoner;
+            }
+
+            if (!found) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    std::vector<std::uint32_t> order_;
+};
+
+template <
+    std::unsigned_integral Index = std::uint32_t,
+    random_source Rng = xoshiro256,
+    visited_tracker Visited = byte_visited,
+    class Strategy = loop_strategy
+>
+class simulation {
+public:
+    simulation(std::size_t count, std::size_t chances, std::uint64_t seed = 0)
+        : count_(count), chances_(chances), rng_(seed), boxes_(count) {
+        if (count == 0) {
+            throw std::invalid_argument("there must be at least one prisoner");
+        }
+
+        if (count - 1 > std::numeric_limits<Index>::max()) {
+            throw std::invalid_argument("the index type is too narrow for this count");
+        }
+
+        if (count > std::numeric_limits<std::uint32_t>::max()) {
+            throw std::invalid_argument("count must fit in 32 bits");
+        }
+
+        // First, populate the boxes with their corresponding slip.
+        for (std::size_t slip = 0; slip < count; slip++) {
+            boxes_[slip] = static_cast<Index>(slip);
+        }
+
+        slips_seen_.resize(count);
+        strategy_.resize(count);
+    }
+
+    void seed(std::uint64_t seed) { rng_.seed(seed); }
+
+    std::size_t count() const { return count_; }
+    std::size_t chances() const { return chances_; }
+
+    // The current arrangement, which callers may also fill in themselves before
+    // calling `play`. `trial` shuffles whatever is there without checking it, so
+    // it must only ever hold slips below `count()`.
+    std::span<Index> boxes() { return boxes_; }
+    std::span<const Index> boxes() const { return boxes_; }
+
+    void generate_boxes() { prisoner::generate_boxes(std::span<Index>(boxes_), rng_); }
+
+    bool play() { return play(std::span<const Index>(boxes_)); }
+
+    // Plays `arrangement` rather than the simulation's own boxes. Every slip is
+    // used as an index, so one out of range throws rather than being followed.
+    bool play(std::span<const Index> arrangement) {
+        if (arrangement.size() != count_) {
+            throw std::invalid_argument("the arrangement must hold one slip per prisoner");
+        }
+
+        check_slips(arrangement);
+
+        return strategy_(arrangement, chances_, slips_seen_, rng_);
+    }
+
+    bool trial() {
+        generate_boxes();
+        return strategy_(std::span<const Index>(boxes_), chances_, slips_seen_, rng_);
+    }
+
+    // Plays one fresh game per element of `results` and returns how many were won.
+    std::uint64_t trial_batch(std::span<bool> results) {
+        std::uint64_t wins = 0;
+
+        for (bool &result : results) {
+            result = trial();
+            wins += result;
+        }
+
+        return wins;
+    }
+
+    // Plays every arrangement in `arrangements`, `count()` boxes at a time, and
+    // stores one outcome per arrangement in `results`.
+    std::uint64_t play_batch(std::span<const Index> arrangements, std::span<bool> results) {
+        if (arrangements.size() != results.size() * count_) {
+            throw std::invalid_argument("arrangements must hold one game per result");
+        }
+
+        check_slips(arrangements);
+
+        std::uint64_t wins = 0;
+
+        for (std::size_t i = 0; i < results.size(); i++) {
+            results[i] = strategy_(
+                arrangements.subspan(i * count_, count_), chances_, slips_seen_, rng_
+            );
+            wins += results[i];
+        }
+
+        return wins;
+    }
+
+    std::uint64_t run(std::uint64_t trials) {
+        std::uint64_t wins = 0;
+
+        for (std::uint64_t i = 0; i < trials; i++) {
+            wins += trial();
+        }
+
+        return wins;
+    }
+
+private:
+    void check_slips(std::span<const Index> slips) const {
+        if (std::ranges::any_of(slips, [this](Index slip) { return slip >= count_; })) {
+            throw std::invalid_argument("every slip must be less than the count");
+        }
+    }
+
+    std::size_t count_;
+    std::size_t chances_;
+    Rng rng_;
+    std::vector<Index> boxes_;
+    Visited slips_seen_;
+    Strategy strategy_;
+};
+
+}  // namespace prisoner
+
+#endif
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+#include "prisoner.hpp"
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char *what) {
+    if (!condition) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+template <class Function>
+bool throws_invalid_argument(Function function) {
+    try {
+        function();
+    } catch (const std::invalid_argument &) {
+        return true;
+    }
+
+    return false;
+}
+
+void test_play_rejects_out_of_range_slips() {
+    prisoner::simulation<std::uint8_t> sim(4, 2);
+    std::vector<std::uint8_t> arrangement = {1, 0, 4, 3};
+    std::vector<std::uint8_t> batch = {1, 0, 3, 2, 0, 1, 2, 200};
+    bool results[2];
+
+    check(
+        throws_invalid_argument([&] { sim.play(arrangement); }),
+        "play accepts a slip equal to the count"
+    );
+    check(
+        throws_invalid_argument([&] { sim.play_batch(batch, results); }),
+        "play_batch accepts a slip beyond the count"
+    );
+
+    auto boxes = sim.boxes();
+
+    boxes[0] = 9;
+    check(
+        throws_invalid_argument([&] { sim.play(); }),
+        "play accepts its own boxes with a slip beyond the count"
+    );
+
+    arrangement = {1, 0, 3, 2};
+    check(sim.play(arrangement), "two loops of two are not won with two chances");
+}
+
+void test_play_rejects_short_arrangements() {
+    prisoner::simulation<std::uint32_t> sim(4, 2);
+    std::vector<std::uint32_t> arrangement = {1, 0, 2};
+
+    check(
+        throws_invalid_argument([&] { sim.play(arrangement); }),
+        "play accepts an arrangement shorter than the count"
+    );
+}
+
+void test_generate_boxes_handles_empty_spans() {
+    prisoner::xoshiro256 rng(1);
+    std::vector<std::uint32_t> none, one = {0};
+
+    prisoner::generate_boxes(std::span<std::uint32_t>(none), rng);
+    prisoner::generate_boxes(std::span<std::uint32_t>(one), rng);
+    check(one[0] == 0, "shuffling a single box moves it");
+}
+
+// The first arrangement libprisoner shuffles for 10 boxes after prisoner_seed(1),
+// so that C++ runs can be checked against the C tool seed for seed.
+void test_generate_boxes_matches_libprisoner() {
+    prisoner::simulation<std::uint8_t> sim(10, 5, 1);
+    std::vector<std::uint8_t> expected = {8, 7, 9, 3, 2, 4, 0, 6, 1, 5};
+
+    sim.generate_boxes();
+    check(
+        std::ranges::equal(sim.boxes(), expected),
+        "the shuffle differs from libprisoner's for the same seed"
+    );
+}
+
+}  // namespace
+
+int main() {
+    test_play_rejects_out_of_range_slips();
+    test_play_rejects_short_arrangements();
+    test_generate_boxes_handles_empty_spans();
+    test_generate_boxes_matches_libprisoner();
+
+    if (failures > 0) {
+        return 1;
+    }
+
+    std::printf("all tests passed\n");
+
+    return 0;
+}
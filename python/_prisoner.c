@@ -0,0 +1,399 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prisoner.h"
+
+
+// Every entry point takes the same keyword arguments describing the game, which
+// mirror the C command line options.
+#define CONFIG_KEYWORDS \
+    "prisoners", "chances", "seed", "warden", "relabel", "boxes", "mapping", \
+    "budgets"
+
+struct config_args {
+    Py_ssize_t prisoners;
+    Py_ssize_t chances;
+    PyObject *seed;
+    const char *warden;
+    int relabel;
+    Py_ssize_t boxes;
+    const char *mapping;
+    PyObject *budgets;
+};
+
+
+static void _config_args_init(struct config_args *args) {
+    args->prisoners = 100;
+    args->chances = 50;
+    args->seed = Py_None;
+    args->warden = "random";
+    args->relabel = 0;
+    args->boxes = 0;
+    args->mapping = "permutation";
+    args->budgets = Py_None;
+}
+
+
+// Checks that a count parsed with "n" fits in an unsigned int, raising
+// ValueError if not.
+static bool _check_count(const char *name, Py_ssize_t value) {
+    if (value < 0) {
+        PyErr_Format(PyExc_ValueError, "%s must not be negative", name);
+        return false;
+    }
+
+    if ((size_t) value > UINT_MAX) {
+        PyErr_Format(PyExc_ValueError, "%s must be at most %u", name, UINT_MAX);
+        return false;
+    }
+
+    return true;
+}
+
+
+// Fills in `config` and `seed` from `args`. Any budgets are copied into a new
+// array stored in `budgets`, which the caller must free. Returns false with a
+// Python exception set if an argument is invalid.
+static bool _build_config(
+    const struct config_args *args,
+    prisoner_config *config,
+    uint64_t *seed,
+    unsigned int **budgets
+) {
+    *config = prisoner_config_default();
+    *budgets = NULL;
+
+    if (!_check_count("prisoners", args->prisoners)
+        || !_check_count("chances", args->chances)
+        || !_check_count("boxes", args->boxes)) {
+        return false;
+    }
+
+    config->count = (unsigned int) args->prisoners;
+    config->chances = (unsigned int) args->chances;
+    config->box_count = (unsigned int) args->boxes;
+    config->relabel = args->relabel != 0;
+
+    if (args->seed == Py_None) {
+        *seed = (uint64_t) time(NULL);
+    } else {
+        *seed = PyLong_AsUnsignedLongLongMask(args->seed);
+
+        if (PyErr_Occurred()) {
+            return false;
+        }
+    }
+
+    if (strcmp(args->warden, "random") == 0) {
+        config->warden = PRISONER_WARDEN_RANDOM;
+    } else if (strcmp(args->warden, "cycle") == 0) {
+        config->warden = PRISONER_WARDEN_CYCLE;
+    } else if (strcmp(args->warden, "leaked") == 0) {
+        config->warden = PRISONER_WARDEN_LEAKED;
+    } else {
+        PyErr_Format(PyExc_ValueError, "unknown warden '%s'", args->warden);
+        return false;
+    }
+
+    if (strcmp(args->mapping, "permutation") == 0) {
+        config->mapping = PRISONER_MAPPING_PERMUTATION;
+    } else if (strcmp(args->mapping, "function") == 0) {
+        config->mapping = PRISONER_MAPPING_FUNCTION;
+    } else {
+        PyErr_Format(PyExc_ValueError, "unknown mapping '%s'", args->mapping);
+        return false;
+    }
+
+    if (args->budgets != Py_None) {
+        PyObject *sequence = PySequence_Fast(args->budgets, "budgets must be a sequence");
+
+        if (sequence == NULL) {
+            return false;
+        }
+
+        if ((size_t) PySequence_Fast_GET_SIZE(sequence) != config->count) {
+            PyErr_Format(
+                PyExc_ValueError, "expected %u budgets, one per prisoner", config->count
+            );
+            Py_DECREF(sequence);
+            return false;
+        }
+
+        *budgets = PyMem_Malloc(config->count * sizeof(unsigned int));
+
+        if (*budgets == NULL) {
+            Py_DECREF(sequence);
+            PyErr_NoMemory();
+            return false;
+        }
+
+        for (unsigned int i = 0; i < config->count; i++) {
+            unsigned long budget = PyLong_AsUnsignedLong(
+                PySequence_Fast_GET_ITEM(sequence, i)
+            );
+
+            if (!PyErr_Occurred() && budget > UINT_MAX) {
+                PyErr_Format(PyExc_ValueError, "budgets must be at most %u", UINT_MAX);
+            }
+
+            if (PyErr_Occurred()) {
+                Py_DECREF(sequence);
+                PyMem_Free(*budgets);
+                *budgets = NULL;
+                return false;
+            }
+
+            (*budgets)[i] = (unsigned int) budget;
+        }
+
+        Py_DECREF(sequence);
+        config->budgets = *budgets;
+    }
+
+    return true;
+}
+
+
+static bool _check_trials(Py_ssize_t trials) {
+    if (trials < 0) {
+        PyErr_SetString(PyExc_ValueError, "trials must not be negative");
+        return false;
+    }
+
+    return true;
+}
+
+
+static PyObject *_raise_errno(int error) {
+    if (error == EINVAL) {
+        PyErr_SetString(PyExc_ValueError, "invalid combination of arguments");
+    } else if (error == ENOMEM) {
+        PyErr_NoMemory();
+    } else {
+        errno = error;
+        PyErr_SetFromErrno(PyExc_OSError);
+    }
+
+    return NULL;
+}
+
+
+PyDoc_STRVAR(
+    run_doc,
+    "run(trials, threads=0, prisoners=100, chances=50, seed=None, warden='random',\n"
+    "    relabel=False, boxes=0, mapping='permutation', budgets=None)\n"
+    "--\n\n"
+    "Play `trials` games across `threads` threads (0 for one per CPU) and return\n"
+    "the number won. The GIL is released while the games run."
+);
+
+static PyObject *prisoner_py_run(PyObject *self, PyObject *py_args, PyObject *kwargs) {
+    static char *keywords[] = {"trials", "threads", CONFIG_KEYWORDS, NULL};
+    Py_ssize_t trials, threads = 0;
+    struct config_args args;
+    prisoner_config config;
+    prisoner_results results;
+    unsigned int *budgets;
+    uint64_t seed;
+    int error;
+
+    _config_args_init(&args);
+
+    if (!PyArg_ParseTupleAndKeywords(
+        py_args, kwargs, "n|$nnnOspnsO", keywords,
+        &trials, &threads, &args.prisoners, &args.chances, &args.seed, &args.warden,
+        &args.relabel, &args.boxes, &args.mapping, &args.budgets
+    )) {
+        return NULL;
+    }
+
+    if (!_check_trials(trials) || !_check_count("threads", threads)) {
+        return NULL;
+    }
+
+    if (!_build_config(&args, &config, &seed, &budgets)) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    error = prisoner_run_parallel(
+        &config, seed, (uint64_t) trials, (unsigned int) threads, &results
+    );
+    Py_END_ALLOW_THREADS
+
+    PyMem_Free(budgets);
+
+    if (error != 0) {
+        return _raise_errno(error);
+    }
+
+    return PyLong_FromUnsignedLongLong(results.wins);
+}
+
+
+PyDoc_STRVAR(
+    batch_doc,
+    "batch(trials, prisoners=100, chances=50, seed=None, warden='random',\n"
+    "      relabel=False, boxes=0, mapping='permutation', budgets=None)\n"
+    "--\n\n"
+    "Play `trials` games on a single thread and return their outcomes as bytes,\n"
+    "one per game: 1 if it was won and 0 otherwise. The result can be viewed\n"
+    "without copying through numpy.frombuffer(result, dtype=bool)."
+);
+
+static PyObject *prisoner_py_batch(PyObject *self, PyObject *py_args, PyObject *kwargs) {
+    static char *keywords[] = {"trials", CONFIG_KEYWORDS, NULL};
+    Py_ssize_t trials;
+    struct config_args args;
+    prisoner_config config;
+    prisoner_ctx *ctx;
+    unsigned int *budgets;
+    uint64_t seed;
+    PyObject *outcomes;
+
+    _config_args_init(&args);
+
+    if (!PyArg_ParseTupleAndKeywords(
+        py_args, kwargs, "n|$nnOspnsO", keywords,
+        &trials, &args.prisoners, &args.chances, &args.seed, &args.warden,
+        &args.relabel, &args.boxes, &args.mapping, &args.budgets
+    )) {
+        return NULL;
+    }
+
+    if (!_check_trials(trials)) {
+        return NULL;
+    }
+
+    if (!_build_config(&args, &config, &seed, &budgets)) {
+        return NULL;
+    }
+
+    ctx = prisoner_create(&config);
+    PyMem_Free(budgets);
+
+    if (ctx == NULL) {
+        return _raise_errno(errno);
+    }
+
+    outcomes = PyBytes_FromStringAndSize(NULL, trials);
+
+    if (outcomes == NULL) {
+        prisoner_destroy(ctx);
+        return NULL;
+    }
+
+    // bool and char have the same size on every platform CPython supports, and
+    // the bytes object is not visible to any other thread until it is returned.
+    bool *results = (bool *) PyBytes_AS_STRING(outcomes);
+
+    Py_BEGIN_ALLOW_THREADS
+    prisoner_seed(ctx, seed);
+    prisoner_trial_batch(ctx, results, (size_t) trials);
+    Py_END_ALLOW_THREADS
+
+    prisoner_destroy(ctx);
+
+    return outcomes;
+}
+
+
+PyDoc_STRVAR(
+    sweep_doc,
+    "sweep(trials, threads=0, prisoners=100, seed=None, warden='random',\n"
+    "      relabel=False)\n"
+    "--\n\n"
+    "Play `trials` games across `threads` threads and return a list whose entry\n"
+    "`c` is the number of games that would have been won with `c` chances, for\n"
+    "every `c` from 0 to `prisoners`. The GIL is released while the games run."
+);
+
+static PyObject *prisoner_py_sweep(PyObject *self, PyObject *py_args, PyObject *kwargs) {
+    static char *keywords[] = {
+        "trials", "threads", "prisoners", "seed", "warden", "relabel", NULL
+    };
+    Py_ssize_t trials, threads = 0;
+    struct config_args args;
+    prisoner_config config;
+    unsigned int *budgets;
+    uint64_t seed, *wins;
+    PyObject *list;
+    int error;
+
+    _config_args_init(&args);
+
+    if (!PyArg_ParseTupleAndKeywords(
+        py_args, kwargs, "n|$nnOsp", keywords,
+        &trials, &threads, &args.prisoners, &args.seed, &args.warden, &args.relabel
+    )) {
+        return NULL;
+    }
+
+    if (!_check_trials(trials) || !_check_count("threads", threads)) {
+        return NULL;
+    }
+
+    if (!_build_config(&args, &config, &seed, &budgets)) {
+        return NULL;
+    }
+
+    wins = PyMem_Malloc(((size_t) config.count + 1) * sizeof(uint64_t));
+
+    if (wins == NULL) {
+        return PyErr_NoMemory();
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    error = prisoner_sweep(&config, seed, (uint64_t) trials, (unsigned int) threads, wins);
+    Py_END_ALLOW_THREADS
+
+    if (error != 0) {
+        PyMem_Free(wins);
+        return _raise_errno(error);
+    }
+
+    list = PyList_New(config.count + 1);
+
+    for (unsigned int chances = 0; list != NULL && chances <= config.count; chances++) {
+        PyObject *value = PyLong_FromUnsignedLongLong(wins[chances]);
+
+        if (value == NULL) {
+            Py_CLEAR(list);
+            break;
+        }
+
+        PyList_SET_ITEM(list, chances, value);
+    }
+
+    PyMem_Free(wins);
+
+    return list;
+}
+
+
+static PyMethodDef prisoner_methods[] = {
+    {"run", (PyCFunction) prisoner_py_run, METH_VARARGS | METH_KEYWORDS, run_doc},
+    {"batch", (PyCFunction) prisoner_py_batch, METH_VARARGS | METH_KEYWORDS, batch_doc},
+    {"sweep", (PyCFunction) prisoner_py_sweep, METH_VARARGS | METH_KEYWORDS, sweep_doc},
+    {NULL, NULL, 0, NULL},
+};
+
+static struct PyModuleDef prisoner_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "_prisoner",
+    .m_doc = "Bindings to libprisoner, the C implementation of the simulation.",
+    .m_size = -1,
+    .m_methods = prisoner_methods,
+};
+
+
+PyMODINIT_FUNC PyInit__prisoner(void) {
+    return PyModule_Create(&prisoner_module);
+}
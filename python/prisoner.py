@@ -1,11 +1,31 @@
+import argparse
 import random
-from typing import List
+import time
+from typing import List, Optional
+
+try:
+    # The C engine, built with `python setup.py build_ext --inplace`.
+    import _prisoner
+except ImportError:
+    _prisoner = None
+
+try:
+    import numpy as np
+except ImportError:
+    np = None
 
 BOXES = None
 
+# The vectorized path works through the trials this many boxes at a time. Its
+# handful of working arrays then come to a few hundred kilobytes, which stay in
+# the L2 cache across the repeated passes the pointer jumping makes over them.
+CHUNK_ELEMENTS = 1 << 14
+
+
+def run_optimized(count: int, chances: Optional[int] = None) -> bool:
+    if chances is None:
+        chances = int(count / 2)
 
-def run_optimized(count: int) -> bool:
-    chances = int(count / 2)
     random.shuffle(BOXES)
     slips_seen = [False for _ in range(count)]
 
@@ -30,14 +50,126 @@ def run_optimized(count: int) -> bool:
     return True
 
 
+def longest_loops_vectorized(count: int, trials: int, rng: 'np.random.Generator') -> 'np.ndarray':
+    """
+    Shuffles `trials` sets of `count` boxes at once, and returns the length of the
+    longest loop in each.
+
+    Each row of boxes is a permutation, given by the order that sorts a row of
+    random 64-bit keys. The low bits of each key are replaced by its column, so
+    sorting the keys themselves gives that order, faster than an argsort, and no
+    two keys in a row are ever equal for the sort to break a tie between.
+
+    Every box is then labelled with the smallest box number on its loop by
+    pointer jumping: each pass takes the minimum of a box's label and the label
+    `jump` boxes further along the loop, then doubles `jump` by composing the
+    permutation with itself. After log2(count) passes every label has seen the
+    whole loop, so counting the boxes with each label gives the loop lengths.
+    """
+    size = trials * count
+    mask = np.uint64((1 << max(1, (count - 1).bit_length())) - 1)
+    keys = rng.bit_generator.random_raw((trials, count))
+
+    keys &= ~mask
+    keys |= np.arange(count, dtype=np.uint64)
+    keys.sort(axis=1)
+    keys &= mask
+
+    # Flatten the rows into one array so that each pass is a single gather, with
+    # every row's box numbers offset to point within its own row.
+    jump = keys.view(np.intp)
+    jump += np.arange(trials, dtype=np.intp)[:, None] * count
+    jump = jump.ravel()
+    labels = np.arange(size, dtype=np.intp)
+    distance = 1
+
+    while distance < count:
+        np.minimum(labels, labels[jump], out=labels)
+        distance *= 2
+
+        # The last pass has no use for a longer jump.
+        if distance < count:
+            jump = jump[jump]
+
+    lengths = np.bincount(labels, minlength=size).reshape(trials, count)
+
+    return lengths.max(axis=1)
+
+
+def run_vectorized(
+    count: int,
+    runs: int,
+    chances: Optional[int] = None,
+    seed: Optional[int] = None,
+    chunk_elements: int = CHUNK_ELEMENTS,
+) -> 'np.ndarray':
+    """
+    Plays `runs` games with NumPy and returns an array of booleans, one per game,
+    which is true if every prisoner found their slip. A game is won exactly when
+    its longest loop is no longer than `chances`, which defaults to half of
+    `count`, as in `run_optimized`.
+    """
+    if chances is None:
+        chances = int(count / 2)
+
+    rng = np.random.default_rng(seed)
+    chunk = max(1, chunk_elements // count)
+    wins = np.empty(runs, dtype=bool)
+
+    for start in range(0, runs, chunk):
+        trials = min(chunk, runs - start)
+        wins[start:start + trials] = longest_loops_vectorized(count, trials, rng) <= chances
+
+    return wins
+
+
+def _parse_args() -> argparse.Namespace:
+    parser = argparse.ArgumentParser(description="Simulates the hundred prisoners riddle.")
+    parser.add_argument('-p', '--prisoners', type=int, default=100)
+    parser.add_argument('-c', '--chances', type=int, default=None,
+                        help='boxes each prisoner may open (default: half the prisoners)')
+    parser.add_argument('-i', '--iterations', type=int, default=100_000)
+    parser.add_argument('-t', '--threads', type=int, default=0,
+                        help='threads for the C extension, or 0 for one per CPU')
+    parser.add_argument('--seed', type=int, default=None)
+    parser.add_argument('--engine', choices=('auto', 'extension', 'numpy', 'python'),
+                        default='auto',
+                        help='the C extension, NumPy or pure Python; auto picks the '
+                             'first of those that is available')
+
+    return parser.parse_args()
+
+
 if __name__ == '__main__':
-    count = 100
-    runs = 100_000
+    args = _parse_args()
+    count = args.prisoners
+    chances = args.chances if args.chances is not None else int(count / 2)
+    runs = args.iterations
+    engine = args.engine
     wins = 0
 
-    BOXES = [x for x in range(count)]
+    if engine == 'auto':
+        engine = 'extension' if _prisoner is not None else 'numpy' if np is not None else 'python'
+
+    if (engine == 'extension' and _prisoner is None) or (engine == 'numpy' and np is None):
+        raise SystemExit(f'the {engine} engine is not available')
+
+    start = time.perf_counter()
+
+    if engine == 'extension':
+        wins = _prisoner.run(runs, threads=args.threads, prisoners=count, chances=chances,
+                             seed=args.seed)
+    elif engine == 'numpy':
+        wins = int(run_vectorized(count, runs, chances, args.seed).sum())
+    else:
+        random.seed(args.seed)
+        BOXES = [x for x in range(count)]
+
+        for _ in range(runs):
+            wins += int(run_optimized(count, chances))
 
-    for _ in range(runs):
-        wins += int(run_optimized(count))
+    duration = time.perf_counter() - start
 
-    print(f'completed! of {runs:,} runs, {wins:,} were successful ({(wins / runs) * 100:.2f}%)')
+    # The same summary line as the other implementations print.
+    print(f'complete in {duration:.3f} seconds! of {runs} runs, {wins} were successful '
+          f'({(wins / runs) * 100:.2f}%)')
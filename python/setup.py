@@ -0,0 +1,20 @@
+from setuptools import Extension, setup
+
+# The extension is built straight from the C library's sources, so it always
+# matches the `prisoner` binary built from the same checkout.
+setup(
+    name='prisoner',
+    version='0.1.0',
+    py_modules=['prisoner'],
+    ext_modules=[
+        Extension(
+            '_prisoner',
+            sources=['_prisoner.c', '../c/libprisoner.c', '../c/counters.c', '../c/latency.c',
+                     '../c/trace.c', '../c/lehmer.c',
+                     '../c/corpus.c'],
+            include_dirs=['../c'],
+            extra_compile_args=['-O2', '-pthread'],
+            extra_link_args=['-pthread'],
+        ),
+    ],
+)
@@ -1,10 +1,41 @@
 use std::fmt;
-use std::sync::mpsc::channel;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::thread;
 use std::time::Instant;
 
 use clap::Parser;
 use rand::{rngs::SmallRng, seq::SliceRandom, Rng, SeedableRng};
-use threadpool::ThreadPool;
+
+/// Worker threads claim iterations in chunks of this size, so a thread that falls
+/// behind simply claims fewer chunks rather than holding everyone else up.
+const CHUNK_SIZE: usize = 4096;
+
+/// The integer type stored in each box. The narrowest one that can number every
+/// prisoner is chosen at startup, to keep the boxes as small as possible.
+trait Index: Copy + Eq + Send + Sync + 'static {
+    fn from_usize(value: usize) -> Self;
+    fn to_usize(self) -> usize;
+}
+
+macro_rules! impl_index {
+    ($($ty:ty),*) => {
+        $(
+            impl Index for $ty {
+                #[inline(always)]
+                fn from_usize(value: usize) -> Self {
+                    value as $ty
+                }
+
+                #[inline(always)]
+                fn to_usize(self) -> usize {
+                    self as usize
+                }
+            }
+        )*
+    };
+}
+
+impl_index!(u8, u16, u32, usize);
 
 #[derive(Parser, Clone)]
 struct Args {
@@ -22,6 +53,10 @@ struct Args {
 
     #[clap(short, long, value_parser, default_value_t = 1_000_000)]
     iterations: usize,
+
+    /// The number of worker threads, or 0 to use every available core.
+    #[clap(short, long, value_parser, default_value_t = 0)]
+    threads: usize,
 }
 
 impl fmt::Display for Args {
@@ -35,31 +70,44 @@ impl fmt::Display for Args {
     }
 }
 
-struct Setup {
-    pub boxes: Vec<usize>,
+struct Setup<T: Index> {
+    pub boxes: Vec<T>,
     pub slips_seen: Vec<bool>,
 
     pub count: usize,
     pub chances: usize,
 
     rng: SmallRng,
+
+    // Scratch space for the strategies, allocated once and reused by every trial.
+    found: Vec<bool>,
+    opened_boxes: Vec<bool>,
+    to_open: Vec<T>,
 }
 
-impl Setup {
-    fn new(args: &Args, thread_rng: &mut rand::rngs::ThreadRng) -> Setup {
+impl<T: Index> Setup<T> {
+    fn new(args: &Args, thread_rng: &mut rand::rngs::ThreadRng) -> Setup<T> {
         // There are `count` numbered slips and `count` numbered boxes, one for each
         // prisoner, and each slip is randomly placed in a box.
-        let slips_seen: Vec<bool> = match args.optimized {
-            true => vec![false; args.prisoners],
-            false => vec![],
-        };
+        Setup::with_boxes(
+            (0..args.prisoners).map(T::from_usize).collect(),
+            args.chances,
+            SmallRng::from_rng(thread_rng).unwrap(),
+        )
+    }
+
+    fn with_boxes(boxes: Vec<T>, chances: usize, rng: SmallRng) -> Setup<T> {
+        let count = boxes.len();
 
         Setup {
-            boxes: (0..args.prisoners).collect(),
-            slips_seen,
-            count: args.prisoners,
-            chances: args.chances,
-            rng: SmallRng::from_rng(thread_rng).unwrap(),
+            boxes,
+            slips_seen: vec![false; count],
+            count,
+            chances,
+            rng,
+            found: vec![false; count],
+            opened_boxes: vec![false; count],
+            to_open: (0..count).map(T::from_usize).collect(),
         }
     }
 
@@ -122,14 +170,14 @@ impl Setup {
 /// with no slip getting the same box. Finally, the prisoners are iterated through,
 /// and each one gets fifty tries to find their slip, by starting with the box
 /// corresponding to their number, as described above.
-fn run(setup: &mut Setup) -> bool {
-    let mut prisoners: Vec<bool> = vec![false; setup.count];
+fn run<T: Index>(setup: &mut Setup<T>) -> bool {
+    setup.found.fill(false);
 
-    for (prisoner, found) in prisoners.iter_mut().enumerate() {
+    for (prisoner, found) in setup.found.iter_mut().enumerate() {
         let mut next_box: usize = prisoner;
 
         for _ in 0..setup.chances {
-            let slip = setup.boxes[next_box];
+            let slip = setup.boxes[next_box].to_usize();
 
             match slip == prisoner {
                 true => {
@@ -141,7 +189,7 @@ fn run(setup: &mut Setup) -> bool {
         }
     }
 
-    prisoners.into_iter().all(|found| found)
+    setup.found.iter().all(|found| *found)
 }
 
 /// This version of the solution has two optimizations. The first is that if any of the
@@ -149,7 +197,7 @@ fn run(setup: &mut Setup) -> bool {
 /// any previously seen slip is cached -- if the slip has been seen by a previous
 /// prisoner, and the function didn't exit early, that means that the slip is
 /// necessarily in a loop that does not contain more than fifty boxes.
-fn run_optimized(setup: &mut Setup) -> bool {
+fn run_optimized<T: Index>(setup: &mut Setup<T>) -> bool {
     for prisoner in 0..setup.count {
         let mut next_box: usize = prisoner;
 
@@ -165,7 +213,7 @@ fn run_optimized(setup: &mut Setup) -> bool {
                 return false;
             }
 
-            let slip = setup.boxes[next_box];
+            let slip = setup.boxes[next_box].to_usize();
 
             setup.slips_seen[slip] = true;
             match slip == prisoner {
@@ -180,11 +228,13 @@ fn run_optimized(setup: &mut Setup) -> bool {
 
 /// The below function is the naive approach to the problem. Each of the prisoners picks
 /// a random box to open. They have 50 attempts to pick the box with their number in it.
-fn run_naive(setup: &mut Setup) -> bool {
-    let mut prisoners: Vec<bool> = vec![false; setup.count];
-    let mut opened_boxes: Vec<bool> = prisoners.clone();
+fn run_naive<T: Index>(setup: &mut Setup<T>) -> bool {
+    let opened_boxes = &mut setup.opened_boxes;
 
-    for (prisoner, found) in prisoners.iter_mut().enumerate() {
+    setup.found.fill(false);
+    opened_boxes.fill(false);
+
+    for (prisoner, found) in setup.found.iter_mut().enumerate() {
         for _ in 0..setup.chances {
             let mut to_open: usize;
 
@@ -197,7 +247,7 @@ fn run_naive(setup: &mut Setup) -> bool {
                 }
             }
 
-            if setup.boxes[to_open] == prisoner {
+            if setup.boxes[to_open].to_usize() == prisoner {
                 *found = true;
                 break;
             }
@@ -206,21 +256,30 @@ fn run_naive(setup: &mut Setup) -> bool {
         opened_boxes.fill(false);
     }
 
-    !prisoners.into_iter().any(|found| !found)
+    !setup.found.iter().any(|found| !found)
 }
 
-/// The below function is an optimized version of the naive logic.
-fn run_naive_optimized(setup: &mut Setup) -> bool {
-    let mut to_open: Vec<usize> = setup.boxes.clone();
+/// The below function is an optimized version of the naive logic. A prisoner only
+/// ever opens `chances` boxes, so only that many steps of a Fisher-Yates shuffle
+/// are needed to choose them, and they stop as soon as they find their slip. Any
+/// prisoner who misses ends the game for everyone.
+fn run_naive_optimized<T: Index>(setup: &mut Setup<T>) -> bool {
+    let to_open = &mut setup.to_open;
+    let attempts = setup.chances.min(setup.count);
 
     for prisoner in 0..setup.count {
-        to_open.shuffle(&mut setup.rng);
+        let mut found = false;
+
+        for opened in 0..attempts {
+            to_open.swap(opened, setup.rng.gen_range(opened..setup.count));
 
-        if !to_open
-            .iter()
-            .take(setup.chances)
-            .any(|number| *number == prisoner)
-        {
+            if setup.boxes[to_open[opened].to_usize()].to_usize() == prisoner {
+                found = true;
+                break;
+            }
+        }
+
+        if !found {
             return false;
         }
     }
@@ -228,46 +287,68 @@ fn run_naive_optimized(setup: &mut Setup) -> bool {
     true
 }
 
-fn main() {
-    let threads: usize = 16;
-    let pool = ThreadPool::new(16);
-    let (tx, rx) = channel();
-
-    let args = Args::parse();
-
-    let handler = match (&args.version[..], args.optimized) {
+/// Runs every iteration across the worker threads and returns the number of wins.
+fn simulate<T: Index>(args: &Args, threads: usize) -> u64 {
+    let handler: fn(&mut Setup<T>) -> bool = match (&args.version[..], args.optimized) {
         ("naive", false) => run_naive,
         ("naive", true) => run_naive_optimized,
         (_, false) => run,
         (_, true) => run_optimized,
     };
 
-    let start = Instant::now();
-
-    for i in 0..threads {
-        let tx = tx.clone();
-        let args = args.clone();
-        let to_execute = match i + 1 == threads {
-            true => (args.iterations / threads) + (args.iterations % threads),
-            false => args.iterations / threads,
-        };
-
-        pool.execute(move || {
-            let mut thread_rng = rand::thread_rng();
-            let mut wins: u32 = 0;
-            let mut setup: Setup = Setup::new(&args, &mut thread_rng);
+    let chunks = (args.iterations + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    let next_chunk = AtomicUsize::new(0);
+
+    thread::scope(|scope| {
+        let workers: Vec<_> = (0..threads.min(chunks.max(1)))
+            .map(|_| {
+                scope.spawn(|| {
+                    let mut thread_rng = rand::thread_rng();
+                    let mut setup: Setup<T> = Setup::new(args, &mut thread_rng);
+                    let mut wins: u64 = 0;
+
+                    loop {
+                        let chunk = next_chunk.fetch_add(1, Ordering::Relaxed);
+
+                        if chunk >= chunks {
+                            break wins;
+                        }
+
+                        let to_execute = CHUNK_SIZE.min(args.iterations - chunk * CHUNK_SIZE);
+
+                        for _ in 0..to_execute {
+                            setup.reset();
+
+                            wins += handler(&mut setup) as u64;
+                        }
+                    }
+                })
+            })
+            .collect();
+
+        workers
+            .into_iter()
+            .map(|worker| worker.join().unwrap())
+            .sum()
+    })
+}
 
-            for _ in 0..to_execute {
-                setup.reset();
+fn main() {
+    let args = Args::parse();
 
-                wins += handler(&mut setup) as u32;
-            }
+    let threads = match args.threads {
+        0 => thread::available_parallelism().map_or(1, |count| count.get()),
+        count => count,
+    };
 
-            tx.send(wins).unwrap();
-        });
-    }
+    let start = Instant::now();
 
-    let wins: u32 = rx.iter().take(threads).sum();
+    let wins = match args.prisoners {
+        count if count <= 1 << 8 => simulate::<u8>(&args, threads),
+        count if count <= 1 << 16 => simulate::<u16>(&args, threads),
+        count if count as u64 <= 1 << 32 => simulate::<u32>(&args, threads),
+        _ => simulate::<usize>(&args, threads),
+    };
 
     let finished = start.elapsed();
 
@@ -287,13 +368,11 @@ mod tests {
     #[test]
     fn test_run_success_known_layout() {
         // Use the box layout from the documentation above.
-        let mut setup = Setup {
-            boxes: vec![4, 3, 9, 2, 7, 8, 6, 5, 0, 1],
-            slips_seen: vec![],
-            count: 10,
-            chances: 5,
-            rng: SmallRng::from_entropy(),
-        };
+        let mut setup = Setup::<usize>::with_boxes(
+            vec![4, 3, 9, 2, 7, 8, 6, 5, 0, 1],
+            5,
+            SmallRng::from_entropy(),
+        );
 
         assert!(run(&mut setup));
     }
@@ -301,13 +380,11 @@ mod tests {
     #[test]
     fn test_run_failure_known_layout() {
         // If the box layout contains a loop longer than n-chances, they always fail.
-        let mut setup = Setup {
-            boxes: vec![1, 2, 3, 4, 5, 6, 7, 8, 9, 0],
-            slips_seen: vec![],
-            count: 10,
-            chances: 5,
-            rng: SmallRng::from_entropy(),
-        };
+        let mut setup = Setup::<usize>::with_boxes(
+            vec![1, 2, 3, 4, 5, 6, 7, 8, 9, 0],
+            5,
+            SmallRng::from_entropy(),
+        );
 
         assert_eq!(run(&mut setup), false);
     }
@@ -315,13 +392,11 @@ mod tests {
     #[test]
     fn test_run_optimized_success_known_layout() {
         // Use the box layout from the documentation above.
-        let mut setup = Setup {
-            boxes: vec![4, 3, 9, 2, 7, 8, 6, 5, 0, 1],
-            slips_seen: vec![false; 10],
-            count: 10,
-            chances: 5,
-            rng: SmallRng::from_entropy(),
-        };
+        let mut setup = Setup::<usize>::with_boxes(
+            vec![4, 3, 9, 2, 7, 8, 6, 5, 0, 1],
+            5,
+            SmallRng::from_entropy(),
+        );
 
         assert!(run_optimized(&mut setup));
     }
@@ -329,13 +404,11 @@ mod tests {
     #[test]
     fn test_run_optimized_failure_known_layout() {
         // If the box layout contains a loop longer than n-chances, they always fail.
-        let mut setup = Setup {
-            boxes: vec![1, 2, 3, 4, 5, 6, 7, 8, 9, 0],
-            slips_seen: vec![false; 10],
-            count: 10,
-            chances: 5,
-            rng: SmallRng::from_entropy(),
-        };
+        let mut setup = Setup::<usize>::with_boxes(
+            vec![1, 2, 3, 4, 5, 6, 7, 8, 9, 0],
+            5,
+            SmallRng::from_entropy(),
+        );
 
         assert_eq!(run_optimized(&mut setup), false);
     }
@@ -344,13 +417,11 @@ mod tests {
     fn test_run_naive_success_known_layout() {
         // Use the box layout from the documentation above. If the prisoner gets
         // chances = count, they will always win.
-        let mut setup = Setup {
-            boxes: vec![4, 3, 9, 2, 7, 8, 6, 5, 0, 1],
-            slips_seen: vec![],
-            count: 10,
-            chances: 10,
-            rng: SmallRng::from_entropy(),
-        };
+        let mut setup = Setup::<usize>::with_boxes(
+            vec![4, 3, 9, 2, 7, 8, 6, 5, 0, 1],
+            10,
+            SmallRng::from_entropy(),
+        );
 
         assert!(run_naive(&mut setup));
     }
@@ -359,13 +430,11 @@ mod tests {
     fn test_run_naive_failure_known_layout() {
         // Use the box layout from the documentation above. If the prisoner gets
         // no chances, they will always lose.
-        let mut setup = Setup {
-            boxes: vec![4, 3, 9, 2, 7, 8, 6, 5, 0, 1],
-            slips_seen: vec![],
-            count: 10,
-            chances: 0,
-            rng: SmallRng::from_entropy(),
-        };
+        let mut setup = Setup::<usize>::with_boxes(
+            vec![4, 3, 9, 2, 7, 8, 6, 5, 0, 1],
+            0,
+            SmallRng::from_entropy(),
+        );
 
         assert!(!run_naive(&mut setup));
     }
@@ -374,13 +443,11 @@ mod tests {
     fn test_run_naive_optimized_success_known_layout() {
         // Use the box layout from the documentation above. If the prisoner gets
         // chances = count, they will always win.
-        let mut setup = Setup {
-            boxes: vec![4, 3, 9, 2, 7, 8, 6, 5, 0, 1],
-            slips_seen: vec![],
-            count: 10,
-            chances: 10,
-            rng: SmallRng::from_entropy(),
-        };
+        let mut setup = Setup::<usize>::with_boxes(
+            vec![4, 3, 9, 2, 7, 8, 6, 5, 0, 1],
+            10,
+            SmallRng::from_entropy(),
+        );
 
         assert!(run_naive_optimized(&mut setup));
     }
@@ -389,14 +456,118 @@ mod tests {
     fn test_run_naive_optimized_failure_known_layout() {
         // Use the box layout from the documentation above. If the prisoner gets
         // no chances, they will always lose.
-        let mut setup = Setup {
-            boxes: vec![4, 3, 9, 2, 7, 8, 6, 5, 0, 1],
-            slips_seen: vec![],
-            count: 10,
-            chances: 0,
-            rng: SmallRng::from_entropy(),
-        };
+        let mut setup = Setup::<usize>::with_boxes(
+            vec![4, 3, 9, 2, 7, 8, 6, 5, 0, 1],
+            0,
+            SmallRng::from_entropy(),
+        );
 
         assert!(!run_naive_optimized(&mut setup));
     }
+
+    #[test]
+    fn test_scratch_reused_between_trials() {
+        // The scratch buffers carry over from one trial to the next, so a winning
+        // layout must not leak into the verdict on a losing one.
+        let mut setup = Setup::<usize>::with_boxes(
+            vec![4, 3, 9, 2, 7, 8, 6, 5, 0, 1],
+            5,
+            SmallRng::from_entropy(),
+        );
+
+        assert!(run(&mut setup));
+
+        setup.boxes = vec![1, 2, 3, 4, 5, 6, 7, 8, 9, 0];
+
+        assert!(!run(&mut setup));
+    }
+
+    #[test]
+    fn test_compact_index_matches_usize() {
+        // The documented layout's longest loop has 5 boxes, and the cycle's has 10.
+        let documented = [4, 3, 9, 2, 7, 8, 6, 5, 0, 1];
+        let cycle = [1, 2, 3, 4, 5, 6, 7, 8, 9, 0];
+        let strategies: [(
+            &str,
+            fn(&mut Setup<u16>) -> bool,
+            fn(&mut Setup<usize>) -> bool,
+        ); 4] = [
+            ("run", run, run),
+            ("run_optimized", run_optimized, run_optimized),
+            ("run_naive", run_naive, run_naive),
+            (
+                "run_naive_optimized",
+                run_naive_optimized,
+                run_naive_optimized,
+            ),
+        ];
+        // Each layout, chances and the known outcome, for the loop strategies and
+        // then for the naive ones, which are only certain with every box or none.
+        let loop_cases = [
+            (&documented, 5, true),
+            (&documented, 4, false),
+            (&cycle, 5, false),
+        ];
+        let naive_cases = [
+            (&documented, 10, true),
+            (&documented, 0, false),
+            (&cycle, 0, false),
+        ];
+
+        for (name, narrow_strategy, wide_strategy) in strategies {
+            let cases = if name.starts_with("run_naive") {
+                naive_cases
+            } else {
+                loop_cases
+            };
+
+            for (layout, chances, won) in cases {
+                // A fresh setup for every strategy, since their scratch state
+                // carries over from one call to the next.
+                let mut narrow = Setup::<u16>::with_boxes(
+                    layout.iter().map(|slip| *slip as u16).collect(),
+                    chances,
+                    SmallRng::seed_from_u64(7),
+                );
+                let mut wide = Setup::<usize>::with_boxes(
+                    layout.to_vec(),
+                    chances,
+                    SmallRng::seed_from_u64(7),
+                );
+
+                assert_eq!(
+                    narrow_strategy(&mut narrow),
+                    won,
+                    "{} with u16, {} chances",
+                    name,
+                    chances
+                );
+                assert_eq!(
+                    wide_strategy(&mut wide),
+                    won,
+                    "{} with usize, {} chances",
+                    name,
+                    chances
+                );
+            }
+        }
+
+        // The shuffle only depends on the length, so the same seed arranges both
+        // index types the same way.
+        let mut narrow = Setup::<u16>::with_boxes(
+            documented.iter().map(|slip| *slip as u16).collect(),
+            5,
+            SmallRng::seed_from_u64(7),
+        );
+        let mut wide =
+            Setup::<usize>::with_boxes(documented.to_vec(), 5, SmallRng::seed_from_u64(7));
+
+        narrow.reset();
+        wide.reset();
+
+        let narrow_boxes: Vec<usize> = narrow.boxes.iter().map(|slip| slip.to_usize()).collect();
+
+        assert_eq!(narrow_boxes, wide.boxes);
+        assert_eq!(run_optimized(&mut narrow), run_optimized(&mut wide));
+    }
 }
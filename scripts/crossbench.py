@@ -0,0 +1,336 @@
+"""
+Builds and runs every implementation of the simulation with the same parameters,
+checks that their success rates agree with each other and with the exact
+probability, and reports how fast each one is.
+
+Every implementation prints the same summary line, and the C one can also report
+as JSON Lines, which is read instead where it is available. Either way each run
+becomes one record:
+
+    implementation, engine, threads, prisoners, chances, trials, wins, rate,
+    ci_low, ci_high, seconds, wall_seconds, trials_per_second
+
+`seconds` is the time the implementation reports for the simulation itself, and
+`wall_seconds` includes starting up. Run from anywhere; paths are relative to
+the repository root.
+"""
+
+import argparse
+import json
+import math
+import os
+import re
+import statistics
+import subprocess
+import sys
+import time
+from dataclasses import asdict, dataclass
+from typing import Dict, List, Optional, Tuple
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+SUMMARY = re.compile(
+    r'complete in (?P<seconds>[\d.]+) seconds! of (?P<trials>\d+) runs, '
+    r'(?P<wins>\d+) were successful'
+)
+
+# 95% two-sided.
+Z_CONFIDENCE = 1.959964
+
+
+@dataclass
+class Implementation:
+    name: str
+    engine: str
+    build: Optional[List[str]]
+    build_dir: str
+    command: List[str]
+    threaded: bool
+    seeded: bool
+    # Pure Python is too slow to run as many trials as the others.
+    max_trials: Optional[int] = None
+    # Whether it takes `--format jsonl` and prints a record rather than a summary.
+    structured: bool = False
+
+
+@dataclass
+class Record:
+    implementation: str
+    engine: str
+    threads: int
+    prisoners: int
+    chances: int
+    trials: int
+    wins: int
+    rate: float
+    ci_low: float
+    ci_high: float
+    seconds: float
+    wall_seconds: float
+    trials_per_second: float
+    repetitions: int
+
+
+IMPLEMENTATIONS = [
+    Implementation(
+        'c', 'libprisoner', ['make', 'prisoner'], 'c', ['c/prisoner'], True, True,
+        structured=True,
+    ),
+    Implementation('cpp', 'header', ['make', 'prisoner'], 'cpp', ['cpp/prisoner'], False, True),
+    Implementation(
+        'rust', 'solved-optimized', ['cargo', 'build', '--release'], 'rust',
+        ['rust/target/release/prisoner', '-v', 'solved', '--optimized'], True, False,
+    ),
+    Implementation(
+        'python', 'extension', [sys.executable, 'setup.py', 'build_ext', '--inplace'], 'python',
+        [sys.executable, 'python/prisoner.py', '--engine', 'extension'], True, True,
+    ),
+    Implementation(
+        'python', 'numpy', None, 'python',
+        [sys.executable, 'python/prisoner.py', '--engine', 'numpy'], False, True,
+    ),
+    Implementation(
+        'python', 'python', None, 'python',
+        [sys.executable, 'python/prisoner.py', '--engine', 'python'], False, True,
+        max_trials=100_000,
+    ),
+]
+
+
+def exact_rate(prisoners: int, chances: int) -> float:
+    """
+    The probability that a uniformly random permutation of `prisoners` has no loop
+    longer than `chances`, which is exactly the probability of winning. Summing
+    over the length of the loop through the first box gives
+    a(n) = (1/n) * sum(a(n - k) for k in 1..min(chances, n)), with a(0) = 1.
+    """
+    a = [1.0] + [0.0] * prisoners
+    window = 1.0
+
+    # `window` is the sum of the last `chances` values of a.
+    for n in range(1, prisoners + 1):
+        a[n] = window / n
+        window += a[n]
+
+        if n >= chances:
+            window -= a[n - chances]
+
+    return a[prisoners]
+
+
+def wilson_interval(wins: int, trials: int) -> Tuple[float, float]:
+    p = wins / trials
+    z2 = Z_CONFIDENCE ** 2
+    centre = (p + z2 / (2 * trials)) / (1 + z2 / trials)
+    half = Z_CONFIDENCE * math.sqrt(p * (1 - p) / trials + z2 / (4 * trials ** 2)) / (1 + z2 / trials)
+
+    return centre - half, centre + half
+
+
+def build(implementation: Implementation, built: Dict[str, bool]) -> bool:
+    key = ' '.join(implementation.build or []) + implementation.build_dir
+
+    if implementation.build is None:
+        return True
+
+    if key not in built:
+        result = subprocess.run(
+            implementation.build, cwd=os.path.join(ROOT, implementation.build_dir),
+            stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True,
+        )
+        built[key] = result.returncode == 0
+
+        if result.returncode != 0:
+            print(f'skipping {implementation.name} ({implementation.engine}): build failed:\n'
+                  f'{result.stderr.strip()[-2000:]}', file=sys.stderr)
+
+    return built[key]
+
+
+def run_once(implementation: Implementation, args: argparse.Namespace, trials: int,
+             threads: int, seed: int) -> Optional[dict]:
+    command = implementation.command + [
+        '--prisoners', str(args.prisoners),
+        '--chances', str(args.chances),
+        '--iterations', str(trials),
+    ]
+
+    if implementation.threaded:
+        command += ['--threads', str(threads)]
+
+    if implementation.seeded:
+        command += ['--seed', str(seed)]
+
+    if implementation.structured:
+        command += ['--format', 'jsonl']
+
+    start = time.perf_counter()
+    result = subprocess.run(command, cwd=ROOT, capture_output=True, text=True)
+    wall = time.perf_counter() - start
+    parsed = parse_output(result.stdout, implementation.structured)
+
+    if result.returncode != 0 or parsed is None:
+        print(f'skipping {implementation.name} ({implementation.engine}): '
+              f'{" ".join(command)} failed:\n{result.stderr.strip()[-2000:]}', file=sys.stderr)
+        return None
+
+    parsed['wall_seconds'] = wall
+
+    return parsed
+
+
+def parse_output(stdout: str, structured: bool) -> Optional[dict]:
+    if structured:
+        try:
+            record = json.loads(stdout.strip().splitlines()[-1])
+        except (IndexError, ValueError):
+            return None
+
+        return {key: record[key] for key in ('seconds', 'trials', 'wins', 'threads')}
+
+    match = SUMMARY.search(stdout)
+
+    if match is None:
+        return None
+
+    return {
+        'seconds': float(match['seconds']),
+        'trials': int(match['trials']),
+        'wins': int(match['wins']),
+    }
+
+
+def measure(implementation: Implementation, args: argparse.Namespace,
+            threads: int) -> Optional[Record]:
+    trials = args.iterations
+
+    if implementation.max_trials is not None:
+        trials = min(trials, implementation.max_trials)
+
+    runs = []
+
+    # Every repetition gets its own seed, so together they form one larger sample.
+    for repetition in range(args.repetitions):
+        run = run_once(implementation, args, trials, threads, args.seed + repetition)
+
+        if run is None:
+            return None
+
+        runs.append(run)
+
+    total_trials = sum(run['trials'] for run in runs)
+    total_wins = sum(run['wins'] for run in runs)
+    seconds = statistics.median(run['seconds'] for run in runs)
+    ci_low, ci_high = wilson_interval(total_wins, total_trials)
+
+    # Record the threads that actually ran rather than 0 for one per CPU, so
+    # records from different machines can be compared.
+    if 'threads' in runs[0]:
+        threads = runs[0]['threads']
+    elif threads == 0:
+        threads = os.cpu_count() or 1
+
+    return Record(
+        implementation=implementation.name,
+        engine=implementation.engine,
+        threads=threads,
+        prisoners=args.prisoners,
+        chances=args.chances,
+        trials=total_trials,
+        wins=total_wins,
+        rate=total_wins / total_trials,
+        ci_low=ci_low,
+        ci_high=ci_high,
+        seconds=seconds,
+        wall_seconds=statistics.median(run['wall_seconds'] for run in runs),
+        trials_per_second=trials / seconds if seconds > 0 else math.inf,
+        repetitions=len(runs),
+    )
+
+
+def agreement(records: List[Record], expected: float, alpha: float) -> List[str]:
+    """
+    Tests every record against the exact rate with a two-sided binomial z-test,
+    Bonferroni-corrected across records, and returns a description of each failure.
+    """
+    failures = []
+    threshold = abs(statistics.NormalDist().inv_cdf(alpha / (2 * max(1, len(records)))))
+
+    for record in records:
+        spread = math.sqrt(record.trials * expected * (1 - expected))
+        z = (record.wins - record.trials * expected) / spread if spread > 0 else 0
+
+        if abs(z) > threshold:
+            failures.append(
+                f'{record.implementation} ({record.engine}, {record.threads} threads): '
+                f'{record.rate:.5f} is {z:+.1f} standard errors from {expected:.5f}'
+            )
+
+    return failures
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__.strip().split('\n\n')[0])
+    parser.add_argument('-p', '--prisoners', type=int, default=100)
+    parser.add_argument('-c', '--chances', type=int, default=None,
+                        help='boxes each prisoner may open (default: half the prisoners)')
+    parser.add_argument('-i', '--iterations', type=int, default=1_000_000)
+    parser.add_argument('-t', '--threads', default='1,0',
+                        help='comma-separated thread counts for the implementations '
+                             'that take one, 0 meaning one per CPU (default: 1,0)')
+    parser.add_argument('-r', '--repetitions', type=int, default=3)
+    parser.add_argument('--only', default=None,
+                        help='comma-separated implementations or engines to run')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--alpha', type=float, default=0.001,
+                        help='family-wise significance level for the agreement test')
+    parser.add_argument('--no-build', action='store_true')
+    parser.add_argument('--jsonl', default=None, help='also write the records to this file')
+    args = parser.parse_args()
+
+    if args.chances is None:
+        args.chances = args.prisoners // 2
+
+    thread_counts = [int(value) for value in args.threads.split(',')]
+    only = set(args.only.split(',')) if args.only else None
+    built: Dict[str, bool] = {}
+    records: List[Record] = []
+
+    for implementation in IMPLEMENTATIONS:
+        if only is not None and implementation.name not in only and implementation.engine not in only:
+            continue
+
+        if not args.no_build and not build(implementation, built):
+            continue
+
+        for threads in thread_counts if implementation.threaded else [1]:
+            record = measure(implementation, args, threads)
+
+            if record is None:
+                break
+
+            records.append(record)
+            print(f'{record.implementation:8} {record.engine:18} {record.threads:>3} threads  '
+                  f'{record.rate * 100:7.3f}% [{record.ci_low * 100:.3f}, {record.ci_high * 100:.3f}]  '
+                  f'{record.trials_per_second:14,.0f} trials/s  ({record.wall_seconds:.3f}s wall)',
+                  flush=True)
+
+    if args.jsonl is not None:
+        with open(args.jsonl, 'w') as output:
+            for record in records:
+                output.write(json.dumps(asdict(record)) + '\n')
+
+    expected = exact_rate(args.prisoners, args.chances)
+    failures = agreement(records, expected, args.alpha)
+
+    print(f'exact rate {expected * 100:.3f}%: '
+          f'{len(records) - len(failures)} of {len(records)} runs agree')
+
+    for failure in failures:
+        print(f'  disagrees: {failure}')
+
+    return 1 if failures or not records else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())